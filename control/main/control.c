@@ -17,11 +17,34 @@
 
 // --- Includes ----------------------------------------------------------------
 
+#include <freertos/FreeRTOS.h> // pre 4.1, IDF headers depend on these two
+#include <freertos/task.h>
+
+#include <assert.h>
 #include <esp_event.h>
+#include <esp_heap_caps.h>
 #include <esp_log.h>
+#include <esp_timer.h>
+#include <nvs.h>
 #include <nvs_flash.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
 
+#include <encode.h>
+#include <jitter.h>
+#include <net.h>
 #include <panel.h>
+#include <play.h>
+#include <prof.h>
+#include <proto.h>
+#include <show.h>
+#include <stats.h>
+#include <store.h>
+#include <stream.h>
+#include <trace.h>
+#include <upload.h>
 #include <util.h>
 #include <wifi.h>
 
@@ -31,13 +54,102 @@
 
 #define GPIO_NO_1 4
 #define GPIO_NO_2 5
+// For clocked LEDs, see encode_chip_t.
+#define GPIO_NO_CLOCK 18
+
+// The LEDs, see encode_chip_id_t, unless NVS_KEY names others, see
+// get_chip(). That way, one build drives installations with different LEDs.
+#ifndef PANEL_CHIP
+#define PANEL_CHIP ENCODE_CHIP_WS2815
+#endif
+
+#define NVS_NAMESPACE "nn"
+#define NVS_KEY "chip"
+#define MAX_CHIP_NAME 16
+
+// The largest panel, in pixels, that compressed shows and streams can be
+// played on. Buffers for its frames are set aside at boot, see
+// reserve_buffers(). Uncompressed shows play from flash and may be larger.
+#ifndef PANEL_MAX_WIDTH
+#define PANEL_MAX_WIDTH 40
+#endif
+
+#ifndef PANEL_MAX_HEIGHT
+#define PANEL_MAX_HEIGHT 20
+#endif
+
+// Number of decoded key frames to keep around for seeking.
+#define N_KEY_SLOTS 4
+
+// Don't sleep longer than this without checking for new cues.
+#define MAX_WAIT_US 100000
+
+// Log the jitter buffer statistics this often, while streaming.
+#define STATS_INTERVAL_US 10000000
+
+// Whenever the output switches between the stream, the show and the idle
+// effect, cross-fade over this long. Only frames of up to MAX_FADE_SZ bytes
+// are faded from, larger ones fade in from black.
+#define FADE_US 500000
+#define MAX_FADE_SZ (JITTER_MAX_PARTS * STREAM_PART_SZ)
+
+// With nothing to play, the last frame dims down over IDLE_FADE_US and then
+// slowly breathes between these weights, see panel_render_mix().
+#define IDLE_FADE_US 2000000
+#define IDLE_PERIOD_US 4000000
+#define IDLE_MIN_WEIGHT 32
+#define IDLE_MAX_WEIGHT 96
+#define IDLE_FRAME_MS 20
+
+#define STACK_SZ 4096
+// Above the network tasks, so that nothing delays a refill. Rendering sleeps
+// while the DMA engine sends, see get_dma_buffer() in panel.c, so this
+// doesn't starve anything either. Those tasks are on the other core, anyway.
+#define PRIORITY 7
+// Away from the WiFi driver and the network tasks, which run on core 0.
+#define CORE 1
+
+_Static_assert(PANEL_N_LANES == SHOW_WAVE_LANES, "pre-encoded shows don't fit");
 
 // --- Macros and inline functions ---------------------------------------------
 
 // --- Globals -----------------------------------------------------------------
 
+static const encode_chip_t *g_chip;
+
+// The last frame output, unless we're fading, and when the current fade
+// started. g_idle says whether the idle effect is dimming it.
+static uint8_t g_last[MAX_FADE_SZ];
+static size_t g_last_sz;
+static int64_t g_fade_start;
+static bool g_idle;
+static int64_t g_idle_start;
+
+// Buffers for shows and streams, for frames of up to PANEL_MAX_WIDTH times
+// PANEL_MAX_HEIGHT pixels. They're allocated once, so that the output task
+// never allocates.
+static uint8_t *g_work, *g_cache, *g_pixels;
+static size_t g_work_sz, g_cache_sz, g_pixels_sz;
+
 // --- Helper declarations -----------------------------------------------------
 
+static const encode_chip_t *get_chip(void);
+static void reserve_buffers(void);
+static void output_task(void *arg);
+static void play_show(void);
+static bool reserve_show(size_t frame_sz, uint32_t *n_slots);
+static void play_stream(void);
+static bool reserve_stream(size_t frame_sz);
+static void play_idle(void);
+static void begin_fade(void);
+static void output(const uint8_t *pixels, size_t n_pixels);
+static void output_wave(const uint8_t *masks, size_t n_pixels);
+static void add_stages(const stream_times_t *times, int64_t published,
+        uint32_t cycles);
+static void log_stats(void);
+static bool next_frame(const cue_t *cue, bool fresh, int64_t now,
+        int64_t period, uint32_t n_frames, uint32_t *frame_id, int64_t *at);
+
 // --- API ---------------------------------------------------------------------
 
 #pragma GCC diagnostic push
@@ -48,16 +160,529 @@ void app_main(void)
     ESP_LOGI("NN", "no noise controller");
 
     util_init();
+    trace_init();
+    stats_init();
 
     util_never_fails(nvs_flash_init);
     util_never_fails(esp_event_loop_create_default);
 
-    panel_init(GPIO_NO_1, GPIO_NO_2);
-    wifi_init();
+    g_chip = get_chip();
+    reserve_buffers();
+    panel_init(GPIO_NO_1, GPIO_NO_2, GPIO_NO_CLOCK, g_chip);
+    store_init();
+    net_init();
+    stream_init(g_pixels_sz);
+
+    // Light up right away. Joining the network may take seconds, or forever.
+    // Until it's up, the show in the show partition plays by the local clock.
+
+    BaseType_t res = xTaskCreatePinnedToCore(output_task, "output", STACK_SZ,
+            NULL, PRIORITY, NULL, CORE);
+    assert(res == pdPASS);
 
-    panel_test_pattern();
+    wifi_init();
+    net_start();
+    stream_start();
+    upload_init();
 }
 
 #pragma GCC diagnostic pop
 
 // --- Helpers -----------------------------------------------------------------
+
+// The LEDs that NVS_KEY names, if any, otherwise PANEL_CHIP. Set with, e.g.,
+// a partition image made by nvs_partition_gen.py.
+static const encode_chip_t *get_chip(void)
+{
+    const encode_chip_t *chip = encode_get_chip(PANEL_CHIP);
+    nvs_handle_t nvs;
+
+    // Fails with ESP_ERR_NVS_NOT_FOUND, unless NVS_KEY was ever set.
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) {
+        return chip;
+    }
+
+    char name[MAX_CHIP_NAME];
+    size_t sz = sizeof name;
+    esp_err_t err = nvs_get_str(nvs, NVS_KEY, name, &sz);
+    nvs_close(nvs);
+
+    if (err != ESP_OK) {
+        return chip;
+    }
+
+    const encode_chip_t *named = encode_find_chip(name);
+
+    if (named == NULL) {
+        ESP_LOGE("NN", "unknown LEDs %s", name);
+        return chip;
+    }
+
+    return named;
+}
+
+// Set aside the buffers for the largest frames of the panel, see g_work. If
+// there isn't enough memory, shows and streams get less or nothing at all.
+static void reserve_buffers(void)
+{
+    uint32_t caps = MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT;
+    size_t frame_sz = (size_t)PANEL_MAX_WIDTH * PANEL_MAX_HEIGHT *
+            g_chip->pixel_sz;
+
+    g_work = heap_caps_malloc(frame_sz, caps);
+    g_work_sz = g_work != NULL ? frame_sz : 0;
+
+    for (uint32_t n = N_KEY_SLOTS; n > 0 && g_work != NULL; --n) {
+        g_cache = heap_caps_malloc(n * frame_sz, caps);
+
+        if (g_cache != NULL) {
+            g_cache_sz = n * frame_sz;
+            break;
+        }
+    }
+
+    g_pixels = heap_caps_malloc(frame_sz, caps);
+    g_pixels_sz = g_pixels != NULL ? frame_sz : 0;
+
+    ESP_LOGI("NN", "%zu-byte frames, %zu key frame(s)", frame_sz,
+            g_cache_sz / frame_sz);
+
+    if (g_work == NULL || g_pixels == NULL) {
+        ESP_LOGE("NN", "no memory for frames");
+    }
+}
+
+// Play the show in the show partition, as cued by the host, unless the host
+// streams frames. When the stream stops, fall back to the show. Check for a
+// new show, whenever there isn't one or it's being overwritten.
+static void output_task(void *arg)
+{
+    assert(arg == NULL);
+
+    ESP_LOGI("NN", "output up after %lld ms", esp_timer_get_time() / 1000);
+
+    while (true) {
+        play_stream();
+        play_show();
+
+        // Idle for a second before looking for a show again. Streams start
+        // right away, though.
+
+        play_idle();
+    }
+}
+
+static void play_show(void)
+{
+    static play_t play;
+
+    const show_t *show = store_lock();
+
+    if (show == NULL) {
+        return;
+    }
+
+    // Copy what we need from the header. Once unlocked, the show may be
+    // overwritten at any time.
+
+    const show_header_t *head = show->head;
+
+    uint32_t serial = store_serial();
+    uint32_t n_frames = head->n_frames;
+    int64_t period = 1000000 / head->fps;
+    size_t n_pixels = (size_t)head->width * head->height;
+    bool raw = head->codec == SHOW_CODEC_RAW;
+    bool wave = head->format == SHOW_FORMAT_WAVE;
+    // Pre-encoded shows carry WS2815 timing, see encode_wave().
+
+    bool fits = (wave ? g_chip == encode_get_chip(ENCODE_CHIP_WS2815) :
+            show_pixel_sz(head->format) == g_chip->pixel_sz) &&
+            n_pixels % PANEL_N_LANES == 0;
+
+    size_t frame_sz = show->frame_sz;
+
+    store_unlock();
+
+    if (!fits) {
+        ESP_LOGE("NN", "show doesn't fit panel");
+        return;
+    }
+
+    // Uncompressed frames are rendered straight from flash. Everything else
+    // needs a work buffer and, ideally, a few cached key frames.
+
+    uint32_t n_slots = 0;
+
+    if (!raw && !reserve_show(frame_sz, &n_slots)) {
+        ESP_LOGE("NN", "show frames too large");
+        return;
+    }
+
+    play_init(&play, show, raw ? NULL : g_work, raw ? NULL : g_cache,
+            n_slots);
+    begin_fade();
+
+    // Until the host says otherwise, loop the show, starting at show clock
+    // time 0. As all controllers share the show clock, they all show the same
+    // frame at the same time.
+
+    cue_t active = { .command = COMMAND_START, .frame_id = 0, .at = 0 };
+    cue_t pending;
+    bool have_pending = false;
+    bool fresh = true;
+    uint32_t cue_serial = 0;
+
+    while (!stream_active()) {
+        cue_t cue;
+        uint32_t new_serial = net_cue(&cue);
+
+        if (new_serial != cue_serial) {
+            cue_serial = new_serial;
+            pending = cue;
+            have_pending = true;
+        }
+
+        int64_t now = net_show_time();
+
+        if (have_pending && pending.at <= now) {
+            active = pending;
+            have_pending = false;
+            fresh = true;
+        }
+
+        uint32_t frame_id;
+        int64_t at;
+
+        bool due = next_frame(&active, fresh, now, period, n_frames,
+                &frame_id, &at) && at <= now + MAX_WAIT_US &&
+                (!have_pending || at < pending.at);
+
+        if (!due) {
+            int64_t wake = now + MAX_WAIT_US;
+
+            if (have_pending && pending.at < wake) {
+                wake = pending.at;
+            }
+
+            util_wait_until(net_local_time(wake));
+            continue;
+        }
+
+        if (store_lock() == NULL) {
+            break;
+        }
+
+        if (store_serial() != serial) {
+            store_unlock();
+            break;
+        }
+
+        // Decode ahead of time, so that only rendering is left to do, when
+        // the frame is due.
+
+        prof_t decompress;
+        prof_start(&decompress);
+
+        const uint8_t *pixels = play_frame(&play, frame_id);
+
+        prof_stop(&decompress, PROBE_DECOMPRESS);
+
+        if (pixels != NULL) {
+            util_wait_until(net_local_time(at));
+
+            if (wave) {
+                output_wave(pixels, n_pixels);
+            }
+            else {
+                output(pixels, n_pixels);
+            }
+
+            trace_hot(TRACE_SHOW_FRAME, frame_id, n_pixels);
+        }
+
+        store_unlock();
+
+        if (pixels == NULL) {
+            ESP_LOGE("NN", "bad frame %u", frame_id);
+            break;
+        }
+
+        fresh = false;
+    }
+}
+
+// Check that the buffers that reserve_buffers() set aside can decode a show
+// with frames of the given size, and get the number of key frames that they
+// can cache. Returns false, if there isn't even room for decoding.
+static bool reserve_show(size_t frame_sz, uint32_t *n_slots)
+{
+    if (frame_sz > g_work_sz) {
+        return false;
+    }
+
+    *n_slots = (uint32_t)(g_cache_sz / frame_sz);
+
+    if (*n_slots > N_KEY_SLOTS) {
+        *n_slots = N_KEY_SLOTS;
+    }
+
+    ESP_LOGI("NN", "caching %u key frame(s)", *n_slots);
+    return true;
+}
+
+// Play streamed frames, while there are any. The jitter buffer holds them
+// until their playout time.
+static void play_stream(void)
+{
+    size_t frame_sz = 0;
+    bool ready = false;
+    int64_t report = esp_timer_get_time() + STATS_INTERVAL_US;
+
+    while (stream_active()) {
+        size_t new_sz = stream_frame_sz();
+
+        if (new_sz != frame_sz) {
+            frame_sz = new_sz;
+            ready = frame_sz > 0 && reserve_stream(frame_sz);
+            begin_fade();
+        }
+
+        size_t n_pixels = frame_sz / g_chip->pixel_sz;
+
+        if (!ready || frame_sz % g_chip->pixel_sz != 0 ||
+                n_pixels % PANEL_N_LANES != 0) {
+            vTaskDelay(MAX_WAIT_US / 1000 / portTICK_PERIOD_MS);
+            continue;
+        }
+
+        if (esp_timer_get_time() >= report) {
+            log_stats();
+            report += STATS_INTERVAL_US;
+        }
+
+        // Tell the leader what delay we need, use the one that it decided
+        // on. That way, all controllers show the same frame at the same time.
+
+        net_set_stream_target(stream_target());
+
+        int64_t delay = net_stream_delay();
+
+        if (delay > 0) {
+            stream_set_delay(delay);
+        }
+
+        int64_t now = net_show_time();
+        int64_t due;
+
+        // Frames normally arrive well before they're due. Check again after
+        // a tick, if there isn't one yet.
+
+        if (!stream_next(&due) || due > now + MAX_WAIT_US) {
+            vTaskDelay(1);
+            continue;
+        }
+
+        util_wait_until(net_local_time(due));
+
+        stream_times_t times;
+
+        if (stream_play(net_show_time(), g_pixels, frame_sz, &times)) {
+            int64_t published = net_show_time();
+            uint32_t cycles = util_cycle_count();
+
+            output(g_pixels, n_pixels);
+            trace_hot(TRACE_STREAM_FRAME, due, n_pixels);
+            stats_add_latency(net_show_time() - times.at);
+            add_stages(&times, published, cycles);
+        }
+    }
+
+    net_set_stream_target(0);
+
+    if (frame_sz > 0) {
+        log_stats();
+    }
+}
+
+// Prepare for a stream with frames of the given size. Parts that never
+// arrive keep what's on the panel, as far as we know it. Returns false, if
+// the frames don't fit the buffer that reserve_buffers() set aside.
+static bool reserve_stream(size_t frame_sz)
+{
+    if (frame_sz > g_pixels_sz) {
+        ESP_LOGE("NN", "stream frames too large");
+        return false;
+    }
+
+    if (frame_sz == g_last_sz) {
+        memcpy(g_pixels, g_last, frame_sz);
+    }
+    else {
+        memset(g_pixels, 0, frame_sz);
+    }
+
+    return true;
+}
+
+// With nothing to play, keep the last frame up, dimmed and slowly breathing,
+// so that the wall doesn't look frozen. Returns after about a second, or once
+// a stream starts.
+static void play_idle(void)
+{
+    if (stream_active()) {
+        return;
+    }
+
+    int64_t start = esp_timer_get_time();
+
+    if (!g_idle) {
+        g_idle = true;
+        g_idle_start = start;
+    }
+
+    while (!stream_active() && esp_timer_get_time() - start < 1000000) {
+        size_t n_pixels = g_last_sz / g_chip->pixel_sz;
+
+        if (n_pixels == 0 || n_pixels % PANEL_N_LANES != 0) {
+            vTaskDelay(100 / portTICK_PERIOD_MS);
+            continue;
+        }
+
+        int64_t t = esp_timer_get_time() - g_idle_start;
+        int64_t phase = t % IDLE_PERIOD_US;
+
+        if (phase > IDLE_PERIOD_US / 2) {
+            phase = IDLE_PERIOD_US - phase;
+        }
+
+        int64_t weight = IDLE_MIN_WEIGHT + (IDLE_MAX_WEIGHT - IDLE_MIN_WEIGHT) *
+                phase / (IDLE_PERIOD_US / 2);
+        int64_t dim = 256 - 256 * t / IDLE_FADE_US;
+
+        if (dim > weight) {
+            weight = dim;
+        }
+
+        panel_render_mix(NULL, g_last, n_pixels, (uint32_t)weight);
+        vTaskDelay(IDLE_FRAME_MS / portTICK_PERIOD_MS);
+    }
+}
+
+// Cross-fade from what's on the panel to what output() gets next.
+static void begin_fade(void)
+{
+    g_fade_start = esp_timer_get_time();
+
+    // The idle effect leaves the panel dimmed. Fade in from black instead.
+
+    if (g_idle) {
+        g_idle = false;
+        g_last_sz = 0;
+    }
+}
+
+// Output a frame, cross-fading, if begin_fade() was called recently. Keeps a
+// copy of the frame for the next fade. Doesn't allocate.
+static void output(const uint8_t *pixels, size_t n_pixels)
+{
+    size_t sz = n_pixels * g_chip->pixel_sz;
+    int64_t t = esp_timer_get_time() - g_fade_start;
+
+    if (t < FADE_US) {
+        const uint8_t *from = sz == g_last_sz ? g_last : NULL;
+        panel_render_mix(from, pixels, n_pixels,
+                (uint32_t)(t * 256 / FADE_US));
+        return;
+    }
+
+    panel_render(pixels, n_pixels);
+
+    if (sz <= MAX_FADE_SZ) {
+        memcpy(g_last, pixels, sz);
+        g_last_sz = sz;
+    }
+    else {
+        g_last_sz = 0;
+    }
+}
+
+// Output a pre-encoded frame. It can't be mixed, so there's no cross-fade
+// into it and nothing to fade from or to dim afterwards.
+static void output_wave(const uint8_t *masks, size_t n_pixels)
+{
+    panel_render_wave(masks, n_pixels);
+    g_last_sz = 0;
+}
+
+// Work out how long after the host sent it a streamed frame got to each
+// stage, see latency_stage_t. published is the show clock time and cycles the
+// cycle count when the frame came out of the jitter buffer. Rendering runs on
+// this core, so its cycle counts compare with ours.
+static void add_stages(const stream_times_t *times, int64_t published,
+        uint32_t cycles)
+{
+    uint32_t start, first_bit;
+    panel_timing(&start, &first_bit);
+
+    int64_t stages[LATENCY_N_STAGES];
+
+    stages[LATENCY_RECEIVE] = times->received - times->at;
+    stages[LATENCY_COMPLETE] = times->completed - times->at;
+    stages[LATENCY_PUBLISH] = published - times->at;
+    stages[LATENCY_ENCODE] = stages[LATENCY_PUBLISH] +
+            util_cycles_to_us(start - cycles);
+    stages[LATENCY_FIRST_BIT] = stages[LATENCY_PUBLISH] +
+            util_cycles_to_us(first_bit - cycles);
+
+    stats_add_stages(stages);
+}
+
+static void log_stats(void)
+{
+    jitter_stats_t stats;
+    int64_t delay;
+
+    stream_stats(&stats, &delay);
+
+    ESP_LOGI("NN", "stream delay %lld us, buffered %u (max %u), played %u, "
+            "late %u, dropped %u, lost %u, reordered %u, recovered %u, "
+            "partial %u, missing %u, skipped %u", delay, stats.occupancy,
+            stats.max_occupancy, stats.n_played, stats.n_late,
+            stats.n_dropped, stats.n_lost, stats.n_reordered,
+            stats.n_recovered, stats.n_partial, stats.n_missing,
+            stats.n_skipped);
+}
+
+// Get the next frame to show for the given cue, at or after show clock time
+// now. fresh says whether the cue has just taken effect. Returns false, if
+// there's nothing to show.
+static bool next_frame(const cue_t *cue, bool fresh, int64_t now,
+        int64_t period, uint32_t n_frames, uint32_t *frame_id, int64_t *at)
+{
+    switch (cue->command) {
+    case COMMAND_START: {
+        // Right after the cue, show the frame that's due now. After that,
+        // the one that's due next. Recomputing this from the show clock
+        // every time keeps us in step, even when the clock estimate moves.
+
+        int64_t k = 0;
+
+        if (now >= cue->at) {
+            k = (now - cue->at) / period + (fresh ? 0 : 1);
+        }
+
+        *frame_id = (uint32_t)(((uint64_t)cue->frame_id + (uint64_t)k) %
+                n_frames);
+        *at = cue->at + k * period;
+        return true;
+    }
+
+    case COMMAND_RENDER_FRAME:
+        *frame_id = cue->frame_id;
+        *at = cue->at;
+        return fresh && cue->frame_id < n_frames;
+
+    default:
+        return false;
+    }
+}
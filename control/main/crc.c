@@ -0,0 +1,77 @@
+// crc.c
+//
+// Copyright (C) 2020 by the contributors
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+
+// --- Includes ----------------------------------------------------------------
+
+#include <crc.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <warnings.h>
+
+// --- Types and constants -----------------------------------------------------
+
+#define POLYNOMIAL 0xedb88320u
+
+// --- Macros and inline functions ---------------------------------------------
+
+// --- Globals -----------------------------------------------------------------
+
+static uint32_t g_table[256];
+static bool g_have_table;
+
+// --- Helper declarations -----------------------------------------------------
+
+static void make_table(void);
+
+// --- API ---------------------------------------------------------------------
+
+uint32_t crc_32(uint32_t crc, const void *data, size_t sz)
+{
+    if (!g_have_table) {
+        make_table();
+    }
+
+    const uint8_t *data_8 = data;
+    crc = ~crc;
+
+    for (size_t i = 0; i < sz; ++i) {
+        crc = g_table[(crc ^ data_8[i]) & 0xff] ^ crc >> 8;
+    }
+
+    return ~crc;
+}
+
+// --- Helpers -----------------------------------------------------------------
+
+static void make_table(void)
+{
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t crc = i;
+
+        for (int32_t k = 0; k < 8; ++k) {
+            crc = (crc & 1) != 0 ? crc >> 1 ^ POLYNOMIAL : crc >> 1;
+        }
+
+        g_table[i] = crc;
+    }
+
+    // Racing tasks compute identical tables, so this is benign.
+    g_have_table = true;
+}
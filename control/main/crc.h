@@ -0,0 +1,44 @@
+// crc.h
+//
+// Copyright (C) 2020 by the contributors
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+// --- Includes ----------------------------------------------------------------
+
+#include <stddef.h>
+#include <stdint.h>
+
+// --- Types and constants -----------------------------------------------------
+
+#define CRC_INIT 0
+
+// --- Macros and inline functions ---------------------------------------------
+
+// --- Globals -----------------------------------------------------------------
+
+// --- API ---------------------------------------------------------------------
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Continue the CRC-32 (IEEE 802.3) of a byte stream. Start with CRC_INIT.
+uint32_t crc_32(uint32_t crc, const void *data, size_t sz);
+
+#ifdef __cplusplus
+}
+#endif
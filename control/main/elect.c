@@ -0,0 +1,142 @@
+// elect.c
+//
+// Copyright (C) 2020 by the contributors
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+
+// --- Includes ----------------------------------------------------------------
+
+#include <elect.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <warnings.h>
+
+// --- Types and constants -----------------------------------------------------
+
+// --- Macros and inline functions ---------------------------------------------
+
+// --- Globals -----------------------------------------------------------------
+
+// --- Helper declarations -----------------------------------------------------
+
+static elect_peer_t *find_peer(elect_t *elect, uint32_t ip);
+
+// --- API ---------------------------------------------------------------------
+
+void elect_init(elect_t *elect, uint32_t self, int64_t now)
+{
+    elect->self = self;
+    elect->ready = false;
+    elect->start = now;
+    elect->n_peers = 0;
+    elect->leader = ELECT_NONE;
+}
+
+void elect_ready(elect_t *elect)
+{
+    elect->ready = true;
+}
+
+void elect_heard(elect_t *elect, uint32_t ip, bool ready, int64_t now)
+{
+    // Broadcasts come back to us.
+
+    if (ip == elect->self || ip == ELECT_NONE) {
+        return;
+    }
+
+    elect_peer_t *peer = find_peer(elect, ip);
+
+    if (peer == NULL) {
+        return;
+    }
+
+    peer->ip = ip;
+    peer->ready = ready;
+    peer->last_seen = now;
+}
+
+uint32_t elect_update(elect_t *elect, int64_t now)
+{
+    uint32_t leader = ELECT_NONE;
+    uint32_t lowest = elect->self;
+
+    for (uint32_t i = 0; i < elect->n_peers; ) {
+        elect_peer_t *peer = elect->peers + i;
+
+        if (now - peer->last_seen > ELECT_TIMEOUT) {
+            *peer = elect->peers[--elect->n_peers];
+            continue;
+        }
+
+        if (peer->ready && (leader == ELECT_NONE || peer->ip < leader)) {
+            leader = peer->ip;
+        }
+
+        if (peer->ip < lowest) {
+            lowest = peer->ip;
+        }
+
+        ++i;
+    }
+
+    // With nobody around to follow, the one who'd win anyway goes ahead and
+    // leads. When everybody starts at the same time, this avoids a detour via
+    // whoever happens to be first.
+
+    if (!elect->ready && leader == ELECT_NONE && lowest == elect->self &&
+            now - elect->start >= ELECT_TIMEOUT) {
+        elect->ready = true;
+    }
+
+    if (elect->ready && (leader == ELECT_NONE || elect->self < leader)) {
+        leader = elect->self;
+    }
+
+    elect->leader = leader;
+    return leader;
+}
+
+// --- Helpers -----------------------------------------------------------------
+
+// Get the given controller's entry. Makes room for it, if needed, by
+// reusing the entry of the controller with the highest IP address. Only the
+// lowest IP addresses ever lead, so those are the ones to keep, and keeping
+// the same ones everywhere keeps everybody in agreement. Returns NULL, if the
+// given controller's IP address is higher than all of them.
+static elect_peer_t *find_peer(elect_t *elect, uint32_t ip)
+{
+    elect_peer_t *highest = NULL;
+
+    for (uint32_t i = 0; i < elect->n_peers; ++i) {
+        elect_peer_t *peer = elect->peers + i;
+
+        if (peer->ip == ip) {
+            return peer;
+        }
+
+        if (highest == NULL || peer->ip > highest->ip) {
+            highest = peer;
+        }
+    }
+
+    if (elect->n_peers < ELECT_MAX_PEERS) {
+        return elect->peers + elect->n_peers++;
+    }
+
+    return ip < highest->ip ? highest : NULL;
+}
@@ -0,0 +1,84 @@
+// elect.h
+//
+// Copyright (C) 2020 by the contributors
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+// --- Includes ----------------------------------------------------------------
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// --- Types and constants -----------------------------------------------------
+
+// How many other controllers to keep track of. There may be more. Then, the
+// ones with the lowest IP addresses are kept, see elect_heard().
+#define ELECT_MAX_PEERS 32
+
+// Controllers that haven't sent a heartbeat for this long are gone. Bounds
+// the time that it takes for a new leader to take over.
+#define ELECT_TIMEOUT 1000000
+
+#define ELECT_NONE 0
+
+typedef struct {
+    uint32_t ip;
+    bool ready;
+    int64_t last_seen;
+} elect_peer_t;
+
+// Leader election. Among the controllers that have been heard from recently
+// and that are ready to lead, the one with the lowest IP address leads. As
+// everybody applies the same rule to the same heartbeats, everybody agrees,
+// give or take a lost heartbeat. Times are in microseconds.
+typedef struct {
+    uint32_t self;
+    bool ready;
+    int64_t start;
+    elect_peer_t peers[ELECT_MAX_PEERS];
+    uint32_t n_peers;
+    uint32_t leader;
+} elect_t;
+
+// --- Macros and inline functions ---------------------------------------------
+
+// --- Globals -----------------------------------------------------------------
+
+// --- API ---------------------------------------------------------------------
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Initialize. We aren't ready to lead, until elect_ready() is called or, if
+// nobody else is ready either, until we've been around for ELECT_TIMEOUT and
+// have the lowest IP address.
+void elect_init(elect_t *elect, uint32_t self, int64_t now);
+
+// Say that we're ready to lead.
+void elect_ready(elect_t *elect);
+
+// Take note of a heartbeat from the given controller. Ignored, if we already
+// keep track of ELECT_MAX_PEERS controllers with lower IP addresses.
+void elect_heard(elect_t *elect, uint32_t ip, bool ready, int64_t now);
+
+// Forget the controllers that have gone quiet and elect a leader. Returns the
+// leader, ELECT_NONE, if there isn't one.
+uint32_t elect_update(elect_t *elect, int64_t now);
+
+#ifdef __cplusplus
+}
+#endif
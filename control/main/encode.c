@@ -0,0 +1,380 @@
+// encode.c
+//
+// Copyright (C) 2020 by the contributors
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+
+// --- Includes ----------------------------------------------------------------
+
+#include <encode.h>
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <warnings.h>
+
+// --- Types and constants -----------------------------------------------------
+
+// WS2815: T0H = 220-380 ns, T1H = 580-1000 ns, T0L = 580-1000 ns,
+// T1L = 220-420 ns, reset >= 280 us.
+#define WS2815_T0H 3
+#define WS2815_T1H 8
+#define WS2815_RESET_US 280
+
+// WS2812B: T0H = 250-550 ns, T1H = 650-950 ns, T0L = 700-1000 ns,
+// T1L = 300-600 ns, reset >= 280 us.
+#define WS2812_T0H 4
+#define WS2812_T1H 8
+#define WS2812_RESET_US 280
+
+// SK6812: T0H = 150-450 ns, T1H = 450-750 ns, T0L = 750-1050 ns,
+// T1L = 450-750 ns, reset >= 80 us.
+#define SK6812_T0H 3
+#define SK6812_T1H 6
+#define SK6812_RESET_US 80
+
+// Self-clocked chips run at 100 ns per sample.
+#define SAMPLE_RATE 10000000
+
+// APA102, SK9822: data is taken on the rising edge of the clock, at up to
+// about 20 MHz, less on long strips. Two samples per bit, i.e., a 10 MHz
+// clock. Pixels are three 1 bits and the 5-bit global brightness, then blue,
+// green, red.
+#define CLOCKED_SAMPLE_RATE 20000000
+#define CLOCKED_SAMPLES_PER_BIT 2
+#define CLOCKED_HEADER (0xe0 | ENCODE_BRIGHTNESS)
+
+// The start frame is 32 0 bits. The end frame is 32 0 bits, for SK9822, and
+// then a bit per two pixels, as each pixel delays the data by half a clock.
+#define CLOCKED_START_BITS 32
+#define CLOCKED_END_BITS 32
+
+_Static_assert(ENCODE_BRIGHTNESS >= 0 && ENCODE_BRIGHTNESS <= 31,
+        "bad brightness");
+
+// --- Macros and inline functions ---------------------------------------------
+
+// The samples of a pre-encoded WS2815 bit, see g_waves. all has a bit per
+// lane, m the lanes that send a 1. In 16-bit mode, the I2S peripheral outputs
+// the two samples of each 32-bit word in swapped order, see encode(). Hence
+// the even sample in the high half.
+#define WAVE_SAMPLE(all, m, s) \
+    ((s) < WS2815_T0H ? (all) : (s) < WS2815_T1H ? (m) : 0u)
+#define WAVE_WORD(all, m, w) \
+    (WAVE_SAMPLE(all, m, 2 * (w)) << 16 | WAVE_SAMPLE(all, m, 2 * (w) + 1))
+#define WAVE_BIT(all, m) { \
+    WAVE_WORD(all, m, 0), WAVE_WORD(all, m, 1), WAVE_WORD(all, m, 2), \
+    WAVE_WORD(all, m, 3), WAVE_WORD(all, m, 4), WAVE_WORD(all, m, 5) }
+#define WAVE_MASKS(all) { \
+    WAVE_BIT(all, 0u), WAVE_BIT(all, 1u), WAVE_BIT(all, 2u), \
+    WAVE_BIT(all, 3u), WAVE_BIT(all, 4u), WAVE_BIT(all, 5u), \
+    WAVE_BIT(all, 6u), WAVE_BIT(all, 7u), WAVE_BIT(all, 8u), \
+    WAVE_BIT(all, 9u), WAVE_BIT(all, 10u), WAVE_BIT(all, 11u), \
+    WAVE_BIT(all, 12u), WAVE_BIT(all, 13u), WAVE_BIT(all, 14u), \
+    WAVE_BIT(all, 15u) }
+
+_Static_assert(ENCODE_SAMPLES_PER_BIT == 12, "WAVE_BIT needs updating");
+_Static_assert(ENCODE_MAX_MASK_LANES == 4, "WAVE_MASKS needs updating");
+
+// --- Globals -----------------------------------------------------------------
+
+// The samples of a bit for each possible mask, as 32-bit words, for 1, 2 and
+// 4 lanes, i.e., indexed by n_lanes / 2. Masks only have as many bits as
+// there are lanes, so the rest of each table is never used.
+static const uint32_t g_waves[3][1 << ENCODE_MAX_MASK_LANES]
+        [ENCODE_SAMPLES_PER_BIT / 2] = {
+    WAVE_MASKS(0x1u), WAVE_MASKS(0x3u), WAVE_MASKS(0xfu)
+};
+
+// --- Helper declarations -----------------------------------------------------
+
+static void encode_ws2812(const uint8_t *const *lanes, uint32_t n_lanes,
+        size_t first, size_t n_pixels, uint16_t *samples);
+static void encode_sk6812_rgbw(const uint8_t *const *lanes, uint32_t n_lanes,
+        size_t first, size_t n_pixels, uint16_t *samples);
+static void encode_clocked(const uint8_t *const *lanes, uint32_t n_lanes,
+        size_t first, size_t n_pixels, uint16_t *samples);
+static inline size_t put_clocked(uint16_t *samples, size_t k, uint32_t mask,
+        uint32_t clock) __attribute__((always_inline));
+static inline void encode(const uint8_t *const *lanes, uint32_t n_lanes,
+        size_t first, size_t n_pixels, uint16_t *samples,
+        const encode_chip_t *chip) __attribute__((always_inline));
+
+// Here, rather than with the globals, because it refers to the helpers. The
+// encoders take their timing and pixel layout from here, see encode(). The
+// WS2815, WS2812 and SK6812 want green, red, blue, then white. Clocked chips
+// want blue, green, red.
+static const encode_chip_t g_chips[ENCODE_N_CHIPS] = {
+    [ENCODE_CHIP_WS2815] = {
+        .name = "ws2815", .sample_rate = SAMPLE_RATE, .t0h = WS2815_T0H,
+        .t1h = WS2815_T1H, .bit = ENCODE_SAMPLES_PER_BIT,
+        .reset_us = WS2815_RESET_US, .pixel_sz = 3, .wire_bits = 24,
+        .order = { 1, 0, 2 }, .encode = encode_pixels
+    },
+    [ENCODE_CHIP_WS2812] = {
+        .name = "ws2812", .sample_rate = SAMPLE_RATE, .t0h = WS2812_T0H,
+        .t1h = WS2812_T1H, .bit = ENCODE_SAMPLES_PER_BIT,
+        .reset_us = WS2812_RESET_US, .pixel_sz = 3, .wire_bits = 24,
+        .order = { 1, 0, 2 }, .encode = encode_ws2812
+    },
+    [ENCODE_CHIP_SK6812_RGBW] = {
+        .name = "sk6812-rgbw", .sample_rate = SAMPLE_RATE, .t0h = SK6812_T0H,
+        .t1h = SK6812_T1H, .bit = ENCODE_SAMPLES_PER_BIT,
+        .reset_us = SK6812_RESET_US, .pixel_sz = 4, .wire_bits = 32,
+        .order = { 1, 0, 2, 3 }, .encode = encode_sk6812_rgbw
+    },
+    [ENCODE_CHIP_APA102] = {
+        .name = "apa102", .clocked = true,
+        .sample_rate = CLOCKED_SAMPLE_RATE, .bit = CLOCKED_SAMPLES_PER_BIT,
+        .pixel_sz = 3, .wire_bits = 32, .order = { 2, 1, 0 },
+        .encode = encode_clocked
+    },
+    [ENCODE_CHIP_SK9822] = {
+        .name = "sk9822", .clocked = true,
+        .sample_rate = CLOCKED_SAMPLE_RATE, .bit = CLOCKED_SAMPLES_PER_BIT,
+        .pixel_sz = 3, .wire_bits = 32, .order = { 2, 1, 0 },
+        .encode = encode_clocked
+    }
+};
+
+// --- API ---------------------------------------------------------------------
+
+const encode_chip_t *encode_get_chip(encode_chip_id_t id)
+{
+    assert(id < ENCODE_N_CHIPS);
+    return &g_chips[id];
+}
+
+const encode_chip_t *encode_find_chip(const char *name)
+{
+    for (int32_t i = 0; i < ENCODE_N_CHIPS; ++i) {
+        if (strcmp(g_chips[i].name, name) == 0) {
+            return &g_chips[i];
+        }
+    }
+
+    return NULL;
+}
+
+size_t encode_n_samples(const encode_chip_t *chip, size_t n_pixels)
+{
+    return n_pixels * chip->wire_bits * chip->bit;
+}
+
+void encode_frame_bits(const encode_chip_t *chip, size_t n_pixels,
+        size_t *head, size_t *tail)
+{
+    assert(chip->clocked);
+
+    *head = CLOCKED_START_BITS;
+    *tail = CLOCKED_END_BITS + (n_pixels + 1) / 2;
+}
+
+void encode_clock(const encode_chip_t *chip, uint32_t n_lanes, size_t n_bits,
+        uint16_t *samples)
+{
+    assert(chip->clocked);
+    assert(n_lanes > 0 && n_lanes < ENCODE_MAX_LANES);
+
+    uint32_t clock = 1u << n_lanes;
+    size_t k = 0;
+
+    for (size_t i = 0; i < n_bits; ++i) {
+        k = put_clocked(samples, k, 0, clock);
+    }
+}
+
+void encode_pixels(const uint8_t *const *lanes, uint32_t n_lanes, size_t first,
+        size_t n_pixels, uint16_t *samples)
+{
+    encode(lanes, n_lanes, first, n_pixels, samples,
+            &g_chips[ENCODE_CHIP_WS2815]);
+}
+
+void encode_masks(const uint8_t *const *lanes, uint32_t n_lanes, size_t first,
+        size_t n_pixels, uint8_t *masks)
+{
+    assert(n_lanes == 1 || n_lanes == 2 || n_lanes == 4);
+
+    const size_t *order = g_chips[ENCODE_CHIP_WS2815].order;
+    uint32_t acc = 0;
+    uint32_t n_bits = 0;
+    size_t k = 0;
+
+    for (size_t p = first; p < first + n_pixels; ++p) {
+        for (size_t c = 0; c < 3; ++c) {
+            size_t off = p * 3 + order[c];
+
+            for (int32_t bit = 7; bit >= 0; --bit) {
+                for (uint32_t l = 0; l < n_lanes; ++l) {
+                    acc |= (uint32_t)(lanes[l][off] >> bit & 1) << n_bits++;
+                }
+
+                if (n_bits == 8) {
+                    masks[k++] = (uint8_t)acc;
+                    acc = 0;
+                    n_bits = 0;
+                }
+            }
+        }
+    }
+}
+
+void encode_wave(const uint8_t *masks, uint32_t n_lanes, size_t first,
+        size_t n_pixels, uint16_t *samples)
+{
+    assert(n_lanes == 1 || n_lanes == 2 || n_lanes == 4);
+
+    const uint32_t (*words)[ENCODE_SAMPLES_PER_BIT / 2] = g_waves[n_lanes / 2];
+    uint32_t all = (1u << n_lanes) - 1;
+    uint32_t *out = (uint32_t *)(void *)samples;
+    uint32_t per_byte = 8 / n_lanes;
+    size_t n_bits = n_pixels * 24;
+    const uint8_t *in = masks + first * 24 / per_byte;
+
+    for (size_t i = 0; i < n_bits; i += per_byte) {
+        uint32_t byte = *in++;
+
+        for (uint32_t j = 0; j < per_byte; ++j) {
+            memcpy(out, words[byte & all], sizeof words[0]);
+            out += ENCODE_SAMPLES_PER_BIT / 2;
+            byte >>= n_lanes;
+        }
+    }
+}
+
+// --- Helpers -----------------------------------------------------------------
+
+static void encode_ws2812(const uint8_t *const *lanes, uint32_t n_lanes,
+        size_t first, size_t n_pixels, uint16_t *samples)
+{
+    encode(lanes, n_lanes, first, n_pixels, samples,
+            &g_chips[ENCODE_CHIP_WS2812]);
+}
+
+static void encode_sk6812_rgbw(const uint8_t *const *lanes, uint32_t n_lanes,
+        size_t first, size_t n_pixels, uint16_t *samples)
+{
+    encode(lanes, n_lanes, first, n_pixels, samples,
+            &g_chips[ENCODE_CHIP_SK6812_RGBW]);
+}
+
+// The encoder of clocked chips. The clock is on lane n_lanes, so there can be
+// one lane less. The APA102 and the SK9822 take the same pixels.
+static void encode_clocked(const uint8_t *const *lanes, uint32_t n_lanes,
+        size_t first, size_t n_pixels, uint16_t *samples)
+{
+    assert(n_lanes > 0 && n_lanes < ENCODE_MAX_LANES);
+
+    const size_t *order = g_chips[ENCODE_CHIP_APA102].order;
+    uint32_t clock = 1u << n_lanes;
+    uint32_t all = clock - 1;
+    size_t k = 0;
+
+    for (size_t p = first; p < first + n_pixels; ++p) {
+        for (int32_t bit = 7; bit >= 0; --bit) {
+            uint32_t mask = (CLOCKED_HEADER >> bit & 1) != 0 ? all : 0;
+            k = put_clocked(samples, k, mask, clock);
+        }
+
+        for (size_t c = 0; c < 3; ++c) {
+            size_t off = p * 3 + order[c];
+            uint8_t bytes[ENCODE_MAX_LANES];
+
+            for (uint32_t l = 0; l < n_lanes; ++l) {
+                bytes[l] = lanes[l][off];
+            }
+
+            for (int32_t bit = 7; bit >= 0; --bit) {
+                uint32_t mask = 0;
+
+                for (uint32_t l = 0; l < n_lanes; ++l) {
+                    mask |= (uint32_t)(bytes[l] >> bit & 1) << l;
+                }
+
+                k = put_clocked(samples, k, mask, clock);
+            }
+        }
+    }
+}
+
+// A bit of a clocked chip: the data with the clock low, then with the clock
+// high, see encode() for the k ^ 1.
+static inline size_t put_clocked(uint16_t *samples, size_t k, uint32_t mask,
+        uint32_t clock)
+{
+    samples[k ^ 1] = (uint16_t)mask;
+    samples[(k + 1) ^ 1] = (uint16_t)(mask | clock);
+
+    return k + CLOCKED_SAMPLES_PER_BIT;
+}
+
+// The encoder of all self-clocked chips. Always inlined with a constant chip,
+// i.e., an element of g_chips, whose timing and pixel layout the compiler
+// then folds in, so that each chip gets its own copy with the sample loops
+// unrolled, instead of one that decides between high, data and low for every
+// sample.
+static inline void encode(const uint8_t *const *lanes, uint32_t n_lanes,
+        size_t first, size_t n_pixels, uint16_t *samples,
+        const encode_chip_t *chip)
+{
+    assert(n_lanes > 0 && n_lanes <= ENCODE_MAX_LANES);
+    assert(!chip->clocked && chip->bit == ENCODE_SAMPLES_PER_BIT);
+
+    uint32_t t0h = chip->t0h;
+    uint32_t t1h = chip->t1h;
+    size_t pixel_sz = chip->pixel_sz;
+    const size_t *order = chip->order;
+
+    uint16_t all = (uint16_t)((1u << n_lanes) - 1);
+    size_t k = 0;
+
+    for (size_t p = first; p < first + n_pixels; ++p) {
+        for (size_t c = 0; c < pixel_sz; ++c) {
+            size_t off = p * pixel_sz + order[c];
+            uint8_t bytes[ENCODE_MAX_LANES];
+
+            for (uint32_t l = 0; l < n_lanes; ++l) {
+                bytes[l] = lanes[l][off];
+            }
+
+            for (int32_t bit = 7; bit >= 0; --bit) {
+                uint32_t mask = 0;
+
+                for (uint32_t l = 0; l < n_lanes; ++l) {
+                    mask |= (uint32_t)(bytes[l] >> bit & 1) << l;
+                }
+
+                // In 16-bit mode, the I2S peripheral outputs the two samples
+                // of each 32-bit word in swapped order. Hence k ^ 1.
+
+                uint32_t s = 0;
+
+                for (; s < t0h; ++s, ++k) {
+                    samples[k ^ 1] = all;
+                }
+
+                for (; s < t1h; ++s, ++k) {
+                    samples[k ^ 1] = (uint16_t)mask;
+                }
+
+                for (; s < ENCODE_SAMPLES_PER_BIT; ++s, ++k) {
+                    samples[k ^ 1] = 0;
+                }
+            }
+        }
+    }
+}
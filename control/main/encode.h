@@ -0,0 +1,133 @@
+// encode.h
+//
+// Copyright (C) 2020 by the contributors
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+// --- Includes ----------------------------------------------------------------
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// --- Types and constants -----------------------------------------------------
+
+#define ENCODE_MAX_LANES 16
+
+// At 100 ns per sample, a bit takes 1.2 us, with all self-clocked chips.
+#define ENCODE_SAMPLES_PER_BIT 12
+#define ENCODE_SAMPLES_PER_PIXEL (24 * ENCODE_SAMPLES_PER_BIT)
+
+// RGBW chips take four bytes per pixel.
+#define ENCODE_MAX_PIXEL_SZ 4
+
+// Pre-encoded pixels, see encode_masks(), work for up to this many lanes.
+#define ENCODE_MAX_MASK_LANES 4
+
+// The global brightness of clocked chips, 0 to 31. Each pixel carries it.
+#ifndef ENCODE_BRIGHTNESS
+#define ENCODE_BRIGHTNESS 31
+#endif
+
+typedef enum {
+    ENCODE_CHIP_WS2815,
+    ENCODE_CHIP_WS2812,
+    ENCODE_CHIP_SK6812_RGBW,
+    ENCODE_CHIP_APA102,
+    ENCODE_CHIP_SK9822,
+    ENCODE_N_CHIPS
+} encode_chip_id_t;
+
+// How a chip wants its pixels. Times are in samples at sample_rate, i.e., in
+// 100 ns for self-clocked chips. Pixels have pixel_sz bytes, in R, G, B, W
+// order, and go out in the order given by order, as wire_bits bits. encode is
+// a copy of encode_pixels(), specialized for the chip at compile time, from
+// these very fields. Panels use reset_us to size their output, see
+// panel_init().
+//
+// Clocked chips, i.e., APA102 and the like, take data on the rising edge of
+// a clock, which encode puts on lane n_lanes, and ignore t0h and t1h. They
+// don't latch after a reset time, but want a start and an end frame, see
+// encode_clock().
+typedef struct {
+    const char *name;
+    bool clocked;
+    uint32_t sample_rate;
+    uint32_t t0h;
+    uint32_t t1h;
+    uint32_t bit;
+    uint32_t reset_us;
+    size_t pixel_sz;
+    size_t wire_bits;
+    size_t order[ENCODE_MAX_PIXEL_SZ];
+    void (*encode)(const uint8_t *const *lanes, uint32_t n_lanes,
+            size_t first, size_t n_pixels, uint16_t *samples);
+} encode_chip_t;
+
+// --- Macros and inline functions ---------------------------------------------
+
+// --- Globals -----------------------------------------------------------------
+
+// --- API ---------------------------------------------------------------------
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Get the description of the given chip.
+const encode_chip_t *encode_get_chip(encode_chip_id_t id);
+
+// Look up a chip by name, e.g., "ws2812". Returns NULL, if there's no such
+// chip.
+const encode_chip_t *encode_find_chip(const char *name);
+
+// The number of samples that n_pixels pixels of the given chip take.
+size_t encode_n_samples(const encode_chip_t *chip, size_t n_pixels);
+
+// For clocked chips, get the number of 0 bits that go out before and after
+// the n_pixels pixels of a frame of each lane.
+void encode_frame_bits(const encode_chip_t *chip, size_t n_pixels,
+        size_t *head, size_t *tail);
+
+// For clocked chips, encode n_bits 0 bits, with the clock on lane n_lanes, as
+// the start and end frames need them. Produces n_bits * chip->bit samples.
+void encode_clock(const encode_chip_t *chip, uint32_t n_lanes, size_t n_bits,
+        uint16_t *samples);
+
+// Encode n_pixels RGB pixels, starting at pixel first, of each of the given
+// lanes into 16-bit LCD mode samples for WS2815 LEDs. Bit n of each sample
+// drives lane n. This produces n_pixels * ENCODE_SAMPLES_PER_PIXEL samples.
+// Other chips' encoders are in their descriptions, see encode_get_chip().
+void encode_pixels(const uint8_t *const *lanes, uint32_t n_lanes, size_t first,
+        size_t n_pixels, uint16_t *samples);
+
+// Pre-encode n_pixels RGB pixels, starting at pixel first, of each of the
+// given lanes. For each bit that goes out, in the order in which it goes out,
+// this produces an n_lanes-bit mask of the lanes that send a 1. Masks are
+// packed into bytes, starting with the low bits. n_lanes must be 1, 2 or 4.
+// This produces n_pixels * 3 * n_lanes bytes, i.e., as many as the pixels.
+void encode_masks(const uint8_t *const *lanes, uint32_t n_lanes, size_t first,
+        size_t n_pixels, uint8_t *masks);
+
+// Like encode_pixels(), but from masks, which encode_masks() produced from
+// all pixels of all lanes. Only copies samples, no per-pixel work. WS2815
+// only.
+void encode_wave(const uint8_t *masks, uint32_t n_lanes, size_t first,
+        size_t n_pixels, uint16_t *samples);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,99 @@
+// hist.c
+//
+// Copyright (C) 2020 by the contributors
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+
+// --- Includes ----------------------------------------------------------------
+
+#include <hist.h>
+
+#include <assert.h>
+#include <stdint.h>
+
+#include <warnings.h>
+
+// --- Types and constants -----------------------------------------------------
+
+// --- Macros and inline functions ---------------------------------------------
+
+// --- Globals -----------------------------------------------------------------
+
+// --- Helper declarations -----------------------------------------------------
+
+// --- API ---------------------------------------------------------------------
+
+uint32_t hist_lower(uint32_t bucket)
+{
+    assert(bucket < HIST_N_BUCKETS);
+
+    if (bucket < 4) {
+        return bucket;
+    }
+
+    uint32_t exp = bucket / 4 + 1;
+
+    return (4 + bucket % 4) << (exp - 2);
+}
+
+uint32_t hist_upper(uint32_t bucket)
+{
+    assert(bucket < HIST_N_BUCKETS);
+
+    return bucket + 1 < HIST_N_BUCKETS ? hist_lower(bucket + 1) - 1 :
+            UINT32_MAX;
+}
+
+uint32_t hist_total(const uint32_t *counts)
+{
+    uint32_t total = 0;
+
+    for (uint32_t i = 0; i < HIST_N_BUCKETS; ++i) {
+        total += counts[i];
+    }
+
+    return total;
+}
+
+uint32_t hist_percentile(const uint32_t *counts, uint32_t per_mille)
+{
+    assert(per_mille <= 1000);
+
+    uint32_t total = hist_total(counts);
+
+    if (total == 0) {
+        return 0;
+    }
+
+    // The rank of the value that we're after, counting from 1.
+    uint64_t rank = ((uint64_t)total * per_mille + 999) / 1000;
+
+    if (rank == 0) {
+        rank = 1;
+    }
+
+    uint64_t seen = 0;
+
+    for (uint32_t i = 0; i < HIST_N_BUCKETS; ++i) {
+        seen += counts[i];
+
+        if (seen >= rank) {
+            return hist_upper(i);
+        }
+    }
+
+    return hist_upper(HIST_N_BUCKETS - 1);
+}
+
+// --- Helpers -----------------------------------------------------------------
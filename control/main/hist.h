@@ -0,0 +1,68 @@
+// hist.h
+//
+// Copyright (C) 2020 by the contributors
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+// --- Includes ----------------------------------------------------------------
+
+#include <stdint.h>
+
+// --- Types and constants -----------------------------------------------------
+
+// Log-bucketed histograms of 32-bit values, e.g., of cycle counts. Values 0
+// through 3 get a bucket each. Above that, each power of two is split into four
+// buckets, i.e., a bucket is within 25% of the values that it holds.
+#define HIST_N_BUCKETS 124
+
+// --- Macros and inline functions ---------------------------------------------
+
+// --- Globals -----------------------------------------------------------------
+
+// --- API ---------------------------------------------------------------------
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Get the bucket of the given value.
+static inline uint32_t hist_bucket(uint32_t value)
+{
+    if (value < 4) {
+        return value;
+    }
+
+    uint32_t exp = 31 - (uint32_t)__builtin_clz(value);
+
+    return 4 * (exp - 1) + (value >> (exp - 2) & 3);
+}
+
+// Get the smallest value in the given bucket.
+uint32_t hist_lower(uint32_t bucket);
+
+// Get the largest value in the given bucket.
+uint32_t hist_upper(uint32_t bucket);
+
+// Get the number of values in the given histogram.
+uint32_t hist_total(const uint32_t *counts);
+
+// Get an upper bound of the given percentile, in per mille, of the values in
+// the given histogram, 0, if it's empty.
+uint32_t hist_percentile(const uint32_t *counts, uint32_t per_mille);
+
+#ifdef __cplusplus
+}
+#endif
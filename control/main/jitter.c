@@ -0,0 +1,485 @@
+// jitter.c
+//
+// Copyright (C) 2020 by the contributors
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+
+// --- Includes ----------------------------------------------------------------
+
+#include <jitter.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <warnings.h>
+
+// --- Types and constants -----------------------------------------------------
+
+// A part that's this many frames behind the last played one means that the
+// sender has started over.
+#define MAX_LAG 64
+
+// The playout delay covers the longest transit time seen in the current or
+// in the previous window of this length, i.e., it covers the bursts that a
+// WiFi link delivers after stalling, and it only shrinks once they've stopped.
+#define PEAK_WINDOW 10000000
+
+// The playout delay only shrinks by at least this much. Every change shows as
+// a hitch in the frame rate.
+#define HYSTERESIS 5000
+
+// Added to the transit time that the playout delay has to cover, for the time
+// it takes to get the frame onto the panel.
+#define MARGIN 2000
+
+// --- Macros and inline functions ---------------------------------------------
+
+// --- Globals -----------------------------------------------------------------
+
+// --- Helper declarations -----------------------------------------------------
+
+static void add_transit(jitter_t *jitter, int64_t transit, int64_t now);
+static void add_seq(jitter_t *jitter, uint32_t frame_id, uint32_t part);
+static jitter_slot_t *find_slot(jitter_t *jitter, uint32_t frame_id,
+        int64_t at, int64_t now);
+static int32_t first_slot(const jitter_t *jitter);
+static size_t part_size(const jitter_t *jitter, uint32_t part);
+static void recover(jitter_t *jitter, jitter_slot_t *slot, uint32_t group);
+static void xor_into(uint8_t *to, const uint8_t *from, size_t sz);
+static void restart(jitter_t *jitter);
+static bool before(uint32_t id_1, uint32_t id_2);
+
+// --- API ---------------------------------------------------------------------
+
+size_t jitter_mem_sz(size_t frame_sz, uint32_t part_sz, uint32_t n_parity)
+{
+    size_t parity_sz = frame_sz < part_sz ? frame_sz : part_sz;
+    return JITTER_N_SLOTS * (frame_sz + n_parity * parity_sz);
+}
+
+void jitter_init(jitter_t *jitter, uint8_t *mem, size_t frame_sz,
+        uint32_t part_sz, uint32_t n_parity, int64_t min_delay,
+        int64_t max_delay)
+{
+    jitter->frame_sz = frame_sz;
+    jitter->n_parts = (uint32_t)((frame_sz + part_sz - 1) / part_sz);
+    jitter->part_sz = part_sz;
+    jitter->n_parity = n_parity;
+
+    size_t slot_sz = jitter_mem_sz(frame_sz, part_sz, n_parity) /
+            JITTER_N_SLOTS;
+
+    for (uint32_t i = 0; i < JITTER_N_SLOTS; ++i) {
+        jitter->slots[i].pixels = mem + i * slot_sz;
+        jitter->slots[i].parity = jitter->slots[i].pixels + frame_sz;
+    }
+
+    jitter->delay = min_delay;
+    jitter->min_delay = min_delay;
+    jitter->max_delay = max_delay;
+    jitter->transit = 0;
+    jitter->deviation = 0;
+    jitter->peaks[0] = 0;
+    jitter->peaks[1] = 0;
+    jitter->peak_start = 0;
+
+    memset(&jitter->stats, 0, sizeof jitter->stats);
+    restart(jitter);
+}
+
+bool jitter_put(jitter_t *jitter, uint32_t frame_id, int64_t at,
+        uint32_t part, const uint8_t *data, size_t sz, int64_t now)
+{
+    uint8_t *to = jitter_begin_put(jitter, frame_id, at, part, sz, now);
+
+    if (to == NULL) {
+        return false;
+    }
+
+    memcpy(to, data, sz);
+    jitter_end_put(jitter);
+
+    return true;
+}
+
+uint8_t *jitter_begin_put(jitter_t *jitter, uint32_t frame_id, int64_t at,
+        uint32_t part, size_t sz, int64_t now)
+{
+    bool is_parity = part >= jitter->n_parts;
+    uint32_t index = is_parity ? part - jitter->n_parts : part;
+
+    if (index >= (is_parity ? jitter->n_parity : jitter->n_parts) ||
+            sz != part_size(jitter, is_parity ? 0 : part)) {
+        ++jitter->stats.n_dropped;
+        return NULL;
+    }
+
+    ++jitter->stats.n_parts;
+    add_transit(jitter, now - at, now);
+    add_seq(jitter, frame_id, part);
+
+    if (jitter->started && !before(jitter->last_id, frame_id)) {
+        if (jitter->last_id - frame_id < MAX_LAG) {
+            ++jitter->stats.n_late;
+            return NULL;
+        }
+
+        restart(jitter);
+    }
+
+    jitter_slot_t *slot = find_slot(jitter, frame_id, at, now);
+
+    if (slot == NULL) {
+        ++jitter->stats.n_dropped;
+        return NULL;
+    }
+
+    slot->completed = now;
+
+    jitter->put_slot = slot;
+    jitter->put_part = part;
+
+    if (is_parity) {
+        return slot->parity + index * sz;
+    }
+
+    return slot->pixels + (size_t)part * jitter->part_sz;
+}
+
+void jitter_end_put(jitter_t *jitter)
+{
+    jitter_slot_t *slot = jitter->put_slot;
+    uint32_t part = jitter->put_part;
+    uint32_t index = part;
+
+    if (part >= jitter->n_parts) {
+        index = part - jitter->n_parts;
+        slot->have_parity |= 1u << index;
+    }
+    else {
+        slot->have |= 1u << part;
+    }
+
+    if (jitter->n_parity > 0) {
+        recover(jitter, slot, index % jitter->n_parity);
+    }
+}
+
+bool jitter_next(const jitter_t *jitter, int64_t *due)
+{
+    int32_t first = first_slot(jitter);
+
+    if (first < 0) {
+        return false;
+    }
+
+    *due = jitter->slots[first].at + jitter->delay;
+    return true;
+}
+
+bool jitter_play(jitter_t *jitter, int64_t now, uint8_t *out)
+{
+    uint32_t all = jitter->n_parts == 32 ?
+            0xffffffffu : (1u << jitter->n_parts) - 1;
+
+    bool played = false;
+    int32_t first;
+
+    // If we fell behind, several frames may be due. Only the last one gets
+    // shown, but the earlier ones fill in what it's missing.
+
+    while ((first = first_slot(jitter)) >= 0 &&
+            jitter->slots[first].at + jitter->delay <= now) {
+        jitter_slot_t *slot = jitter->slots + first;
+
+        for (uint32_t part = 0; part < jitter->n_parts; ++part) {
+            if ((slot->have & (1u << part)) != 0) {
+                size_t offset = (size_t)part * jitter->part_sz;
+                memcpy(out + offset, slot->pixels + offset,
+                        part_size(jitter, part));
+            }
+        }
+
+        if (slot->have != all) {
+            ++jitter->stats.n_partial;
+        }
+
+        if (jitter->started) {
+            jitter->stats.n_missing += slot->frame_id - jitter->last_id - 1;
+        }
+
+        if (played) {
+            ++jitter->stats.n_skipped;
+        }
+
+        jitter->started = true;
+        jitter->last_id = slot->frame_id;
+        jitter->last_at = slot->at;
+        jitter->last_received = slot->received;
+        jitter->last_completed = slot->completed;
+
+        slot->used = false;
+        --jitter->stats.occupancy;
+
+        played = true;
+    }
+
+    if (played) {
+        ++jitter->stats.n_played;
+    }
+
+    return played;
+}
+
+int64_t jitter_target(const jitter_t *jitter)
+{
+    // Cover the usual spread of transit times, as well as the recent bursts.
+
+    int64_t target = (jitter->transit + 4 * jitter->deviation) / 16;
+
+    for (uint32_t i = 0; i < 2; ++i) {
+        if (target < jitter->peaks[i]) {
+            target = jitter->peaks[i];
+        }
+    }
+
+    return target + MARGIN;
+}
+
+void jitter_make_parity(const uint8_t *frame, size_t frame_sz,
+        uint32_t part_sz, uint32_t n_parity, uint32_t group, uint8_t *parity)
+{
+    size_t parity_sz = frame_sz < part_sz ? frame_sz : part_sz;
+    memset(parity, 0, parity_sz);
+
+    for (size_t offset = (size_t)group * part_sz; offset < frame_sz;
+            offset += (size_t)n_parity * part_sz) {
+        size_t sz = frame_sz - offset;
+        xor_into(parity, frame + offset, sz < part_sz ? sz : part_sz);
+    }
+}
+
+void jitter_set_delay(jitter_t *jitter, int64_t delay)
+{
+    if (delay < jitter->min_delay) {
+        delay = jitter->min_delay;
+    }
+
+    if (delay > jitter->max_delay) {
+        delay = jitter->max_delay;
+    }
+
+    if (delay > jitter->delay || delay <= jitter->delay - HYSTERESIS) {
+        jitter->delay = delay;
+    }
+}
+
+// --- Helpers -----------------------------------------------------------------
+
+// Track the transit times like RFC 3550 does, i.e., with running averages of
+// the transit time and of its deviation. Also track the peaks.
+static void add_transit(jitter_t *jitter, int64_t transit, int64_t now)
+{
+    if (jitter->stats.n_parts == 1) {
+        jitter->transit = 16 * transit;
+        jitter->peaks[0] = transit;
+        jitter->peak_start = now;
+        return;
+    }
+
+    int64_t diff = transit - jitter->transit / 16;
+
+    jitter->transit += diff;
+    jitter->deviation += llabs(diff) - jitter->deviation / 16;
+
+    if (now - jitter->peak_start >= PEAK_WINDOW) {
+        jitter->peaks[1] = jitter->peaks[0];
+        jitter->peaks[0] = transit;
+        jitter->peak_start = now;
+    }
+    else if (transit > jitter->peaks[0]) {
+        jitter->peaks[0] = transit;
+    }
+}
+
+// Count lost and reordered parts like RFC 3550 does, by sequence number. A part
+// that comes after a later one fills a gap that was counted as lost.
+static void add_seq(jitter_t *jitter, uint32_t frame_id, uint32_t part)
+{
+    int64_t n_total = jitter->n_parts + jitter->n_parity;
+    int64_t seq = (int64_t)frame_id * n_total + part;
+
+    // Start over, if the sender did.
+
+    if (jitter->stats.n_parts == 1 ||
+            seq < jitter->max_seq - MAX_LAG * n_total) {
+        jitter->max_seq = seq;
+        return;
+    }
+
+    if (seq > jitter->max_seq) {
+        jitter->stats.n_lost += (uint32_t)(seq - jitter->max_seq - 1);
+        jitter->max_seq = seq;
+    }
+    else if (seq < jitter->max_seq) {
+        ++jitter->stats.n_reordered;
+
+        if (jitter->stats.n_lost > 0) {
+            --jitter->stats.n_lost;
+        }
+    }
+}
+
+// Find the slot for the given frame. Takes a free one, if the frame is new.
+// Returns NULL, if there's no room.
+static jitter_slot_t *find_slot(jitter_t *jitter, uint32_t frame_id,
+        int64_t at, int64_t now)
+{
+    jitter_slot_t *free_slot = NULL;
+
+    for (uint32_t i = 0; i < JITTER_N_SLOTS; ++i) {
+        jitter_slot_t *slot = jitter->slots + i;
+
+        if (!slot->used) {
+            free_slot = free_slot != NULL ? free_slot : slot;
+        }
+        else if (slot->frame_id == frame_id) {
+            return slot;
+        }
+    }
+
+    if (free_slot == NULL) {
+        return NULL;
+    }
+
+    free_slot->used = true;
+    free_slot->frame_id = frame_id;
+    free_slot->at = at;
+    free_slot->received = now;
+    free_slot->have = 0;
+    free_slot->have_parity = 0;
+
+    jitter_stats_t *stats = &jitter->stats;
+
+    if (++stats->occupancy > stats->max_occupancy) {
+        stats->max_occupancy = stats->occupancy;
+    }
+
+    return free_slot;
+}
+
+// Find the slot with the earliest frame. Returns -1, if there isn't one.
+static int32_t first_slot(const jitter_t *jitter)
+{
+    int32_t first = -1;
+
+    for (int32_t i = 0; i < JITTER_N_SLOTS; ++i) {
+        const jitter_slot_t *slot = jitter->slots + i;
+
+        if (slot->used && (first < 0 ||
+                before(slot->frame_id, jitter->slots[first].frame_id))) {
+            first = i;
+        }
+    }
+
+    return first;
+}
+
+// Get the size of the given part. Only the last one may be short.
+static size_t part_size(const jitter_t *jitter, uint32_t part)
+{
+    size_t offset = (size_t)part * jitter->part_sz;
+    size_t sz = jitter->frame_sz - offset;
+
+    return sz < jitter->part_sz ? sz : jitter->part_sz;
+}
+
+// Rebuild the missing data part of the given parity group, if it's the only
+// one missing and we have the group's parity part.
+static void recover(jitter_t *jitter, jitter_slot_t *slot, uint32_t group)
+{
+    if ((slot->have_parity & (1u << group)) == 0) {
+        return;
+    }
+
+    int32_t missing = -1;
+
+    for (uint32_t part = group; part < jitter->n_parts;
+            part += jitter->n_parity) {
+        if ((slot->have & (1u << part)) != 0) {
+            continue;
+        }
+
+        if (missing >= 0) {
+            return;
+        }
+
+        missing = (int32_t)part;
+    }
+
+    if (missing < 0) {
+        return;
+    }
+
+    // XOR the parity with the data parts that we have. As parity and parts are
+    // padded with zeros, only the missing part's size counts.
+
+    uint8_t *to = slot->pixels + (size_t)missing * jitter->part_sz;
+    size_t sz = part_size(jitter, (uint32_t)missing);
+
+    memcpy(to, slot->parity + (size_t)group * part_size(jitter, 0), sz);
+
+    for (uint32_t part = group; part < jitter->n_parts;
+            part += jitter->n_parity) {
+        if (part != (uint32_t)missing) {
+            size_t part_sz = part_size(jitter, part);
+            xor_into(to, slot->pixels + (size_t)part * jitter->part_sz,
+                    part_sz < sz ? part_sz : sz);
+        }
+    }
+
+    slot->have |= 1u << missing;
+    ++jitter->stats.n_recovered;
+}
+
+static void xor_into(uint8_t *to, const uint8_t *from, size_t sz)
+{
+    for (size_t i = 0; i < sz; ++i) {
+        to[i] ^= from[i];
+    }
+}
+
+// Forget the buffered frames and where we were in the stream.
+static void restart(jitter_t *jitter)
+{
+    for (uint32_t i = 0; i < JITTER_N_SLOTS; ++i) {
+        jitter->slots[i].used = false;
+    }
+
+    jitter->started = false;
+    jitter->last_id = 0;
+    jitter->last_at = 0;
+    jitter->last_received = 0;
+    jitter->last_completed = 0;
+    jitter->stats.occupancy = 0;
+}
+
+// Compare frame IDs, allowing for wrap-around.
+static bool before(uint32_t id_1, uint32_t id_2)
+{
+    return (int32_t)(id_1 - id_2) < 0;
+}
@@ -0,0 +1,163 @@
+// jitter.h
+//
+// Copyright (C) 2020 by the contributors
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+// --- Includes ----------------------------------------------------------------
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// --- Types and constants -----------------------------------------------------
+
+#define JITTER_N_SLOTS 8
+
+// Frames arrive in parts, see frame_part_t in proto.h, optionally followed by
+// parity parts. Parity part g is the XOR of data parts g, g + n_parity,
+// g + 2 * n_parity, etc., each padded with zeros to the size of the first one.
+// With it, any one of those data parts can be rebuilt.
+#define JITTER_MAX_PARTS 32
+#define JITTER_MAX_PARITY 8
+
+typedef struct {
+    bool used;
+    uint32_t frame_id;
+    int64_t at;
+    // When the first and the last part so far were received.
+    int64_t received;
+    int64_t completed;
+    uint32_t have;
+    uint32_t have_parity;
+    uint8_t *pixels;
+    uint8_t *parity;
+} jitter_slot_t;
+
+typedef struct {
+    // Parts received, parts that came after their frame had been played or
+    // skipped, parts that didn't fit into the buffer, data parts rebuilt from
+    // parity parts.
+    uint32_t n_parts;
+    uint32_t n_late;
+    uint32_t n_dropped;
+    uint32_t n_recovered;
+    // Parts lost on the way, parts that came after a later one.
+    uint32_t n_lost;
+    uint32_t n_reordered;
+    // Frames played, frames played with missing parts, frames never seen,
+    // frames passed over, because the next one was due, too.
+    uint32_t n_played;
+    uint32_t n_partial;
+    uint32_t n_missing;
+    uint32_t n_skipped;
+    // Frames in the buffer, now and at most.
+    uint32_t occupancy;
+    uint32_t max_occupancy;
+} jitter_stats_t;
+
+// Jitter buffer for streamed frames. Each frame carries a timestamp and is
+// played at that time plus the playout delay, no matter when it arrives. Late
+// parts are dropped. Missing parts, or whole missing frames, are concealed by
+// keeping the previous frame's pixels. The buffer also works out the playout
+// delay that the network needs. Times are in microseconds.
+typedef struct {
+    jitter_slot_t slots[JITTER_N_SLOTS];
+    size_t frame_sz;
+    uint32_t n_parts;
+    uint32_t part_sz;
+    uint32_t n_parity;
+    jitter_slot_t *put_slot;
+    uint32_t put_part;
+    // The last frame played.
+    bool started;
+    uint32_t last_id;
+    int64_t last_at;
+    int64_t last_received;
+    int64_t last_completed;
+    // Highest part sequence number so far. Parts are numbered across frames.
+    int64_t max_seq;
+    int64_t delay;
+    int64_t min_delay;
+    int64_t max_delay;
+    // Transit time statistics. The average and its deviation are scaled by
+    // 16. The peaks are for the current and the previous window.
+    int64_t transit;
+    int64_t deviation;
+    int64_t peaks[2];
+    int64_t peak_start;
+    jitter_stats_t stats;
+} jitter_t;
+
+// --- Macros and inline functions ---------------------------------------------
+
+// --- Globals -----------------------------------------------------------------
+
+// --- API ---------------------------------------------------------------------
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Get the size of the memory that jitter_init() needs.
+size_t jitter_mem_sz(size_t frame_sz, uint32_t part_sz, uint32_t n_parity);
+
+// Initialize. Frames are frame_sz bytes, which arrive in parts of part_sz
+// bytes, plus n_parity parity parts, at most JITTER_MAX_PARTS and
+// JITTER_MAX_PARITY, respectively. mem must hold jitter_mem_sz() bytes. The
+// playout delay starts at min_delay and is kept between min_delay and
+// max_delay.
+void jitter_init(jitter_t *jitter, uint8_t *mem, size_t frame_sz,
+        uint32_t part_sz, uint32_t n_parity, int64_t min_delay,
+        int64_t max_delay);
+
+// Add a part of a frame, received at time now. Parity parts come after the
+// data parts. Returns false, if the part was dropped.
+bool jitter_put(jitter_t *jitter, uint32_t frame_id, int64_t at,
+        uint32_t part, const uint8_t *data, size_t sz, int64_t now);
+
+// Like jitter_put(), but without the data. Returns where the part's sz bytes
+// go, NULL, if the part is dropped. Once they're there, call jitter_end_put().
+// This way, the data can be copied straight from where it was received.
+uint8_t *jitter_begin_put(jitter_t *jitter, uint32_t frame_id, int64_t at,
+        uint32_t part, size_t sz, int64_t now);
+
+// Done copying the data of the part, see jitter_begin_put().
+void jitter_end_put(jitter_t *jitter);
+
+// Get the time at which the next frame is due. Returns false, if there isn't
+// one.
+bool jitter_next(const jitter_t *jitter, int64_t *due);
+
+// Play what's due at time now into out, which holds the previous frame and
+// must hold frame_sz bytes. Returns false, if nothing is due.
+bool jitter_play(jitter_t *jitter, int64_t now, uint8_t *out);
+
+// Get the playout delay that covers the recent transit times.
+int64_t jitter_target(const jitter_t *jitter);
+
+// For senders, make parity part group of the given frame. parity must hold
+// the size of the first part.
+void jitter_make_parity(const uint8_t *frame, size_t frame_sz,
+        uint32_t part_sz, uint32_t n_parity, uint32_t group, uint8_t *parity);
+
+// Set the playout delay, e.g., to jitter_target(). Clamped to the configured
+// range. Small decreases are ignored.
+void jitter_set_delay(jitter_t *jitter, int64_t delay);
+
+#ifdef __cplusplus
+}
+#endif
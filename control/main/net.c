@@ -0,0 +1,705 @@
+// net.c
+//
+// Copyright (C) 2020 by the contributors
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+
+// --- Includes ----------------------------------------------------------------
+
+#include <net.h>
+
+#include <freertos/FreeRTOS.h> // pre 4.1, IDF headers depend on these
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <esp_log.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+#include <lwip/sockets.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <elect.h>
+#include <prof.h>
+#include <proto.h>
+#include <reply.h>
+#include <stats.h>
+#include <sync.h>
+#include <trace.h>
+#include <util.h>
+#include <wifi.h>
+
+#include <warnings.h>
+
+// --- Types and constants -----------------------------------------------------
+
+_Static_assert(sizeof (ping_reply_t) == 4, "ping_reply_t layout");
+_Static_assert(sizeof (sync_request_t) == 16, "sync_request_t layout");
+_Static_assert(sizeof (sync_reply_t) == 32, "sync_reply_t layout");
+_Static_assert(sizeof (cue_t) == 16, "cue_t layout");
+_Static_assert(sizeof (heartbeat_t) == 32, "heartbeat_t layout");
+_Static_assert(sizeof (profile_request_t) == 4, "profile_request_t layout");
+_Static_assert(sizeof (profile_reply_t) == 8 + PROFILE_N_CORES *
+        PROFILE_N_BUCKETS * 4, "profile_reply_t layout");
+_Static_assert(sizeof (stats_reply_t) == 136, "stats_reply_t layout");
+
+// See assign_addr() in wifi.c.
+#define BROADCAST_IP 0x0affffffu
+
+// Largest UDP message we understand.
+#define BUF_SZ 64
+
+// Ping replies are delayed randomly by up to this many microseconds, so that
+// the replies to a broadcast ping don't all collide.
+#define PING_DELAY_LIMIT 1000
+
+// Delayed ping replies wait in one of these, for a one-shot timer, so that
+// nothing waits in serve_task(). Beyond that, replies go out right away.
+#define N_PING_SLOTS 4
+
+typedef struct {
+    esp_timer_handle_t timer;
+    bool busy;
+    int sock;
+    struct sockaddr_in addr;
+    int64_t received;
+    ping_reply_t reply;
+} ping_slot_t;
+
+// Sync quickly until the estimator has a full set of samples, then slow down
+// to what it takes to follow the drift.
+#define SYNC_FAST_MS 50
+#define SYNC_SLOW_MS 500
+#define SYNC_TIMEOUT_MS 100
+
+// Log the clock estimate every this many samples.
+#define SYNC_LOG_INTERVAL 120
+
+// Ten heartbeats per ELECT_TIMEOUT, so that even heavy broadcast loss doesn't
+// make us look gone.
+#define HEARTBEAT_MS 100
+
+// After a cue from the host, ignore the leader's cue for a while. It may not
+// have seen the host's cue yet.
+#define CUE_HOLD_US 1000000
+
+// The leader goes by the largest playout delay that followers asked for in
+// the current or in the previous window of this length.
+#define DELAY_WINDOW_US 2000000
+
+#define STACK_SZ 4096
+// Above the upload tasks, so that timestamps are taken promptly.
+#define PRIORITY 6
+// With the WiFi driver, away from the output task.
+#define CORE 0
+
+// --- Macros and inline functions ---------------------------------------------
+
+// --- Globals -----------------------------------------------------------------
+
+static SemaphoreHandle_t g_lock;
+
+static ping_slot_t g_pings[N_PING_SLOTS];
+
+static sync_t g_sync;
+static elect_t g_elect;
+static uint32_t g_leader;
+
+static cue_t g_cue;
+static uint32_t g_cue_serial;
+static int64_t g_cue_time;
+
+// Playout delay for streams that we need, that we use, and, if we lead, what
+// the followers asked for.
+static int64_t g_stream_target;
+static int64_t g_stream_delay;
+static int64_t g_delays[2];
+static int64_t g_delay_start;
+
+// --- Helper declarations -----------------------------------------------------
+
+static void serve_task(void *arg);
+static void beat_task(void *arg);
+static void sync_task(void *arg);
+static void handle_ping(int sock, const uint8_t *buf, size_t sz,
+        const struct sockaddr_in *addr, int64_t now);
+static void send_ping_reply(void *arg);
+static void handle_sync(int sock, const uint8_t *buf, size_t sz,
+        const struct sockaddr_in *addr, int64_t now);
+static void handle_cue(const uint8_t *buf, size_t sz, int64_t now);
+static void handle_heartbeat(const uint8_t *buf, size_t sz, int64_t now);
+static void handle_profile(int sock, const uint8_t *buf, size_t sz,
+        const struct sockaddr_in *addr);
+static void handle_stats(int sock, size_t sz, const struct sockaddr_in *addr);
+static bool take_cue(const cue_t *cue);
+static int64_t lead_delay(int64_t now);
+static void run_sync(int sock, uint32_t leader, uint32_t seq);
+static bool is_leader(void);
+
+// --- API ---------------------------------------------------------------------
+
+void net_init(void)
+{
+    g_lock = xSemaphoreCreateMutex();
+    assert(g_lock != NULL);
+
+    for (int32_t i = 0; i < N_PING_SLOTS; ++i) {
+        esp_timer_create_args_t args = {
+            .callback = send_ping_reply,
+            .arg = &g_pings[i],
+            .dispatch_method = ESP_TIMER_TASK,
+            .name = "ping"
+        };
+
+        util_never_fails(esp_timer_create, &args, &g_pings[i].timer);
+    }
+
+    sync_init(&g_sync);
+}
+
+void net_start(void)
+{
+    elect_init(&g_elect, wifi_ip(), esp_timer_get_time());
+
+    BaseType_t res = xTaskCreatePinnedToCore(serve_task, "net_serve",
+            STACK_SZ, NULL, PRIORITY, NULL, CORE);
+    assert(res == pdPASS);
+
+    res = xTaskCreatePinnedToCore(beat_task, "net_beat", STACK_SZ, NULL,
+            PRIORITY, NULL, CORE);
+    assert(res == pdPASS);
+
+    res = xTaskCreatePinnedToCore(sync_task, "net_sync", STACK_SZ, NULL,
+            PRIORITY, NULL, CORE);
+    assert(res == pdPASS);
+}
+
+uint32_t net_cue(cue_t *cue)
+{
+    xSemaphoreTake(g_lock, portMAX_DELAY);
+
+    *cue = g_cue;
+    uint32_t serial = g_cue_serial;
+
+    xSemaphoreGive(g_lock);
+    return serial;
+}
+
+int64_t net_show_time(void)
+{
+    xSemaphoreTake(g_lock, portMAX_DELAY);
+    int64_t show = sync_to_master(&g_sync, esp_timer_get_time());
+    xSemaphoreGive(g_lock);
+
+    return show;
+}
+
+int64_t net_local_time(int64_t show)
+{
+    xSemaphoreTake(g_lock, portMAX_DELAY);
+    int64_t local = sync_to_local(&g_sync, show);
+    xSemaphoreGive(g_lock);
+
+    return local;
+}
+
+void net_set_stream_target(int64_t target)
+{
+    xSemaphoreTake(g_lock, portMAX_DELAY);
+    g_stream_target = target;
+    xSemaphoreGive(g_lock);
+}
+
+int64_t net_stream_delay(void)
+{
+    xSemaphoreTake(g_lock, portMAX_DELAY);
+    int64_t delay = g_stream_delay;
+    xSemaphoreGive(g_lock);
+
+    return delay;
+}
+
+// --- Helpers -----------------------------------------------------------------
+
+static void serve_task(void *arg)
+{
+    assert(arg == NULL);
+
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(PROTO_UDP_PORT),
+        .sin_addr = { .s_addr = htonl(INADDR_ANY) }
+    };
+
+    if (sock < 0 ||
+            bind(sock, (struct sockaddr *)&addr, sizeof addr) < 0) {
+        ESP_LOGE("NN", "cannot listen for commands: %d", errno);
+        vTaskDelete(NULL);
+        return;
+    }
+
+    while (true) {
+        uint8_t buf[BUF_SZ];
+        struct sockaddr_in rem_addr;
+        socklen_t rem_addr_len = sizeof rem_addr;
+
+        ssize_t len = recvfrom(sock, buf, sizeof buf, 0,
+                (struct sockaddr *)&rem_addr, &rem_addr_len);
+
+        // Take the time right away. Any delay here ends up in the clock
+        // offset as seen by the syncing controller.
+
+        int64_t now = esp_timer_get_time();
+
+        if (len < 1) {
+            continue;
+        }
+
+        size_t sz = (size_t)len;
+        trace_hot(TRACE_COMMAND, buf[0], sz);
+
+        switch (buf[0]) {
+        case COMMAND_PING:
+            handle_ping(sock, buf, sz, &rem_addr, now);
+            break;
+
+        case COMMAND_SYNC:
+            handle_sync(sock, buf, sz, &rem_addr, now);
+            break;
+
+        case COMMAND_START:
+        case COMMAND_STOP:
+        case COMMAND_RENDER_FRAME:
+            handle_cue(buf, sz, now);
+            break;
+
+        case COMMAND_HEARTBEAT:
+            handle_heartbeat(buf, sz, now);
+            break;
+
+        case COMMAND_PROFILE:
+            handle_profile(sock, buf, sz, &rem_addr);
+            break;
+
+        case COMMAND_STATS:
+            handle_stats(sock, sz, &rem_addr);
+            break;
+
+        default:
+            ESP_LOGW("NN", "unknown command %u", buf[0]);
+            break;
+        }
+    }
+}
+
+static void beat_task(void *arg)
+{
+    assert(arg == NULL);
+
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    int one = 1;
+
+    if (sock < 0 ||
+            setsockopt(sock, SOL_SOCKET, SO_BROADCAST, &one, sizeof one) < 0) {
+        ESP_LOGE("NN", "cannot create heartbeat socket: %d", errno);
+        vTaskDelete(NULL);
+        return;
+    }
+
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(PROTO_UDP_PORT),
+        .sin_addr = { .s_addr = htonl(BROADCAST_IP) }
+    };
+
+    uint32_t prev_leader = ELECT_NONE;
+
+    while (true) {
+        heartbeat_t beat = {
+            .command = COMMAND_HEARTBEAT,
+            .ip = wifi_ip()
+        };
+
+        int64_t now = esp_timer_get_time();
+
+        xSemaphoreTake(g_lock, portMAX_DELAY);
+
+        g_leader = elect_update(&g_elect, now);
+
+        uint32_t leader = g_leader;
+        beat.ready = g_elect.ready;
+        beat.cue = g_cue;
+        beat.delay = g_stream_target;
+
+        if (leader == beat.ip) {
+            int64_t delay = lead_delay(now);
+            beat.delay = delay > beat.delay ? delay : beat.delay;
+
+            if (beat.delay > 0) {
+                g_stream_delay = beat.delay;
+            }
+        }
+
+        xSemaphoreGive(g_lock);
+
+        if (leader != prev_leader) {
+            ESP_LOGI("NN", "leader %u.%u.%u.%u%s", leader >> 24,
+                    (leader >> 16) & 0xff, (leader >> 8) & 0xff,
+                    leader & 0xff, leader == beat.ip ? " (us)" : "");
+            prev_leader = leader;
+        }
+
+        sendto(sock, &beat, sizeof beat, 0, (struct sockaddr *)&addr,
+                sizeof addr);
+
+        vTaskDelay(HEARTBEAT_MS / portTICK_PERIOD_MS);
+    }
+}
+
+static void sync_task(void *arg)
+{
+    assert(arg == NULL);
+
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+
+    if (sock < 0) {
+        ESP_LOGE("NN", "cannot create sync socket: %d", errno);
+        vTaskDelete(NULL);
+        return;
+    }
+
+    struct timeval timeout = {
+        .tv_sec = 0,
+        .tv_usec = SYNC_TIMEOUT_MS * 1000
+    };
+
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+
+    for (uint32_t seq = 0; ; ++seq) {
+        xSemaphoreTake(g_lock, portMAX_DELAY);
+
+        uint32_t leader = g_leader;
+        bool full = g_sync.n_samples == SYNC_N_SAMPLES;
+
+        xSemaphoreGive(g_lock);
+
+        // The leader's estimate of the show clock is the show clock. It just
+        // keeps going, when we become the leader.
+
+        if (leader != ELECT_NONE && leader != wifi_ip()) {
+            run_sync(sock, leader, seq);
+        }
+
+        uint32_t delay = full ? SYNC_SLOW_MS : SYNC_FAST_MS;
+        vTaskDelay(delay / portTICK_PERIOD_MS);
+    }
+}
+
+static void handle_ping(int sock, const uint8_t *buf, size_t sz,
+        const struct sockaddr_in *addr, int64_t now)
+{
+    ping_reply_t reply;
+
+    if (!reply_ping(buf, sz, is_leader(), &reply)) {
+        ESP_LOGW("NN", "bad ping message size %zu", sz);
+        return;
+    }
+
+    for (int32_t i = 0; i < N_PING_SLOTS; ++i) {
+        ping_slot_t *slot = &g_pings[i];
+
+        if (__atomic_load_n(&slot->busy, __ATOMIC_ACQUIRE)) {
+            continue;
+        }
+
+        slot->busy = true;
+        slot->sock = sock;
+        slot->addr = *addr;
+        slot->received = now;
+        slot->reply = reply;
+
+        util_never_fails(esp_timer_start_once, slot->timer,
+                esp_random() % PING_DELAY_LIMIT);
+        return;
+    }
+
+    // All slots are waiting. Pings come faster than they should.
+
+    sendto(sock, &reply, sizeof reply, 0, (const struct sockaddr *)addr,
+            sizeof *addr);
+}
+
+// Runs in the timer task, once a ping reply's delay has passed.
+static void send_ping_reply(void *arg)
+{
+    ping_slot_t *slot = arg;
+
+    reply_set_held(&slot->reply, esp_timer_get_time() - slot->received);
+
+    sendto(slot->sock, &slot->reply, sizeof slot->reply, 0,
+            (const struct sockaddr *)&slot->addr, sizeof slot->addr);
+
+    __atomic_store_n(&slot->busy, false, __ATOMIC_RELEASE);
+}
+
+static void handle_sync(int sock, const uint8_t *buf, size_t sz,
+        const struct sockaddr_in *addr, int64_t now)
+{
+    if (sz != sizeof (sync_request_t)) {
+        ESP_LOGW("NN", "bad sync message size %zu", sz);
+        return;
+    }
+
+    sync_request_t req;
+    memcpy(&req, buf, sizeof req);
+
+    sync_reply_t reply = {
+        .command = COMMAND_SYNC,
+        .result = RESULT_NOT_MASTER,
+        .seq = req.seq,
+        .t1 = req.t1
+    };
+
+    // Only the leader's clock counts.
+
+    xSemaphoreTake(g_lock, portMAX_DELAY);
+
+    if (g_leader == wifi_ip()) {
+        reply.result = RESULT_OK;
+        reply.t2 = sync_to_master(&g_sync, now);
+        reply.t3 = sync_to_master(&g_sync, esp_timer_get_time());
+    }
+
+    xSemaphoreGive(g_lock);
+
+    sendto(sock, &reply, sizeof reply, 0, (const struct sockaddr *)addr,
+            sizeof *addr);
+}
+
+static void handle_cue(const uint8_t *buf, size_t sz, int64_t now)
+{
+    if (sz != sizeof (cue_t)) {
+        ESP_LOGW("NN", "bad cue message size %zu", sz);
+        return;
+    }
+
+    cue_t cue;
+    memcpy(&cue, buf, sizeof cue);
+
+    xSemaphoreTake(g_lock, portMAX_DELAY);
+
+    bool fresh = take_cue(&cue);
+    g_cue_time = now;
+
+    xSemaphoreGive(g_lock);
+
+    if (fresh) {
+        ESP_LOGI("NN", "cue %u frame %u at %lld", cue.command, cue.frame_id,
+                cue.at);
+    }
+}
+
+static void handle_heartbeat(const uint8_t *buf, size_t sz, int64_t now)
+{
+    if (sz != sizeof (heartbeat_t)) {
+        ESP_LOGW("NN", "bad heartbeat message size %zu", sz);
+        return;
+    }
+
+    heartbeat_t beat;
+    memcpy(&beat, buf, sizeof beat);
+
+    xSemaphoreTake(g_lock, portMAX_DELAY);
+
+    elect_heard(&g_elect, beat.ip, beat.ready != 0, now);
+
+    // Follow the leader's cue, if it has one.
+
+    bool follow = beat.ip == g_leader && beat.ip != wifi_ip() &&
+            beat.cue.command != COMMAND_PING &&
+            (g_cue_serial == 0 || now - g_cue_time > CUE_HOLD_US);
+
+    bool fresh = follow && take_cue(&beat.cue);
+
+    // Collect the followers' playout delays, if we lead, or use the leader's.
+    // A delay of 0 means that there isn't a stream.
+
+    if (g_leader != wifi_ip()) {
+        if (beat.ip == g_leader && beat.delay > 0) {
+            g_stream_delay = beat.delay;
+        }
+    }
+    else if (beat.delay > g_delays[0]) {
+        g_delays[0] = beat.delay;
+    }
+
+    xSemaphoreGive(g_lock);
+
+    if (fresh) {
+        ESP_LOGI("NN", "leader's cue %u frame %u at %lld", beat.cue.command,
+                beat.cue.frame_id, beat.cue.at);
+    }
+}
+
+static void handle_profile(int sock, const uint8_t *buf, size_t sz,
+        const struct sockaddr_in *addr)
+{
+    if (sz != sizeof (profile_request_t)) {
+        ESP_LOGW("NN", "bad profile message size %zu", sz);
+        return;
+    }
+
+    profile_request_t req;
+    memcpy(&req, buf, sizeof req);
+
+    // Too large for the stack. Only ever used by the serving task.
+    static profile_reply_t reply;
+
+    memset(&reply, 0, sizeof reply);
+    reply.command = COMMAND_PROFILE;
+    reply.probe = req.probe;
+    reply.result = RESULT_BAD_REQUEST;
+
+    if (req.probe < PROFILE_N_PROBES) {
+        reply.result = RESULT_OK;
+        reply.cpu_mhz = util_ns_to_cycles(1000);
+        prof_read((probe_t)req.probe, reply.counts, req.reset != 0);
+    }
+
+    sendto(sock, &reply, sizeof reply, 0, (const struct sockaddr *)addr,
+            sizeof *addr);
+}
+
+static void handle_stats(int sock, size_t sz, const struct sockaddr_in *addr)
+{
+    stats_reply_t reply;
+
+    if (!stats_get(sz, &reply)) {
+        ESP_LOGW("NN", "bad stats message size %zu", sz);
+        return;
+    }
+
+    sendto(sock, &reply, sizeof reply, 0, (const struct sockaddr *)addr,
+            sizeof *addr);
+}
+
+// Make the given cue the current one. The host sends each cue a few times, as
+// broadcasts aren't acknowledged, and the leader keeps repeating it. Returns
+// false, if it's the current one already. Must be called with g_lock held.
+static bool take_cue(const cue_t *cue)
+{
+    if (g_cue_serial != 0 && memcmp(cue, &g_cue, sizeof *cue) == 0) {
+        return false;
+    }
+
+    g_cue = *cue;
+
+    if (++g_cue_serial == 0) {
+        g_cue_serial = 1;
+    }
+
+    return true;
+}
+
+// Get the largest playout delay that the followers have asked for lately.
+// Must be called with g_lock held.
+static int64_t lead_delay(int64_t now)
+{
+    if (now - g_delay_start >= DELAY_WINDOW_US) {
+        g_delays[1] = g_delays[0];
+        g_delays[0] = 0;
+        g_delay_start = now;
+    }
+
+    return g_delays[0] > g_delays[1] ? g_delays[0] : g_delays[1];
+}
+
+// Do one sync exchange with the leader. Once the estimate is good, we're
+// ready to lead ourselves.
+static void run_sync(int sock, uint32_t leader, uint32_t seq)
+{
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(PROTO_UDP_PORT),
+        .sin_addr = { .s_addr = htonl(leader) }
+    };
+
+    sync_request_t req = {
+        .command = COMMAND_SYNC,
+        .seq = seq,
+        .t1 = esp_timer_get_time()
+    };
+
+    if (sendto(sock, &req, sizeof req, 0, (const struct sockaddr *)&addr,
+            sizeof addr) < 0) {
+        return;
+    }
+
+    sync_reply_t reply;
+
+    // Skip late replies to earlier requests.
+
+    do {
+        ssize_t len = recv(sock, &reply, sizeof reply, 0);
+
+        if (len != sizeof reply) {
+            return;
+        }
+    }
+    while (reply.seq != seq);
+
+    if (reply.result != RESULT_OK) {
+        return;
+    }
+
+    int64_t t4 = esp_timer_get_time();
+
+    xSemaphoreTake(g_lock, portMAX_DELAY);
+
+    uint32_t n_resets = g_sync.n_resets;
+    bool added = sync_add(&g_sync, reply.t1, reply.t2, reply.t3, t4);
+    bool reset = g_sync.n_resets != n_resets;
+    int64_t offset = g_sync.offset;
+    double drift = g_sync.drift;
+
+    if (g_sync.n_samples == SYNC_N_SAMPLES) {
+        elect_ready(&g_elect);
+    }
+
+    xSemaphoreGive(g_lock);
+
+    if (reset) {
+        ESP_LOGW("NN", "show clock jumped, resyncing");
+    }
+
+    if (added && (seq % SYNC_LOG_INTERVAL == 0 || reset)) {
+        ESP_LOGI("NN", "clock offset %lld us drift %d ppb, delay %lld us",
+                offset, (int32_t)(drift * 1e9), t4 - reply.t1);
+    }
+}
+
+static bool is_leader(void)
+{
+    xSemaphoreTake(g_lock, portMAX_DELAY);
+    bool leader = g_leader == wifi_ip();
+    xSemaphoreGive(g_lock);
+
+    return leader;
+}
@@ -0,0 +1,57 @@
+// net.h
+//
+// Copyright (C) 2020 by the contributors
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+
+// --- Includes ----------------------------------------------------------------
+
+#include <stdint.h>
+
+#include <proto.h>
+
+// --- Types and constants -----------------------------------------------------
+
+// --- Macros and inline functions ---------------------------------------------
+
+// --- Globals -----------------------------------------------------------------
+
+// --- API ---------------------------------------------------------------------
+
+// Initialize. Until net_start(), the show clock is the local clock and there
+// are no cues. Doesn't need the network.
+void net_init(void);
+
+// Start answering UDP commands, see proto.h, taking part in the leader
+// election and, unless we're the leader, keeping the show clock in sync with
+// the leader. Call, once the network is up.
+void net_start(void);
+
+// Get the most recent cue from the host. Returns a serial number that changes
+// with every new cue, 0, if there hasn't been one yet.
+uint32_t net_cue(cue_t *cue);
+
+// Get the current show clock time.
+int64_t net_show_time(void);
+
+// Convert the given show clock time to esp_timer_get_time() time.
+int64_t net_local_time(int64_t show);
+
+// Set the playout delay that our stream needs, 0, if we don't have one. Goes
+// out with our heartbeats.
+void net_set_stream_target(int64_t target);
+
+// Get the playout delay that all controllers use for streams, as decided by
+// the leader. 0, if there hasn't been a stream yet.
+int64_t net_stream_delay(void);
@@ -19,53 +19,145 @@
 
 #include <panel.h>
 
-#include <freertos/FreeRTOS.h> // pre 4.1, IDF headers depend on these two
+#include <freertos/FreeRTOS.h> // pre 4.1, IDF headers depend on these
 #include <freertos/task.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
 
 #include <assert.h>
 #include <driver/gpio.h>
 #include <driver/i2s.h>
-#include <esp_log.h>
 #include <esp32/rom/gpio.h>
 #include <esp32/rom/lldesc.h>
+#include <esp_heap_caps.h>
+#include <esp_log.h>
 #include <soc/gpio_sig_map.h>
 #include <soc/i2s_struct.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+#include <encode.h>
+#include <prof.h>
+#include <proto.h>
+#include <trace.h>
 #include <util.h>
 
 #include <warnings.h>
 
 // --- Types and constants -----------------------------------------------------
 
+// Each DMA buffer holds a whole number of pixels per lane, so that it can be
+// refilled by encoding straight into it. How many depends on the chip, see
+// panel_init().
+
 #define N_DMA_BUFS 2
 #define N_CHANNELS 2
-#define DMA_BUF_LEN 1024
-#define DMA_BUF_SZ (DMA_BUF_LEN * N_CHANNELS * sizeof (uint16_t))
-#define SAMPLE_RATE 10000000
+
+// See panel_test_pattern().
+#define N_TEST_SAMPLES 10000
+
+// The I2S driver's limit on the samples per channel of a DMA buffer and the
+// DMA descriptors' limit on its bytes.
+#define MAX_DMA_BUF_LEN 1024
+#define MAX_DMA_BUF_SZ 4092
 
 // --- Macros and inline functions ---------------------------------------------
 
 // --- Globals -----------------------------------------------------------------
 
+// The LEDs and the DMA buffer layout that goes with them.
+static const encode_chip_t *g_chip;
+static size_t g_pixels_per_buf;
+static size_t g_buf_sz;
+
+// A DMA buffer's worth of pixels per lane, see render().
+static uint8_t *g_mixed;
+
+// The I2S driver posts an event here, whenever the DMA engine finishes a
+// buffer, see get_dma_buffer().
+static QueueHandle_t g_dma_events;
+
+// Held while a frame is being output, see panel_pause().
+static SemaphoreHandle_t g_busy;
+
+static uint32_t g_n_frames;
+static uint32_t g_n_underruns;
+
+// See panel_timing().
+static uint32_t g_start;
+static uint32_t g_first_bit;
+
 // --- Helper declarations -----------------------------------------------------
 
+static void render(const uint8_t *from, const uint8_t *pixels,
+        size_t n_pixels, uint32_t weight, bool wave);
+static void mix(const uint8_t *from, const uint8_t *to, size_t sz,
+        uint32_t weight, uint8_t *out);
+static void write_clock(size_t n_bits);
 static void write_data(const void *data, size_t sz);
+static void write_silence(void);
 static volatile uint8_t *get_dma_buffer(void);
+static bool is_sending(volatile uint8_t *buf);
 static void v_memcpy(volatile void *to, const void *from, size_t sz);
 static void v_memset(volatile void *to, uint8_t val, size_t sz);
 
 // --- API ---------------------------------------------------------------------
 
-void panel_init(uint32_t gpio_no_1, uint32_t gpio_no_2)
+void panel_init(uint32_t gpio_no_1, uint32_t gpio_no_2,
+        uint32_t gpio_no_clock, const encode_chip_t *chip)
 {
+    // The LEDs latch after chip->reset_us of silence. Silence is output by
+    // N_DMA_BUFS buffers of it, see write_silence(), so that's what sets the
+    // gap between frames. Just enough pixels per DMA buffer to cover the
+    // reset time, then. Clocked chips don't need any silence. They get as
+    // many pixels as the DMA buffers hold, i.e., 31 APA102 pixels or about
+    // 100 us per buffer, which leaves the most time to refill a buffer.
+
+    size_t pixel_samples = encode_n_samples(chip, 1);
+    size_t reset_samples = chip->reset_us * (chip->sample_rate / 1000000);
+    size_t max_samples = MAX_DMA_BUF_LEN * N_CHANNELS;
+
+    if (max_samples > MAX_DMA_BUF_SZ / sizeof (uint16_t)) {
+        max_samples = MAX_DMA_BUF_SZ / sizeof (uint16_t);
+    }
+
+    size_t max_pixels = max_samples / pixel_samples;
+
+    size_t silent_samples = N_DMA_BUFS * pixel_samples;
+
+    g_chip = chip;
+    g_pixels_per_buf = (reset_samples + silent_samples - 1) / silent_samples;
+
+    if (g_pixels_per_buf == 0 || g_pixels_per_buf > max_pixels) {
+        g_pixels_per_buf = max_pixels;
+    }
+
+    size_t buf_len = g_pixels_per_buf * pixel_samples / N_CHANNELS;
+    g_buf_sz = buf_len * N_CHANNELS * sizeof (uint16_t);
+
+    assert(N_DMA_BUFS * buf_len * N_CHANNELS >= reset_samples);
+
+    // Like the frame buffers, set aside at boot.
+
+    g_mixed = heap_caps_malloc(PANEL_N_LANES * g_pixels_per_buf *
+            chip->pixel_sz, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    assert(g_mixed != NULL);
+
+    g_busy = xSemaphoreCreateMutex();
+    assert(g_busy != NULL);
+
+    ESP_LOGI("NN", "%s LEDs, %zu pixel(s) per DMA buffer, %zu us of reset",
+            chip->name, g_pixels_per_buf,
+            N_DMA_BUFS * buf_len * N_CHANNELS / (chip->sample_rate / 1000000));
+
     // Completely normal GPIO setup.
 
     gpio_config_t gpio_conf = {
         .pin_bit_mask =
             (uint64_t)1 << gpio_no_1 |
-            (uint64_t)1 << gpio_no_2,
+            (uint64_t)1 << gpio_no_2 |
+            (uint64_t)(chip->clocked ? 1 : 0) << gpio_no_clock,
         .mode = GPIO_MODE_OUTPUT,
         .pull_up_en = GPIO_PULLUP_DISABLE,
         .pull_down_en = GPIO_PULLDOWN_DISABLE,
@@ -80,20 +172,20 @@ void panel_init(uint32_t gpio_no_1, uint32_t gpio_no_2)
         .mode = I2S_MODE_MASTER | I2S_MODE_TX,
         // Divide by 16. I assume that we need to do this, because we'll switch
         // to LCD mode, which transmits 16 bits in parallel. This setting gives
-        // us 100 ns per sample.
-        .sample_rate = SAMPLE_RATE / 16,
+        // us 100 ns per sample for self-clocked chips, 50 ns for clocked ones.
+        .sample_rate = (int)(chip->sample_rate / 16),
         .bits_per_sample = 16,
         .channel_format = I2S_CHANNEL_FMT_RIGHT_LEFT,
         .communication_format = I2S_COMM_FORMAT_STAND_PCM_SHORT,
         .intr_alloc_flags = 0,
         .dma_buf_count = N_DMA_BUFS,
-        .dma_buf_len = DMA_BUF_LEN,
+        .dma_buf_len = (int)buf_len,
         .use_apll = false,
         .tx_desc_auto_clear = false,
         .fixed_mclk = 0
     };
 
-    i2s_driver_install(0, &i2s_conf, 0, NULL);
+    i2s_driver_install(0, &i2s_conf, N_DMA_BUFS, &g_dma_events);
 
     // In LCD mode, the 16-bit samples are output via signals I2S0O_DATA_OUT8
     // through I2S0O_DATA_OUT23. Instead of using i2s_set_pin(), we manually
@@ -102,18 +194,67 @@ void panel_init(uint32_t gpio_no_1, uint32_t gpio_no_2)
     gpio_matrix_out(gpio_no_1, I2S0O_DATA_OUT8_IDX, false, false);
     gpio_matrix_out(gpio_no_2, I2S0O_DATA_OUT9_IDX, false, false);
 
+    // Clocked chips share a clock, which the encoder puts on the bit after
+    // the lanes, i.e., bit 2.
+
+    _Static_assert(PANEL_N_LANES == 2, "clock on wrong bit");
+
+    if (chip->clocked) {
+        gpio_matrix_out(gpio_no_clock, I2S0O_DATA_OUT10_IDX, false, false);
+    }
+
     // Write directly to I2S_CONF2_REG to enable LCD mode.
     I2S0.conf2.lcd_en = 1;
 }
 
+void panel_render(const uint8_t *pixels, size_t n_pixels)
+{
+    render(NULL, pixels, n_pixels, 256, false);
+}
+
+void panel_render_mix(const uint8_t *from, const uint8_t *pixels,
+        size_t n_pixels, uint32_t weight)
+{
+    assert(weight <= 256);
+    render(from, pixels, n_pixels, weight, false);
+}
+
+void panel_render_wave(const uint8_t *masks, size_t n_pixels)
+{
+    assert(g_chip == encode_get_chip(ENCODE_CHIP_WS2815));
+    render(NULL, masks, n_pixels, 256, true);
+}
+
+void panel_pause(void)
+{
+    xSemaphoreTake(g_busy, portMAX_DELAY);
+}
+
+void panel_resume(void)
+{
+    xSemaphoreGive(g_busy);
+}
+
+void panel_timing(uint32_t *start, uint32_t *first_bit)
+{
+    *start = g_start;
+    *first_bit = g_first_bit;
+}
+
+void panel_stats(uint32_t *n_frames, uint32_t *n_underruns)
+{
+    *n_frames = __atomic_load_n(&g_n_frames, __ATOMIC_RELAXED);
+    *n_underruns = __atomic_load_n(&g_n_underruns, __ATOMIC_RELAXED);
+}
+
 void panel_test_pattern(void)
 {
-    // Create 1 ms's worth of output (= 10000 samples). Make gpio_no_1 flip
-    // every 100 ns, gpio_no_2 every 200 ns.
+    // Create 1 ms's worth of output (= 10000 samples), at 100 ns per sample.
+    // Make gpio_no_1 flip every 100 ns, gpio_no_2 every 200 ns.
 
-    static uint16_t samples[SAMPLE_RATE / 1000];
+    static uint16_t samples[N_TEST_SAMPLES];
 
-    for (int32_t i = 0; i < SAMPLE_RATE / 1000; ++i) {
+    for (int32_t i = 0; i < N_TEST_SAMPLES; ++i) {
         samples[i] = (uint16_t)(i & 3);
     }
 
@@ -123,9 +264,11 @@ void panel_test_pattern(void)
     uint32_t iter = 0;
 
     while (true) {
-        ESP_LOGI("NN", "%d", iter++);
+        trace_event(TRACE_TEST_PATTERN, iter++, 0);
 
+        xSemaphoreTake(g_busy, portMAX_DELAY);
         write_data(samples, sizeof samples);
+        xSemaphoreGive(g_busy);
 
         vTaskDelay(ticks_pause);
     }
@@ -133,12 +276,173 @@ void panel_test_pattern(void)
 
 // --- Helpers -----------------------------------------------------------------
 
+// Output a frame, see panel_render_mix(). With a weight of 256, from is
+// ignored and the pixels are encoded as they are. With wave set, the pixels
+// are pre-encoded, see panel_render_wave(), and can't be mixed.
+static void render(const uint8_t *from, const uint8_t *pixels,
+        size_t n_pixels, uint32_t weight, bool wave)
+{
+    assert(!wave || weight == 256);
+    assert(n_pixels % PANEL_N_LANES == 0);
+
+    // Until the silence after the frame is queued, see panel_pause().
+
+    xSemaphoreTake(g_busy, portMAX_DELAY);
+
+    prof_t publish;
+    prof_start(&publish);
+
+    g_start = util_cycle_count();
+
+    size_t pixel_sz = g_chip->pixel_sz;
+    size_t lane_pixels = n_pixels / PANEL_N_LANES;
+
+    // With clocked chips, the first bit goes out with the start frame, i.e.,
+    // before the pixels.
+
+    size_t head_bits = 0;
+    size_t tail_bits = 0;
+    size_t first_bit_at = g_pixels_per_buf;
+
+    if (g_chip->clocked) {
+        encode_frame_bits(g_chip, lane_pixels, &head_bits, &tail_bits);
+        write_clock(head_bits);
+        first_bit_at = 0;
+    }
+
+    const uint8_t *lanes[PANEL_N_LANES];
+
+    for (int32_t i = 0; i < PANEL_N_LANES; ++i) {
+        lanes[i] = pixels + (size_t)i * lane_pixels * pixel_sz;
+    }
+
+    // When mixing, each DMA buffer's worth of pixels is mixed into g_mixed
+    // first and encoded from there.
+
+    uint8_t *mixed[PANEL_N_LANES];
+    const uint8_t *mixed_lanes[PANEL_N_LANES];
+
+    for (int32_t i = 0; i < PANEL_N_LANES; ++i) {
+        mixed[i] = g_mixed + (size_t)i * g_pixels_per_buf * pixel_sz;
+        mixed_lanes[i] = mixed[i];
+    }
+
+    // Encode directly into the DMA buffers as they become available. The
+    // pixels may well live in mapped flash; they're read exactly once.
+
+    for (size_t first = 0; first < lane_pixels; first += g_pixels_per_buf) {
+        volatile uint8_t *buf = get_dma_buffer();
+
+        // The DMA engine just moved on to the first buffer that we filled.
+
+        if (first == first_bit_at) {
+            g_first_bit = util_cycle_count();
+        }
+
+        prof_t refill;
+        prof_start(&refill);
+
+        size_t n = lane_pixels - first;
+
+        if (n > g_pixels_per_buf) {
+            n = g_pixels_per_buf;
+        }
+
+        prof_t encode;
+        prof_start(&encode);
+
+        // The DMA engine is done with the buffer, so plain stores are fine.
+
+        if (wave) {
+            encode_wave(pixels, PANEL_N_LANES, first, n,
+                    (uint16_t *)(uintptr_t)buf);
+        }
+        else if (weight < 256) {
+            for (int32_t i = 0; i < PANEL_N_LANES; ++i) {
+                size_t at = ((size_t)i * lane_pixels + first) * pixel_sz;
+                mix(from != NULL ? from + at : NULL, pixels + at,
+                        n * pixel_sz, weight, mixed[i]);
+            }
+
+            g_chip->encode(mixed_lanes, PANEL_N_LANES, 0, n,
+                    (uint16_t *)(uintptr_t)buf);
+        }
+        else {
+            g_chip->encode(lanes, PANEL_N_LANES, first, n,
+                    (uint16_t *)(uintptr_t)buf);
+        }
+
+        prof_stop(&encode, PROBE_ENCODE);
+
+        size_t sz = encode_n_samples(g_chip, n) * sizeof (uint16_t);
+        v_memset(buf + sz, 0, g_buf_sz - sz);
+
+        prof_stop(&refill, PROBE_DMA_REFILL);
+
+        if (is_sending(buf)) {
+            __atomic_fetch_add(&g_n_underruns, 1, __ATOMIC_RELAXED);
+        }
+    }
+
+    // Close enough for frames that fit into a single buffer.
+
+    if (lane_pixels <= first_bit_at) {
+        g_first_bit = util_cycle_count();
+    }
+
+    write_clock(tail_bits);
+    write_silence();
+
+    xSemaphoreGive(g_busy);
+
+    __atomic_fetch_add(&g_n_frames, 1, __ATOMIC_RELAXED);
+    prof_stop(&publish, PROBE_PUBLISH);
+}
+
+// Mix sz bytes of from and to, weight / 256 of to. from may be NULL for black.
+static void mix(const uint8_t *from, const uint8_t *to, size_t sz,
+        uint32_t weight, uint8_t *out)
+{
+    if (from == NULL) {
+        for (size_t i = 0; i < sz; ++i) {
+            out[i] = (uint8_t)((to[i] * weight) >> 8);
+        }
+
+        return;
+    }
+
+    for (size_t i = 0; i < sz; ++i) {
+        out[i] = (uint8_t)((to[i] * weight + from[i] * (256 - weight)) >> 8);
+    }
+}
+
+// For clocked chips, output n_bits 0 bits with the clock running, as the
+// start and end frames need them.
+static void write_clock(size_t n_bits)
+{
+    size_t buf_bits = g_buf_sz / sizeof (uint16_t) / g_chip->bit;
+
+    while (n_bits > 0) {
+        volatile uint8_t *buf = get_dma_buffer();
+        size_t n = n_bits < buf_bits ? n_bits : buf_bits;
+
+        // The DMA engine is done with the buffer, so plain stores are fine.
+
+        encode_clock(g_chip, PANEL_N_LANES, n, (uint16_t *)(uintptr_t)buf);
+
+        size_t sz = n * g_chip->bit * sizeof (uint16_t);
+        v_memset(buf + sz, 0, g_buf_sz - sz);
+
+        n_bits -= n;
+    }
+}
+
 static void write_data(const void *data, size_t sz)
 {
     assert((sz & 3) == 0);
 
     // Copy data to DMA buffers as they become available. Pad data with
-    // silence to make its length a multiple of DMA_BUF_SZ.
+    // silence to make its length a multiple of g_buf_sz.
 
     const uint8_t *data_8 = data;
 
@@ -146,49 +450,68 @@ static void write_data(const void *data, size_t sz)
         // Wait for a DMA buffer to become available.
         volatile uint8_t *buf = get_dma_buffer();
 
-        if (sz > DMA_BUF_SZ) {
+        if (sz > g_buf_sz) {
             // Fill DMA buffer with samples.
-            v_memcpy(buf, data_8, DMA_BUF_SZ);
+            v_memcpy(buf, data_8, g_buf_sz);
 
-            data_8 += DMA_BUF_SZ;
-            sz -= DMA_BUF_SZ;
+            data_8 += g_buf_sz;
+            sz -= g_buf_sz;
         }
         else {
             // Fill DMA buffer with samples.
             v_memcpy(buf, data_8, sz);
             // Pad DMA buffer with silence.
-            v_memset(buf + sz, 0, DMA_BUF_SZ - sz);
+            v_memset(buf + sz, 0, g_buf_sz - sz);
             break;
         }
     }
 
-    // Done with copying samples. Now fill DMA buffers with silence as they
-    // become available.
+    write_silence();
+}
+
+static void write_silence(void)
+{
+    // Fill DMA buffers with silence as they become available. The DMA engine
+    // keeps cycling through them, so the output then stays silent.
 
     for (int32_t i = 0; i < N_DMA_BUFS; ++i) {
         // Wait for a DMA buffer to become available.
         volatile uint8_t *buf = get_dma_buffer();
 
         // Fill it with silence.
-        v_memset(buf, 0, DMA_BUF_SZ);
+        v_memset(buf, 0, g_buf_sz);
     }
 }
 
 static volatile uint8_t *get_dma_buffer(void)
 {
     lldesc_t *prev_desc = (lldesc_t *)I2S0.out_eof_des_addr;
-    lldesc_t *desc;
+    lldesc_t *desc = prev_desc;
 
-    // Wait for the next DMA descriptor to finish.
+    // Wait for the next DMA descriptor to finish. Sleep until the driver's
+    // interrupt says that one did, rather than poll, so that the output task
+    // doesn't keep its core from lower priority work. The queue may still
+    // hold events from before we started waiting, so the descriptor decides.
 
-    do {
+    while (desc == prev_desc) {
+        i2s_event_t event;
+        xQueueReceive(g_dma_events, &event, portMAX_DELAY);
         desc = (lldesc_t *)I2S0.out_eof_des_addr;
-    } while (desc == prev_desc);
+    }
 
     // Return the DMA buffer of the DMA descriptor that just finished.
     return desc->buf;
 }
 
+// Check whether the DMA engine has moved on to the given buffer, which
+// get_dma_buffer() returned. If so, it finished the other buffer before we
+// were done refilling this one.
+static bool is_sending(volatile uint8_t *buf)
+{
+    lldesc_t *desc = (lldesc_t *)I2S0.out_eof_des_addr;
+    return desc->buf != buf;
+}
+
 static void v_memcpy(volatile void *to, const void *from, size_t sz)
 {
     assert((sz & 3) == 0);
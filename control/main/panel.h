@@ -17,18 +17,62 @@
 
 // --- Includes ----------------------------------------------------------------
 
+#include <stddef.h>
 #include <stdint.h>
 
+#include <encode.h>
+
 // --- Types and constants -----------------------------------------------------
 
+#define PANEL_N_LANES 2
+
 // --- Macros and inline functions ---------------------------------------------
 
 // --- Globals -----------------------------------------------------------------
 
 // --- API ---------------------------------------------------------------------
 
-// Initialize.
-void panel_init(uint32_t gpio_no_1, uint32_t gpio_no_2);
+// Initialize for the given LEDs. gpio_no_clock is for clocked chips only,
+// which share a clock across lanes.
+void panel_init(uint32_t gpio_no_1, uint32_t gpio_no_2,
+        uint32_t gpio_no_clock, const encode_chip_t *chip);
+
+// Output a frame of pixels, in the format that the chip given to panel_init()
+// takes, i.e., RGB or RGBW. The first half of the pixels goes to the first
+// lane, the second half to the second lane. Returns after the frame has been
+// output.
+void panel_render(const uint8_t *pixels, size_t n_pixels);
+
+// Like panel_render(), but output a mix of from and pixels, weight / 256 of
+// pixels, the rest of from. from may be NULL for black. Mixing happens on the
+// fly, in small chunks, so no frame-sized buffer is needed.
+void panel_render_mix(const uint8_t *from, const uint8_t *pixels,
+        size_t n_pixels, uint32_t weight);
+
+// Like panel_render(), but from masks, which hold the pixels pre-encoded for
+// PANEL_N_LANES lanes, see encode_masks(). Copies ready-made samples to the
+// DMA buffers, so it takes a fraction of the time. WS2815 only.
+void panel_render_wave(const uint8_t *masks, size_t n_pixels);
+
+// Wait until the frame being output, if any, is done, then keep new ones
+// from starting until panel_resume(). Writing or erasing flash stalls both
+// cores, which would leave the DMA engine cycling through stale pixels in
+// the middle of a frame. Between frames, it cycles through silence, and the
+// LEDs keep showing the last frame. So, everything that writes flash while
+// frames are being output does it between panel_pause() and panel_resume().
+void panel_pause(void);
+
+// Let frames be output again.
+void panel_resume(void);
+
+// Get the CPU cycle counts at which the last frame started rendering and at
+// which its first bit went out, i.e., when the DMA engine got to the first
+// buffer of it. Only meaningful on the core that rendered it.
+void panel_timing(uint32_t *start, uint32_t *first_bit);
+
+// Get the number of frames output so far and the number of DMA buffers that
+// weren't refilled in time, i.e., that went out with stale data.
+void panel_stats(uint32_t *n_frames, uint32_t *n_underruns);
 
 // Generate test pattern.
 void panel_test_pattern(void);
@@ -0,0 +1,167 @@
+// play.c
+//
+// Copyright (C) 2020 by the contributors
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+
+// --- Includes ----------------------------------------------------------------
+
+#include <play.h>
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <show.h>
+
+#include <warnings.h>
+
+// --- Types and constants -----------------------------------------------------
+
+// --- Macros and inline functions ---------------------------------------------
+
+// --- Globals -----------------------------------------------------------------
+
+// --- Helper declarations -----------------------------------------------------
+
+static bool load_key_frame(play_t *play, uint32_t key_id);
+static play_slot_t *find_slot(play_t *play, uint32_t key_id);
+static play_slot_t *oldest_slot(play_t *play);
+
+// --- API ---------------------------------------------------------------------
+
+void play_init(play_t *play, const show_t *show, uint8_t *work, uint8_t *cache,
+        uint32_t n_slots)
+{
+    assert(n_slots <= PLAY_MAX_SLOTS);
+
+    play->show = show;
+    play->work = work;
+    play->work_id = SHOW_NO_FRAME;
+    play->n_slots = n_slots;
+    play->clock = 0;
+    play->n_hits = 0;
+    play->n_misses = 0;
+
+    for (uint32_t i = 0; i < n_slots; ++i) {
+        play_slot_t *slot = play->slots + i;
+
+        slot->frame_id = SHOW_NO_FRAME;
+        slot->last_use = 0;
+        slot->pixels = cache + i * show->frame_sz;
+    }
+}
+
+const uint8_t *play_frame(play_t *play, uint32_t frame_id)
+{
+    const show_t *show = play->show;
+
+    if (frame_id >= show->head->n_frames) {
+        return NULL;
+    }
+
+    if (show->head->codec == SHOW_CODEC_RAW) {
+        size_t sz;
+        return show_frame_data(show, frame_id, &sz);
+    }
+
+    if (play->work_id == frame_id) {
+        return play->work;
+    }
+
+    uint32_t key_id = show_key_frame(show, frame_id);
+    uint32_t cur_id = play->work_id;
+
+    // Unless we can simply keep going from the current frame, start over from
+    // the key frame.
+
+    if (cur_id == SHOW_NO_FRAME || cur_id > frame_id || cur_id < key_id) {
+        play->work_id = SHOW_NO_FRAME;
+
+        if (!load_key_frame(play, key_id)) {
+            return NULL;
+        }
+
+        cur_id = key_id;
+    }
+
+    for (uint32_t i = cur_id + 1; i <= frame_id; ++i) {
+        if (!show_apply(show, i, play->work)) {
+            play->work_id = SHOW_NO_FRAME;
+            return NULL;
+        }
+    }
+
+    play->work_id = frame_id;
+    return play->work;
+}
+
+// --- Helpers -----------------------------------------------------------------
+
+static bool load_key_frame(play_t *play, uint32_t key_id)
+{
+    const show_t *show = play->show;
+    play_slot_t *slot = find_slot(play, key_id);
+
+    if (slot != NULL) {
+        ++play->n_hits;
+        slot->last_use = ++play->clock;
+        memcpy(play->work, slot->pixels, show->frame_sz);
+        return true;
+    }
+
+    ++play->n_misses;
+
+    if (!show_apply(show, key_id, play->work)) {
+        return false;
+    }
+
+    slot = oldest_slot(play);
+
+    if (slot != NULL) {
+        slot->frame_id = key_id;
+        slot->last_use = ++play->clock;
+        memcpy(slot->pixels, play->work, show->frame_sz);
+    }
+
+    return true;
+}
+
+static play_slot_t *find_slot(play_t *play, uint32_t key_id)
+{
+    for (uint32_t i = 0; i < play->n_slots; ++i) {
+        if (play->slots[i].frame_id == key_id) {
+            return play->slots + i;
+        }
+    }
+
+    return NULL;
+}
+
+static play_slot_t *oldest_slot(play_t *play)
+{
+    play_slot_t *oldest = NULL;
+
+    for (uint32_t i = 0; i < play->n_slots; ++i) {
+        play_slot_t *slot = play->slots + i;
+
+        if (oldest == NULL || slot->last_use < oldest->last_use) {
+            oldest = slot;
+        }
+    }
+
+    return oldest;
+}
@@ -0,0 +1,71 @@
+// play.h
+//
+// Copyright (C) 2020 by the contributors
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+// --- Includes ----------------------------------------------------------------
+
+#include <show.h>
+
+#include <stdint.h>
+
+// --- Types and constants -----------------------------------------------------
+
+#define PLAY_MAX_SLOTS 8
+
+typedef struct {
+    uint32_t frame_id;
+    uint32_t last_use;
+    uint8_t *pixels;
+} play_slot_t;
+
+// Random access to the frames of a show. Recently decoded key frames are kept
+// in a small cache, so that seeking backwards doesn't decode them again.
+typedef struct {
+    const show_t *show;
+    uint8_t *work;
+    uint32_t work_id;
+    play_slot_t slots[PLAY_MAX_SLOTS];
+    uint32_t n_slots;
+    uint32_t clock;
+    uint32_t n_hits;
+    uint32_t n_misses;
+} play_t;
+
+// --- Macros and inline functions ---------------------------------------------
+
+// --- Globals -----------------------------------------------------------------
+
+// --- API ---------------------------------------------------------------------
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Initialize. work must hold show->frame_sz bytes, cache n_slots times that.
+// Nothing is allocated here or later.
+void play_init(play_t *play, const show_t *show, uint8_t *work, uint8_t *cache,
+        uint32_t n_slots);
+
+// Get the pixels of the given frame, NULL if it can't be decoded. Uncompressed
+// frames are returned in place, i.e., directly from the show's memory.
+// Otherwise, the pixels stay valid until the next call.
+const uint8_t *play_frame(play_t *play, uint32_t frame_id);
+
+#ifdef __cplusplus
+}
+#endif
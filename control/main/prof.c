@@ -0,0 +1,63 @@
+// prof.c
+//
+// Copyright (C) 2020 by the contributors
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+
+// --- Includes ----------------------------------------------------------------
+
+#include <prof.h>
+
+#include <freertos/FreeRTOS.h> // pre 4.1, IDF headers depend on this
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <hist.h>
+#include <proto.h>
+
+#include <warnings.h>
+
+// --- Types and constants -----------------------------------------------------
+
+_Static_assert(PROFILE_N_BUCKETS == HIST_N_BUCKETS, "bucket mismatch");
+_Static_assert(portNUM_PROCESSORS <= PROFILE_N_CORES, "core mismatch");
+
+// --- Macros and inline functions ---------------------------------------------
+
+// --- Globals -----------------------------------------------------------------
+
+uint32_t g_prof_counts[PROFILE_N_PROBES][PROFILE_N_CORES][PROFILE_N_BUCKETS];
+
+// --- Helper declarations -----------------------------------------------------
+
+// --- API ---------------------------------------------------------------------
+
+void prof_read(probe_t probe,
+        uint32_t counts[PROFILE_N_CORES][PROFILE_N_BUCKETS], bool reset)
+{
+    // Not a consistent snapshot, but each count is read and cleared whole.
+
+    for (uint32_t i = 0; i < PROFILE_N_CORES; ++i) {
+        for (uint32_t k = 0; k < PROFILE_N_BUCKETS; ++k) {
+            uint32_t *count = &g_prof_counts[probe][i][k];
+
+            counts[i][k] = reset ? __atomic_exchange_n(count, 0,
+                    __ATOMIC_RELAXED) : __atomic_load_n(count,
+                    __ATOMIC_RELAXED);
+        }
+    }
+}
+
+// --- Helpers -----------------------------------------------------------------
@@ -0,0 +1,72 @@
+// prof.h
+//
+// Copyright (C) 2020 by the contributors
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+// --- Includes ----------------------------------------------------------------
+
+#include <freertos/FreeRTOS.h> // pre 4.1, IDF headers depend on this
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <hist.h>
+#include <proto.h>
+#include <util.h>
+
+// --- Types and constants -----------------------------------------------------
+
+// A running measurement. The cycle counters of the two cores aren't in sync,
+// so a measurement only counts, if it ends on the core that it started on.
+typedef struct {
+    uint32_t start;
+    uint32_t core;
+} prof_t;
+
+// --- Macros and inline functions ---------------------------------------------
+
+// --- Globals -----------------------------------------------------------------
+
+// Histograms of the measured cycles per probe and core.
+extern uint32_t g_prof_counts[PROFILE_N_PROBES][PROFILE_N_CORES]
+        [PROFILE_N_BUCKETS];
+
+// --- API ---------------------------------------------------------------------
+
+// Copy the histograms of the given probe and, optionally, start over.
+void prof_read(probe_t probe,
+        uint32_t counts[PROFILE_N_CORES][PROFILE_N_BUCKETS], bool reset);
+
+// Start measuring.
+static inline void prof_start(prof_t *prof)
+{
+    prof->core = (uint32_t)xPortGetCoreID();
+    prof->start = util_cycle_count();
+}
+
+// Stop measuring and add the cycles taken to the given probe's histogram.
+// Lock-free and cheap enough for code that runs per DMA buffer.
+static inline void prof_stop(const prof_t *prof, probe_t probe)
+{
+    uint32_t cycles = util_cycle_count() - prof->start;
+    uint32_t core = (uint32_t)xPortGetCoreID();
+
+    if (core == prof->core) {
+        __atomic_fetch_add(&g_prof_counts[probe][core][hist_bucket(cycles)], 1,
+                __ATOMIC_RELAXED);
+    }
+}
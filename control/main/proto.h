@@ -0,0 +1,304 @@
+// proto.h
+//
+// Copyright (C) 2020 by the contributors
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+
+// Network protocol, shared by the controllers and the host tools. All integers
+// are little-endian.
+//
+// Upload (TCP)
+//
+//   host                               controller
+//   upload_begin_t             ---->
+//                              <----   upload_ack_t (offset to resume from)
+//   upload_chunk_t + data      ---->
+//   upload_chunk_t + data      ---->   at most UPLOAD_WINDOW chunks in flight
+//                              <----   upload_ack_t (written up to offset)
+//   ...
+//                              <----   upload_ack_t (offset = total size)
+//
+// Chunks start at multiples of UPLOAD_CHUNK_SZ and hold UPLOAD_CHUNK_SZ bytes,
+// except for the last one. A chunk with a bad CRC is answered with
+// RESULT_BAD_CRC and the offset to resend from; the controller ignores chunks
+// until that offset comes around. The final acknowledgement, for the last
+// chunk, carries the result of checking the whole show. After a disconnect,
+// starting over with the same upload_begin_t resumes the upload.
+//
+// Show clock (UDP)
+//
+// Controllers elect a leader, see elect.h, by broadcasting heartbeat_t
+// messages. The leader keeps the show clock. Everybody else - including the
+// host - estimates it from sync exchanges with the leader:
+//
+//   controller                         leader
+//   sync_request_t (t1)        ---->
+//                              <----   sync_reply_t (t1, t2, t3)
+//
+// START, STOP and RENDER_FRAME are cue_t messages, broadcast by the host. They
+// take effect at a given show clock time, i.e., simultaneously everywhere. The
+// leader repeats the current cue in its heartbeats, so that controllers that
+// missed it, or that came late, catch up, and so that the show goes on without
+// the host. A new leader carries on with the show clock and the cue of the old
+// one.
+//
+// Streaming (UDP)
+//
+// Instead of playing a show, controllers play frames streamed by the host,
+// while there are any. The host broadcasts each frame to PROTO_STREAM_PORT, or
+// sends each controller its own part of the wall, as FRAME_DATA messages,
+// i.e., frame_part_t + up to STREAM_PART_SZ bytes of RGB
+// pixels, stamped with the show clock time it sent the frame at. Optionally,
+// parity parts follow, from which controllers rebuild lost parts without
+// asking for them again, see jitter.h. A frame is shown at its time plus the
+// playout delay, which absorbs the network jitter. Each controller works out
+// the delay that it needs and sends it in its heartbeat. The leader's
+// heartbeat carries the largest one, which everybody uses.
+//
+// Profiling (UDP)
+//
+//   host                               controller
+//   profile_request_t          ---->
+//                              <----   profile_reply_t
+//
+// Controllers time what they do with the CPU cycle counter, see prof.h. The
+// reply holds the histograms of one probe, one per CPU core, bucketed as
+// described in hist.h.
+//
+// Telemetry (UDP)
+//
+//   host                               controller
+//   STATS (command byte only)  ---->
+//                              <----   stats_reply_t
+//
+// The host broadcasts the request to poll all controllers at once. Counters
+// only ever grow, except for the stream's, which start over with each stream.
+// Rates, such as frames per second, follow from two replies.
+//
+// Streamed frames carry the show clock time at which the host sent them. The
+// controllers time how long after that each frame reaches each stage of its
+// way to the LEDs, see latency_stage_t, so the host needs no timestamps of
+// its own to correlate them with.
+
+#pragma once
+
+// --- Includes ----------------------------------------------------------------
+
+#include <stdint.h>
+
+// --- Types and constants -----------------------------------------------------
+
+#define PROTO_UDP_PORT 1972
+#define PROTO_TCP_PORT 1972
+#define PROTO_STREAM_PORT 1973
+
+typedef enum {
+    COMMAND_PING,
+    COMMAND_UPLOAD,
+    COMMAND_PREPARE,
+    COMMAND_START,
+    COMMAND_STOP,
+    COMMAND_RENDER_FRAME,
+    COMMAND_SYNC,
+    COMMAND_HEARTBEAT,
+    COMMAND_FRAME_DATA,
+    COMMAND_PROFILE,
+    COMMAND_STATS
+} command_t;
+
+typedef enum {
+    RESULT_OK,
+    RESULT_NOT_MASTER,
+    RESULT_BAD_REQUEST,
+    RESULT_BAD_CRC,
+    RESULT_BAD_SHOW,
+    RESULT_TOO_LARGE,
+    RESULT_FLASH_ERROR
+} result_t;
+
+// Reply to a ping, which is a COMMAND_PING byte and a sequence number byte.
+// Controllers hold replies for a random time, so that the replies to a
+// broadcast ping don't all collide. held says for how long, in microseconds,
+// so that round trip times can leave it out.
+typedef struct {
+    uint8_t seq;
+    // Whether the sender leads.
+    uint8_t leader;
+    uint16_t held;
+} ping_reply_t;
+
+#define UPLOAD_CHUNK_SZ 4096
+#define UPLOAD_WINDOW 4
+
+typedef struct {
+    uint8_t command;
+    uint8_t pad[3];
+    uint32_t total_sz;
+    // CRC-32 of the whole show. Identifies the upload when resuming.
+    uint32_t crc;
+} upload_begin_t;
+
+typedef struct {
+    uint32_t offset;
+    uint32_t sz;
+    uint32_t crc;
+} upload_chunk_t;
+
+typedef struct {
+    uint8_t result;
+    uint8_t pad[3];
+    uint32_t offset;
+} upload_ack_t;
+
+typedef struct {
+    uint8_t command;
+    uint8_t pad[3];
+    uint32_t seq;
+    // Sender's clock when sending.
+    int64_t t1;
+} sync_request_t;
+
+// Unless result is RESULT_OK, the replying controller isn't the leader and the
+// times are meaningless.
+typedef struct {
+    uint8_t command;
+    uint8_t result;
+    uint8_t pad[2];
+    uint32_t seq;
+    int64_t t1;
+    // Show clock when receiving the request and when replying.
+    int64_t t2;
+    int64_t t3;
+} sync_reply_t;
+
+// START plays frame_id at show clock time at, and the following frames after
+// it. RENDER_FRAME only shows frame_id. STOP freezes the panel at time at.
+typedef struct {
+    uint8_t command;
+    uint8_t pad[3];
+    uint32_t frame_id;
+    int64_t at;
+} cue_t;
+
+typedef struct {
+    uint8_t command;
+    // Whether the sender is ready to lead.
+    uint8_t ready;
+    uint8_t pad[2];
+    uint32_t ip;
+    // The playout delay for streamed frames that the sender needs, or, for the
+    // leader, the one to use.
+    int64_t delay;
+    // The sender's current cue. Followers take the leader's.
+    cue_t cue;
+} heartbeat_t;
+
+// Fits into a single Ethernet frame, with the header.
+#define STREAM_PART_SZ 1200
+
+// Part part of n_parts of frame frame_id, which is frame_sz bytes. All parts
+// hold STREAM_PART_SZ bytes, except for the last one. Parts n_parts and up are
+// the n_parity parity parts, which are the size of the first part. Frame IDs
+// count up by one per frame.
+typedef struct {
+    uint8_t command;
+    uint8_t part;
+    uint8_t n_parts;
+    uint8_t n_parity;
+    uint32_t frame_id;
+    // Show clock when sending the frame.
+    int64_t at;
+    uint32_t frame_sz;
+    uint8_t pad2[4];
+} frame_part_t;
+
+typedef enum {
+    // Encoding pixels into a DMA buffer. Refilling a DMA buffer, which
+    // includes encoding. Handling a received stream part. Decoding a show
+    // frame. Outputting a whole frame to the panel.
+    PROBE_ENCODE,
+    PROBE_DMA_REFILL,
+    PROBE_PARSE,
+    PROBE_DECOMPRESS,
+    PROBE_PUBLISH,
+    PROFILE_N_PROBES
+} probe_t;
+
+#define PROFILE_N_CORES 2
+// Same as HIST_N_BUCKETS.
+#define PROFILE_N_BUCKETS 124
+
+// With reset set, the controller starts over after replying.
+typedef struct {
+    uint8_t command;
+    uint8_t probe;
+    uint8_t reset;
+    uint8_t pad;
+} profile_request_t;
+
+// Unless result is RESULT_OK, the probe is unknown and there are no counts.
+typedef struct {
+    uint8_t command;
+    uint8_t probe;
+    uint8_t result;
+    uint8_t pad;
+    // To convert cycles to time.
+    uint32_t cpu_mhz;
+    uint32_t counts[PROFILE_N_CORES][PROFILE_N_BUCKETS];
+} profile_reply_t;
+
+typedef enum {
+    // A streamed frame's first part received, its last part received, the
+    // frame taken from the jitter buffer, rendering started, its first bit
+    // out to the LEDs.
+    LATENCY_RECEIVE,
+    LATENCY_COMPLETE,
+    LATENCY_PUBLISH,
+    LATENCY_ENCODE,
+    LATENCY_FIRST_BIT,
+    LATENCY_N_STAGES
+} latency_stage_t;
+
+typedef struct {
+    uint8_t command;
+    // Signal strength in dBm, 0, if the sender is the access point.
+    int8_t rssi;
+    uint8_t pad[2];
+    uint32_t uptime_ms;
+    // Frames output to the panel, DMA buffers that weren't refilled in time.
+    uint32_t n_frames;
+    uint32_t n_underruns;
+    // Stream parts received, lost, received out of order, received too late
+    // or dropped, see jitter_stats_t.
+    uint32_t n_parts;
+    uint32_t n_lost;
+    uint32_t n_reordered;
+    uint32_t n_late;
+    // Time from the host sending a streamed frame until it's on the panel, in
+    // microseconds, over the last 10 to 20 seconds: 50th, 90th, 99th
+    // percentile and maximum. Upper bounds, see hist.h.
+    uint32_t latency[4];
+    // Free heap now and at its lowest.
+    uint32_t free_heap;
+    uint32_t min_free_heap;
+    // Like latency, but from the host sending a frame until it reaches each
+    // stage, see latency_stage_t. The last one is the display delay.
+    uint32_t stages[LATENCY_N_STAGES][4];
+} stats_reply_t;
+
+// --- Macros and inline functions ---------------------------------------------
+
+// --- Globals -----------------------------------------------------------------
+
+// --- API ---------------------------------------------------------------------
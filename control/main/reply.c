@@ -0,0 +1,174 @@
+// reply.c
+//
+// Copyright (C) 2020 by the contributors
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+
+// --- Includes ----------------------------------------------------------------
+
+#include <reply.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <hist.h>
+#include <jitter.h>
+#include <proto.h>
+
+#include <warnings.h>
+
+// --- Types and constants -----------------------------------------------------
+
+// --- Macros and inline functions ---------------------------------------------
+
+// --- Globals -----------------------------------------------------------------
+
+// --- Helper declarations -----------------------------------------------------
+
+static void rotate(reply_window_t *win, int64_t now);
+static void add(uint32_t *counts, int64_t latency);
+static void get_percentiles(const uint32_t *counts_1,
+        const uint32_t *counts_2, uint32_t *percentiles);
+
+// --- API ---------------------------------------------------------------------
+
+bool reply_ping(const uint8_t *req, size_t sz, bool leader,
+        ping_reply_t *reply)
+{
+    if (sz != 2 || req[0] != COMMAND_PING) {
+        return false;
+    }
+
+    reply->seq = req[1];
+    reply->leader = leader ? 1 : 0;
+    reply->held = 0;
+
+    return true;
+}
+
+void reply_set_held(ping_reply_t *reply, int64_t held)
+{
+    if (held < 0) {
+        held = 0;
+    }
+
+    reply->held = (uint16_t)(held < UINT16_MAX ? held : UINT16_MAX);
+}
+
+void reply_init_window(reply_window_t *win, int64_t now)
+{
+    memset(win, 0, sizeof *win);
+    win->window_start = now;
+}
+
+void reply_add_latency(reply_window_t *win, int64_t now, int64_t latency)
+{
+    rotate(win, now);
+    add(win->latency[0], latency);
+}
+
+void reply_add_stages(reply_window_t *win, int64_t now,
+        const int64_t *stages)
+{
+    rotate(win, now);
+
+    for (uint32_t i = 0; i < LATENCY_N_STAGES; ++i) {
+        add(win->stages[0][i], stages[i]);
+    }
+}
+
+bool reply_stats(size_t sz, reply_window_t *win, int64_t now,
+        const jitter_stats_t *stream, stats_reply_t *reply)
+{
+    if (sz != 1) {
+        return false;
+    }
+
+    memset(reply, 0, sizeof *reply);
+    reply->command = COMMAND_STATS;
+
+    rotate(win, now);
+
+    get_percentiles(win->latency[0], win->latency[1], reply->latency);
+
+    for (uint32_t i = 0; i < LATENCY_N_STAGES; ++i) {
+        get_percentiles(win->stages[0][i], win->stages[1][i],
+                reply->stages[i]);
+    }
+
+    if (stream != NULL) {
+        reply->n_parts = stream->n_parts;
+        reply->n_lost = stream->n_lost;
+        reply->n_reordered = stream->n_reordered;
+        reply->n_late = stream->n_late + stream->n_dropped;
+    }
+
+    return true;
+}
+
+// --- Helpers -----------------------------------------------------------------
+
+// Start a new window, if it's time.
+static void rotate(reply_window_t *win, int64_t now)
+{
+    if (now - win->window_start < REPLY_WINDOW_US) {
+        return;
+    }
+
+    memcpy(win->latency[1], win->latency[0], sizeof win->latency[0]);
+    memset(win->latency[0], 0, sizeof win->latency[0]);
+    memcpy(win->stages[1], win->stages[0], sizeof win->stages[0]);
+    memset(win->stages[0], 0, sizeof win->stages[0]);
+
+    // After a long quiet time, the previous window is empty, too.
+
+    if (now - win->window_start >= 2 * REPLY_WINDOW_US) {
+        memset(win->latency[1], 0, sizeof win->latency[1]);
+        memset(win->stages[1], 0, sizeof win->stages[1]);
+    }
+
+    win->window_start = now;
+}
+
+// Count a latency, clamped to what the histogram holds.
+static void add(uint32_t *counts, int64_t latency)
+{
+    if (latency < 0) {
+        latency = 0;
+    }
+
+    if (latency > UINT32_MAX) {
+        latency = UINT32_MAX;
+    }
+
+    ++counts[hist_bucket((uint32_t)latency)];
+}
+
+// Get the percentiles that a STATS reply wants over both windows.
+static void get_percentiles(const uint32_t *counts_1,
+        const uint32_t *counts_2, uint32_t *percentiles)
+{
+    static const uint32_t per_mille[4] = { 500, 900, 990, 1000 };
+    uint32_t counts[HIST_N_BUCKETS];
+
+    for (uint32_t i = 0; i < HIST_N_BUCKETS; ++i) {
+        counts[i] = counts_1[i] + counts_2[i];
+    }
+
+    for (uint32_t i = 0; i < 4; ++i) {
+        percentiles[i] = hist_percentile(counts, per_mille[i]);
+    }
+}
@@ -0,0 +1,82 @@
+// reply.h
+//
+// Copyright (C) 2020 by the contributors
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+// --- Includes ----------------------------------------------------------------
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <hist.h>
+#include <jitter.h>
+#include <proto.h>
+
+// --- Types and constants -----------------------------------------------------
+
+// Latency percentiles in STATS replies cover the current and the previous
+// window of this length.
+#define REPLY_WINDOW_US 10000000
+
+// The latency histograms that STATS replies report on, see stats_reply_t.
+// Times are in microseconds.
+typedef struct {
+    uint32_t latency[2][HIST_N_BUCKETS];
+    uint32_t stages[2][LATENCY_N_STAGES][HIST_N_BUCKETS];
+    int64_t window_start;
+} reply_window_t;
+
+// --- Macros and inline functions ---------------------------------------------
+
+// --- Globals -----------------------------------------------------------------
+
+// --- API ---------------------------------------------------------------------
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Check a PING request and build the reply to it. Returns false, if the
+// request is malformed. held stays 0, see reply_set_held().
+bool reply_ping(const uint8_t *req, size_t sz, bool leader,
+        ping_reply_t *reply);
+
+// Record for how long a ping reply was held, clamped to what fits.
+void reply_set_held(ping_reply_t *reply, int64_t held);
+
+// Initialize, with the first window starting now.
+void reply_init_window(reply_window_t *win, int64_t now);
+
+// Add the latency of a streamed frame, i.e., the time from the host sending it
+// until it's on the panel.
+void reply_add_latency(reply_window_t *win, int64_t now, int64_t latency);
+
+// Add the times from the host sending a streamed frame until it reached each
+// stage, see latency_stage_t.
+void reply_add_stages(reply_window_t *win, int64_t now,
+        const int64_t *stages);
+
+// Check a STATS request and build the reply to it, as far as it doesn't
+// depend on the hardware: the latency percentiles and, unless stream is NULL,
+// the stream's counts. Returns false, if the request is malformed.
+bool reply_stats(size_t sz, reply_window_t *win, int64_t now,
+        const jitter_stats_t *stream, stats_reply_t *reply);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,293 @@
+// show.c
+//
+// Copyright (C) 2020 by the contributors
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+
+// --- Includes ----------------------------------------------------------------
+
+#include <show.h>
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <crc.h>
+
+#include <warnings.h>
+
+// --- Types and constants -----------------------------------------------------
+
+_Static_assert(sizeof (show_header_t) == 40, "show_header_t layout");
+_Static_assert(sizeof (show_index_t) == 8, "show_index_t layout");
+
+// --- Macros and inline functions ---------------------------------------------
+
+// --- Globals -----------------------------------------------------------------
+
+// --- Helper declarations -----------------------------------------------------
+
+static show_result_t check_header(const show_header_t *head, size_t sz);
+static show_result_t check_index(const show_t *show);
+static bool run_length_decode(const uint8_t *in, size_t in_sz, uint8_t *out,
+        size_t out_sz, bool delta);
+
+// --- API ---------------------------------------------------------------------
+
+show_result_t show_open(show_t *show, const void *data, size_t sz)
+{
+    // Flash mappings and heap blocks are both suitably aligned.
+    assert(((uintptr_t)data & 3) == 0);
+
+    if (sz < sizeof (show_header_t)) {
+        return SHOW_BAD_SIZE;
+    }
+
+    const show_header_t *head = data;
+    show_result_t res = check_header(head, sz);
+
+    if (res != SHOW_OK) {
+        return res;
+    }
+
+    show->data = data;
+    show->sz = sz;
+    show->head = head;
+    show->index = (const show_index_t *)(show->data + head->index_off);
+    show->frames = show->data + head->data_off;
+    show->frame_sz = (size_t)head->width * head->height *
+            show_pixel_sz(head->format);
+
+    return check_index(show);
+}
+
+show_result_t show_check(const show_t *show, uint8_t *pixels)
+{
+    const show_header_t *head = show->head;
+
+    uint32_t crc = crc_32(CRC_INIT, show->data + head->index_off,
+            head->data_off + head->data_sz - head->index_off);
+
+    if (crc != head->crc) {
+        return SHOW_BAD_CRC;
+    }
+
+    for (uint32_t i = 0; i < head->n_frames; ++i) {
+        if (!show_apply(show, i, pixels)) {
+            return SHOW_BAD_FRAME;
+        }
+    }
+
+    return SHOW_OK;
+}
+
+size_t show_pixel_sz(uint8_t format)
+{
+    switch (format) {
+    case SHOW_FORMAT_RGB:
+    case SHOW_FORMAT_WAVE:
+        return 3;
+
+    case SHOW_FORMAT_RGBW:
+        return 4;
+
+    default:
+        return 0;
+    }
+}
+
+bool show_decode(const show_t *show, uint32_t frame_id, uint32_t cur_id,
+        uint8_t *pixels)
+{
+    if (frame_id >= show->head->n_frames) {
+        return false;
+    }
+
+    uint32_t key_id = show_key_frame(show, frame_id);
+    uint32_t first_id;
+
+    if (cur_id != SHOW_NO_FRAME && cur_id <= frame_id && cur_id >= key_id) {
+        first_id = cur_id + 1;
+    }
+    else {
+        first_id = key_id;
+    }
+
+    for (uint32_t i = first_id; i <= frame_id; ++i) {
+        if (!show_apply(show, i, pixels)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool show_apply(const show_t *show, uint32_t frame_id, uint8_t *pixels)
+{
+    size_t sz;
+    const uint8_t *data = show_frame_data(show, frame_id, &sz);
+
+    if (show->head->codec == SHOW_CODEC_RAW) {
+        memcpy(pixels, data, sz);
+        return true;
+    }
+
+    bool delta = frame_id % show->head->key_interval != 0;
+    return run_length_decode(data, sz, pixels, show->frame_sz, delta);
+}
+
+const char *show_result_str(show_result_t res)
+{
+    switch (res) {
+    case SHOW_OK:
+        return "ok";
+
+    case SHOW_BAD_SIZE:
+        return "truncated show";
+
+    case SHOW_BAD_MAGIC:
+        return "bad magic number";
+
+    case SHOW_BAD_VERSION:
+        return "unsupported version";
+
+    case SHOW_BAD_HEADER:
+        return "bad header field";
+
+    case SHOW_BAD_INDEX:
+        return "bad frame index";
+
+    case SHOW_BAD_CRC:
+        return "CRC mismatch";
+
+    case SHOW_BAD_FRAME:
+        return "bad frame data";
+
+    default:
+        return "unknown error";
+    }
+}
+
+// --- Helpers -----------------------------------------------------------------
+
+static show_result_t check_header(const show_header_t *head, size_t sz)
+{
+    if (head->magic != SHOW_MAGIC) {
+        return SHOW_BAD_MAGIC;
+    }
+
+    if (head->version != SHOW_VERSION) {
+        return SHOW_BAD_VERSION;
+    }
+
+    if (head->header_sz < sizeof (show_header_t) ||
+            head->header_sz > head->index_off ||
+            (head->index_off & 3) != 0 ||
+            head->width == 0 || head->height == 0 || head->fps == 0 ||
+            show_pixel_sz(head->format) == 0 ||
+            (head->format == SHOW_FORMAT_WAVE &&
+                (uint32_t)head->width * head->height % SHOW_WAVE_LANES != 0) ||
+            head->codec > SHOW_CODEC_RLE ||
+            head->n_frames == 0 || head->key_interval == 0 ||
+            (head->codec == SHOW_CODEC_RAW && head->key_interval != 1)) {
+        return SHOW_BAD_HEADER;
+    }
+
+    uint64_t index_end = (uint64_t)head->index_off +
+            (uint64_t)head->n_frames * sizeof (show_index_t);
+
+    if (index_end > head->data_off) {
+        return SHOW_BAD_HEADER;
+    }
+
+    if ((uint64_t)head->data_off + head->data_sz > sz) {
+        return SHOW_BAD_SIZE;
+    }
+
+    return SHOW_OK;
+}
+
+static show_result_t check_index(const show_t *show)
+{
+    const show_header_t *head = show->head;
+
+    for (uint32_t i = 0; i < head->n_frames; ++i) {
+        const show_index_t *entry = show->index + i;
+
+        if ((uint64_t)entry->off + entry->sz > head->data_sz) {
+            return SHOW_BAD_INDEX;
+        }
+
+        if (head->codec == SHOW_CODEC_RAW && entry->sz != show->frame_sz) {
+            return SHOW_BAD_INDEX;
+        }
+    }
+
+    return SHOW_OK;
+}
+
+static bool run_length_decode(const uint8_t *in, size_t in_sz, uint8_t *out,
+        size_t out_sz, bool delta)
+{
+    const uint8_t *in_end = in + in_sz;
+    uint8_t *out_end = out + out_sz;
+
+    while (in < in_end) {
+        uint32_t ctrl = *in++;
+
+        if (ctrl < 0x80) {
+            size_t len = ctrl + 1;
+
+            if ((size_t)(in_end - in) < len || (size_t)(out_end - out) < len) {
+                return false;
+            }
+
+            if (delta) {
+                for (size_t i = 0; i < len; ++i) {
+                    out[i] ^= in[i];
+                }
+            }
+            else {
+                memcpy(out, in, len);
+            }
+
+            in += len;
+            out += len;
+        }
+        else {
+            size_t len = ctrl - 0x80 + 2;
+
+            if (in == in_end || (size_t)(out_end - out) < len) {
+                return false;
+            }
+
+            uint8_t val = *in++;
+
+            if (!delta) {
+                memset(out, val, len);
+            }
+            else if (val != 0) {
+                for (size_t i = 0; i < len; ++i) {
+                    out[i] ^= val;
+                }
+            }
+
+            out += len;
+        }
+    }
+
+    return out == out_end;
+}
@@ -0,0 +1,169 @@
+// show.h
+//
+// Copyright (C) 2020 by the contributors
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+
+// Show container format. All integers are little-endian.
+//
+//   +--------------------+  0
+//   | show_header_t      |
+//   +--------------------+  index_off
+//   | show_index_t       |  one entry per frame
+//   | ...                |
+//   +--------------------+  data_off
+//   | frame data         |  index offsets are relative to data_off
+//   | ...                |
+//   +--------------------+  data_off + data_sz
+//
+// Every key_interval-th frame, starting with frame 0, is a key frame and can
+// be decoded on its own. All other frames are deltas against the preceding
+// frame. Reaching any frame thus takes one index lookup plus decoding at most
+// key_interval frames.
+//
+// Frame data is run-length coded. A control byte c < 0x80 is followed by c + 1
+// literal bytes. A control byte c >= 0x80 is followed by a single byte that is
+// repeated c - 0x80 + 2 times. Key frames code the pixel bytes, delta frames
+// code the XOR of the frame with its predecessor. With SHOW_CODEC_RAW, all
+// frames are key frames and store the pixel bytes as-is.
+//
+// With SHOW_FORMAT_WAVE, frames are pre-encoded for SHOW_WAVE_LANES lanes, the
+// first part of the pixels on the first lane, and so on. Instead of pixel
+// bytes, they hold the bit masks that encode_masks() makes of them, the same
+// number of bytes. Coding works as above; as the masks are just the pixel bits
+// shuffled around, deltas stay as sparse as the pixels' deltas.
+
+#pragma once
+
+// --- Includes ----------------------------------------------------------------
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// --- Types and constants -----------------------------------------------------
+
+#define SHOW_MAGIC 0x48534e4eu // "NNSH"
+#define SHOW_VERSION 1
+
+#define SHOW_NO_FRAME 0xffffffffu
+
+typedef enum {
+    SHOW_FORMAT_RGB,
+    SHOW_FORMAT_RGBW,
+    SHOW_FORMAT_WAVE
+} show_format_t;
+
+#define SHOW_WAVE_LANES 2
+
+typedef enum {
+    SHOW_CODEC_RAW,
+    SHOW_CODEC_RLE
+} show_codec_t;
+
+typedef enum {
+    SHOW_OK,
+    SHOW_BAD_SIZE,
+    SHOW_BAD_MAGIC,
+    SHOW_BAD_VERSION,
+    SHOW_BAD_HEADER,
+    SHOW_BAD_INDEX,
+    SHOW_BAD_CRC,
+    SHOW_BAD_FRAME
+} show_result_t;
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_sz;
+    uint16_t width;
+    uint16_t height;
+    uint16_t fps;
+    uint8_t format;
+    uint8_t codec;
+    uint32_t n_frames;
+    uint32_t key_interval;
+    uint32_t index_off;
+    uint32_t data_off;
+    uint32_t data_sz;
+    // CRC-32 of everything from index_off to data_off + data_sz.
+    uint32_t crc;
+} show_header_t;
+
+typedef struct {
+    uint32_t off;
+    uint32_t sz;
+} show_index_t;
+
+typedef struct {
+    const uint8_t *data;
+    size_t sz;
+    const show_header_t *head;
+    const show_index_t *index;
+    const uint8_t *frames;
+    size_t frame_sz;
+} show_t;
+
+// --- Macros and inline functions ---------------------------------------------
+
+// --- Globals -----------------------------------------------------------------
+
+// --- API ---------------------------------------------------------------------
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Attach to an in-memory show. Checks the header and the index, but doesn't
+// touch the frame data. The memory has to stay valid while the show is in use.
+show_result_t show_open(show_t *show, const void *data, size_t sz);
+
+// Verify the CRC and decode all frames. This reads the entire show.
+show_result_t show_check(const show_t *show, uint8_t *pixels);
+
+// Get the number of bytes per pixel for the given format, 0 if it's unknown.
+size_t show_pixel_sz(uint8_t format);
+
+// Get the key frame that the given frame depends on.
+static inline uint32_t show_key_frame(const show_t *show, uint32_t frame_id)
+{
+    return frame_id - frame_id % show->head->key_interval;
+}
+
+// Get the coded data of the given frame.
+static inline const uint8_t *show_frame_data(const show_t *show,
+        uint32_t frame_id, size_t *sz)
+{
+    const show_index_t *entry = show->index + frame_id;
+
+    *sz = entry->sz;
+    return show->frames + entry->off;
+}
+
+// Decode the given frame into pixels, which currently hold frame cur_id -
+// or SHOW_NO_FRAME. Decoding resumes from cur_id, if it's in the same key
+// frame interval and not past frame_id.
+bool show_decode(const show_t *show, uint32_t frame_id, uint32_t cur_id,
+        uint8_t *pixels);
+
+// Decode a single frame on top of pixels, which must hold the preceding frame
+// for delta frames.
+bool show_apply(const show_t *show, uint32_t frame_id, uint8_t *pixels);
+
+// Get a human-readable description of the given result.
+const char *show_result_str(show_result_t res);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,105 @@
+// stats.c
+//
+// Copyright (C) 2020 by the contributors
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+
+// --- Includes ----------------------------------------------------------------
+
+#include <stats.h>
+
+#include <freertos/FreeRTOS.h> // pre 4.1, IDF headers depend on this
+#include <freertos/semphr.h>
+
+#include <assert.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <jitter.h>
+#include <panel.h>
+#include <proto.h>
+#include <reply.h>
+#include <wifi.h>
+
+#include <warnings.h>
+
+// --- Types and constants -----------------------------------------------------
+
+// --- Macros and inline functions ---------------------------------------------
+
+// --- Globals -----------------------------------------------------------------
+
+static SemaphoreHandle_t g_lock;
+
+static jitter_stats_t g_stream;
+static reply_window_t g_window;
+
+// --- Helper declarations -----------------------------------------------------
+
+// --- API ---------------------------------------------------------------------
+
+void stats_init(void)
+{
+    g_lock = xSemaphoreCreateMutex();
+    assert(g_lock != NULL);
+
+    reply_init_window(&g_window, esp_timer_get_time());
+}
+
+void stats_add_latency(int64_t latency)
+{
+    xSemaphoreTake(g_lock, portMAX_DELAY);
+    reply_add_latency(&g_window, esp_timer_get_time(), latency);
+    xSemaphoreGive(g_lock);
+}
+
+void stats_add_stages(const int64_t *stages)
+{
+    xSemaphoreTake(g_lock, portMAX_DELAY);
+    reply_add_stages(&g_window, esp_timer_get_time(), stages);
+    xSemaphoreGive(g_lock);
+}
+
+void stats_set_stream(const jitter_stats_t *stream)
+{
+    xSemaphoreTake(g_lock, portMAX_DELAY);
+    g_stream = *stream;
+    xSemaphoreGive(g_lock);
+}
+
+bool stats_get(size_t sz, stats_reply_t *reply)
+{
+    int64_t now = esp_timer_get_time();
+
+    xSemaphoreTake(g_lock, portMAX_DELAY);
+    bool ok = reply_stats(sz, &g_window, now, &g_stream, reply);
+    xSemaphoreGive(g_lock);
+
+    if (!ok) {
+        return false;
+    }
+
+    reply->rssi = wifi_rssi();
+    reply->uptime_ms = (uint32_t)(now / 1000);
+    panel_stats(&reply->n_frames, &reply->n_underruns);
+    reply->free_heap = esp_get_free_heap_size();
+    reply->min_free_heap = esp_get_minimum_free_heap_size();
+
+    return true;
+}
+
+// --- Helpers -----------------------------------------------------------------
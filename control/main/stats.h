@@ -0,0 +1,53 @@
+// stats.h
+//
+// Copyright (C) 2020 by the contributors
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+// --- Includes ----------------------------------------------------------------
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <jitter.h>
+#include <proto.h>
+
+// --- Types and constants -----------------------------------------------------
+
+// --- Macros and inline functions ---------------------------------------------
+
+// --- Globals -----------------------------------------------------------------
+
+// --- API ---------------------------------------------------------------------
+
+// Initialize. Call before anything reports to us.
+void stats_init(void);
+
+// Add the latency of a streamed frame, i.e., the time from the host sending it
+// until it's on the panel.
+void stats_add_latency(int64_t latency);
+
+// Add the times from the host sending a streamed frame until it reached each
+// stage, see latency_stage_t.
+void stats_add_stages(const int64_t *stages);
+
+// Set the statistics of the current stream.
+void stats_set_stream(const jitter_stats_t *stream);
+
+// Check a STATS request of sz bytes and build the reply to it. Returns false,
+// if the request is malformed.
+bool stats_get(size_t sz, stats_reply_t *reply);
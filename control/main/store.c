@@ -0,0 +1,242 @@
+// store.c
+//
+// Copyright (C) 2020 by the contributors
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+
+// --- Includes ----------------------------------------------------------------
+
+#include <store.h>
+
+#include <freertos/FreeRTOS.h> // pre 4.1, IDF headers depend on this
+#include <freertos/semphr.h>
+
+#include <assert.h>
+#include <esp_log.h>
+#include <esp_partition.h>
+#include <esp_spi_flash.h>
+#include <nvs.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <crc.h>
+#include <panel.h>
+#include <show.h>
+#include <util.h>
+
+#include <warnings.h>
+
+// --- Types and constants -----------------------------------------------------
+
+// See partitions.csv.
+#define SHOW_SUBTYPE 0x40
+
+// The show partition holds a complete show, if NVS has a record of its size.
+// The record goes away before the partition gets overwritten and comes back
+// once the new show has passed its CRC check. So, after a reset during an
+// upload, there isn't a show rather than a half-written one.
+#define NVS_NAMESPACE "nn"
+#define NVS_KEY "show"
+
+// --- Macros and inline functions ---------------------------------------------
+
+// --- Globals -----------------------------------------------------------------
+
+static const esp_partition_t *g_part;
+static spi_flash_mmap_handle_t g_handle;
+static const void *g_data;
+
+static SemaphoreHandle_t g_lock;
+static volatile uint32_t g_serial;
+
+static show_t g_show;
+static bool g_have_show;
+
+// --- Helper declarations -----------------------------------------------------
+
+static bool open_show(uint32_t sz);
+static bool load_record(uint32_t *sz);
+static void save_record(uint32_t sz);
+static void clear_record(void);
+
+// --- API ---------------------------------------------------------------------
+
+void store_init(void)
+{
+    g_lock = xSemaphoreCreateMutex();
+    assert(g_lock != NULL);
+
+    g_part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+            (esp_partition_subtype_t)SHOW_SUBTYPE, NULL);
+
+    if (g_part == NULL) {
+        ESP_LOGE("NN", "no show partition");
+        return;
+    }
+
+    // The whole partition stays mapped. Frames are then read through the
+    // flash cache on demand, i.e., there's nothing to load at startup.
+
+    if (util_failed(esp_partition_mmap, g_part, 0, g_part->size,
+                SPI_FLASH_MMAP_DATA, &g_data, &g_handle)) {
+        return;
+    }
+
+    // Checking the CRC would read the entire show, which takes a while. The
+    // record says that it was checked before.
+
+    uint32_t sz;
+
+    if (!load_record(&sz) || sz > g_part->size) {
+        ESP_LOGW("NN", "no complete show");
+        return;
+    }
+
+    g_have_show = open_show(sz);
+}
+
+const show_t *store_lock(void)
+{
+    xSemaphoreTake(g_lock, portMAX_DELAY);
+
+    if (!g_have_show) {
+        xSemaphoreGive(g_lock);
+        return NULL;
+    }
+
+    return &g_show;
+}
+
+void store_unlock(void)
+{
+    xSemaphoreGive(g_lock);
+}
+
+uint32_t store_serial(void)
+{
+    return g_serial;
+}
+
+const esp_partition_t *store_partition(void)
+{
+    return g_data != NULL ? g_part : NULL;
+}
+
+void store_begin_write(void)
+{
+    xSemaphoreTake(g_lock, portMAX_DELAY);
+
+    g_have_show = false;
+    ++g_serial;
+
+    xSemaphoreGive(g_lock);
+
+    clear_record();
+}
+
+bool store_end_write(uint32_t sz, uint32_t crc)
+{
+    assert(!g_have_show && sz <= g_part->size);
+
+    // Writing to flash invalidates the cached view of the modified range, so
+    // the mapping shows the new data.
+
+    if (crc_32(CRC_INIT, g_data, sz) != crc) {
+        ESP_LOGE("NN", "show CRC mismatch");
+        return false;
+    }
+
+    bool ok = open_show(sz);
+
+    if (ok) {
+        save_record(sz);
+    }
+
+    xSemaphoreTake(g_lock, portMAX_DELAY);
+    g_have_show = ok;
+    xSemaphoreGive(g_lock);
+
+    return ok;
+}
+
+// --- Helpers -----------------------------------------------------------------
+
+static bool open_show(uint32_t sz)
+{
+    show_result_t res = show_open(&g_show, g_data, sz);
+
+    if (res != SHOW_OK) {
+        ESP_LOGW("NN", "no show: %s", show_result_str(res));
+        return false;
+    }
+
+    ESP_LOGI("NN", "show %ux%u %u fps %u frame(s)",
+            g_show.head->width, g_show.head->height, g_show.head->fps,
+            g_show.head->n_frames);
+
+    return true;
+}
+
+// Get the size that save_record() saved. Returns false, if there isn't any.
+static bool load_record(uint32_t *sz)
+{
+    nvs_handle_t nvs;
+
+    // Fails with ESP_ERR_NVS_NOT_FOUND, until the first save_record().
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) {
+        return false;
+    }
+
+    esp_err_t err = nvs_get_u32(nvs, NVS_KEY, sz);
+    nvs_close(nvs);
+
+    return err == ESP_OK;
+}
+
+static void save_record(uint32_t sz)
+{
+    nvs_handle_t nvs;
+
+    if (util_failed(nvs_open, NVS_NAMESPACE, NVS_READWRITE, &nvs)) {
+        return;
+    }
+
+    panel_pause();
+
+    if (!util_failed(nvs_set_u32, nvs, NVS_KEY, sz)) {
+        util_failed(nvs_commit, nvs);
+    }
+
+    panel_resume();
+    nvs_close(nvs);
+}
+
+static void clear_record(void)
+{
+    nvs_handle_t nvs;
+
+    if (util_failed(nvs_open, NVS_NAMESPACE, NVS_READWRITE, &nvs)) {
+        return;
+    }
+
+    panel_pause();
+
+    // ESP_ERR_NVS_NOT_FOUND is fine.
+    nvs_erase_key(nvs, NVS_KEY);
+    nvs_commit(nvs);
+
+    panel_resume();
+    nvs_close(nvs);
+}
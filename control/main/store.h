@@ -0,0 +1,62 @@
+// store.h
+//
+// Copyright (C) 2020 by the contributors
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+// --- Includes ----------------------------------------------------------------
+
+#include <esp_partition.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <show.h>
+
+// --- Types and constants -----------------------------------------------------
+
+// --- Macros and inline functions ---------------------------------------------
+
+// --- Globals -----------------------------------------------------------------
+
+// --- API ---------------------------------------------------------------------
+
+// Initialize. Maps the show partition into the address space. Only opens
+// the show in it, if it was completely written and passed its CRC check, see
+// store_end_write().
+void store_init(void);
+
+// Lock the show in the show partition against being overwritten, i.e., keep
+// store_begin_write() from returning. Returns NULL without locking, if there
+// isn't a valid show.
+const show_t *store_lock(void);
+
+// Unlock the show.
+void store_unlock(void);
+
+// Get a number that changes whenever the show partition gets overwritten.
+uint32_t store_serial(void);
+
+// Get the show partition, NULL if there isn't one.
+const esp_partition_t *store_partition(void);
+
+// Invalidate the show, because the show partition is about to be overwritten.
+// Waits for the show to be unlocked. The partition stays mapped.
+void store_begin_write(void);
+
+// Done overwriting the show partition. Checks the CRC of the first sz bytes
+// and opens the new show. Until this succeeds, the show partition doesn't
+// hold a show, not even after a reset.
+bool store_end_write(uint32_t sz, uint32_t crc);
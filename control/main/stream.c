@@ -0,0 +1,357 @@
+// stream.c
+//
+// Copyright (C) 2020 by the contributors
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+
+// --- Includes ----------------------------------------------------------------
+
+#include <stream.h>
+
+#include <freertos/FreeRTOS.h> // pre 4.1, IDF headers depend on this
+#include <freertos/semphr.h>
+
+#include <assert.h>
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <lwip/err.h>
+#include <lwip/ip_addr.h>
+#include <lwip/pbuf.h>
+#include <lwip/tcpip.h>
+#include <lwip/udp.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <jitter.h>
+#include <net.h>
+#include <prof.h>
+#include <proto.h>
+#include <stats.h>
+#include <trace.h>
+
+#include <warnings.h>
+
+// --- Types and constants -----------------------------------------------------
+
+_Static_assert(sizeof (frame_part_t) == 24, "frame_part_t layout");
+
+#define TIMEOUT_US ((int64_t)STREAM_TIMEOUT_MS * 1000)
+
+// Range of the playout delay. With JITTER_N_SLOTS frames of buffer, the upper
+// end covers streams of up to about 30 frames per second.
+#define MIN_DELAY 10000
+#define MAX_DELAY 250000
+
+// Until the leader tells us otherwise.
+#define INITIAL_DELAY 50000
+
+// --- Macros and inline functions ---------------------------------------------
+
+// --- Globals -----------------------------------------------------------------
+
+static SemaphoreHandle_t g_lock;
+
+static jitter_t g_jitter;
+static uint8_t *g_mem;
+static size_t g_mem_sz;
+
+// Whether there's a buffer for the current stream, its frame size and number
+// of parity parts, when we last got a part of it.
+static bool g_started;
+static size_t g_frame_sz;
+static uint32_t g_n_parity;
+static int64_t g_last_time;
+
+static int64_t g_delay = INITIAL_DELAY;
+
+// --- Helper declarations -----------------------------------------------------
+
+static void listen_task(void *arg);
+static void receive(void *arg, struct udp_pcb *pcb, struct pbuf *p,
+        const ip_addr_t *addr, u16_t port);
+static bool check_head(const frame_part_t *head);
+static size_t get_mem_sz(size_t frame_sz);
+static void start(size_t frame_sz, uint32_t n_parity);
+static bool is_active(int64_t now);
+
+// --- API ---------------------------------------------------------------------
+
+void stream_init(size_t max_frame_sz)
+{
+    g_lock = xSemaphoreCreateMutex();
+    assert(g_lock != NULL);
+
+    // receive() runs in lwIP's thread, which mustn't wait for the heap. So,
+    // the jitter buffer is set aside here, for the largest frames with the
+    // most parity parts.
+
+    size_t mem_sz = max_frame_sz > 0 ? get_mem_sz(max_frame_sz) : 0;
+
+    if (mem_sz > 0) {
+        g_mem = heap_caps_malloc(mem_sz, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+        g_mem_sz = g_mem != NULL ? mem_sz : 0;
+    }
+
+    if (g_mem == NULL) {
+        ESP_LOGE("NN", "no memory for streams");
+    }
+
+    g_last_time = esp_timer_get_time() - TIMEOUT_US;
+}
+
+void stream_start(void)
+{
+    // lwIP's raw API isn't thread-safe. Set up in lwIP's thread.
+
+    if (tcpip_callback(listen_task, NULL) != ERR_OK) {
+        ESP_LOGE("NN", "cannot listen for streams");
+    }
+}
+
+bool stream_active(void)
+{
+    xSemaphoreTake(g_lock, portMAX_DELAY);
+    bool active = is_active(esp_timer_get_time());
+    xSemaphoreGive(g_lock);
+
+    return active;
+}
+
+size_t stream_frame_sz(void)
+{
+    xSemaphoreTake(g_lock, portMAX_DELAY);
+    size_t frame_sz = g_started ? g_frame_sz : 0;
+    xSemaphoreGive(g_lock);
+
+    return frame_sz;
+}
+
+bool stream_next(int64_t *due)
+{
+    xSemaphoreTake(g_lock, portMAX_DELAY);
+    bool next = g_started && jitter_next(&g_jitter, due);
+    xSemaphoreGive(g_lock);
+
+    return next;
+}
+
+// The frame is copied out of its slot rather than rendered from it. That way,
+// out keeps the previous frame's pixels for parts that never arrive. Also,
+// g_lock isn't held for the milliseconds that rendering takes, while
+// receive() may need the slot for a new frame.
+bool stream_play(int64_t now, uint8_t *out, size_t sz, stream_times_t *times)
+{
+    xSemaphoreTake(g_lock, portMAX_DELAY);
+
+    bool played = g_started && sz == g_frame_sz &&
+            jitter_play(&g_jitter, now, out);
+
+    if (played) {
+        times->at = g_jitter.last_at;
+        times->received = g_jitter.last_received;
+        times->completed = g_jitter.last_completed;
+        stats_set_stream(&g_jitter.stats);
+    }
+
+    xSemaphoreGive(g_lock);
+
+    return played;
+}
+
+int64_t stream_target(void)
+{
+    xSemaphoreTake(g_lock, portMAX_DELAY);
+
+    int64_t target = 0;
+
+    if (g_started && is_active(esp_timer_get_time())) {
+        target = jitter_target(&g_jitter);
+    }
+
+    xSemaphoreGive(g_lock);
+
+    return target;
+}
+
+void stream_set_delay(int64_t delay)
+{
+    xSemaphoreTake(g_lock, portMAX_DELAY);
+
+    g_delay = delay;
+
+    if (g_started) {
+        jitter_set_delay(&g_jitter, delay);
+    }
+
+    xSemaphoreGive(g_lock);
+}
+
+void stream_stats(jitter_stats_t *stats, int64_t *delay)
+{
+    xSemaphoreTake(g_lock, portMAX_DELAY);
+
+    if (g_started) {
+        *stats = g_jitter.stats;
+        *delay = g_jitter.delay;
+    }
+    else {
+        memset(stats, 0, sizeof *stats);
+        *delay = g_delay;
+    }
+
+    xSemaphoreGive(g_lock);
+}
+
+// --- Helpers -----------------------------------------------------------------
+
+// Listen for streamed frames. Runs in lwIP's thread.
+static void listen_task(void *arg)
+{
+    assert(arg == NULL);
+
+    struct udp_pcb *pcb = udp_new();
+
+    if (pcb == NULL ||
+            udp_bind(pcb, IP_ADDR_ANY, PROTO_STREAM_PORT) != ERR_OK) {
+        ESP_LOGE("NN", "cannot listen for streams");
+
+        if (pcb != NULL) {
+            udp_remove(pcb);
+        }
+
+        return;
+    }
+
+    udp_recv(pcb, receive, NULL);
+}
+
+// Handle a FRAME_DATA message. Runs in lwIP's thread, i.e., without a detour
+// through a socket and another task. The pixels are copied straight from the
+// received packet to their place in the jitter buffer. That's the only copy
+// on the way in. stream_play() copies a frame once more, on its way out, see
+// there. It neither allocates nor logs. What's worth logging is traced.
+static void receive(void *arg, struct udp_pcb *pcb, struct pbuf *p,
+        const ip_addr_t *addr, u16_t port)
+{
+    (void)arg;
+    (void)pcb;
+    (void)addr;
+    (void)port;
+
+    prof_t parse;
+    prof_start(&parse);
+
+    int64_t now = net_show_time();
+    frame_part_t head;
+
+    if (pbuf_copy_partial(p, &head, sizeof head, 0) != sizeof head ||
+            head.command != COMMAND_FRAME_DATA || !check_head(&head)) {
+        pbuf_free(p);
+        return;
+    }
+
+    u16_t sz = (u16_t)(p->tot_len - sizeof head);
+
+    xSemaphoreTake(g_lock, portMAX_DELAY);
+
+    int64_t local = esp_timer_get_time();
+
+    if (!is_active(local) || head.frame_sz != g_frame_sz ||
+            head.n_parity != g_n_parity) {
+        start(head.frame_sz, head.n_parity);
+    }
+
+    uint8_t *to = NULL;
+
+    if (g_started) {
+        to = jitter_begin_put(&g_jitter, head.frame_id, head.at, head.part,
+                sz, now);
+    }
+
+    if (to != NULL) {
+        pbuf_copy_partial(p, to, sz, sizeof head);
+        jitter_end_put(&g_jitter);
+        trace_hot(TRACE_PART, head.frame_id, head.part);
+    }
+    else {
+        trace_hot(TRACE_PART_DROPPED, head.frame_id, head.part);
+    }
+
+    g_last_time = local;
+
+    xSemaphoreGive(g_lock);
+
+    pbuf_free(p);
+
+    prof_stop(&parse, PROBE_PARSE);
+}
+
+static bool check_head(const frame_part_t *head)
+{
+    uint32_t n_parts = (head->frame_sz + STREAM_PART_SZ - 1) / STREAM_PART_SZ;
+
+    // RGB or RGBW pixels. Whether they fit the LEDs is for the player.
+
+    if (head->frame_sz == 0 ||
+            (head->frame_sz % 3 != 0 && head->frame_sz % 4 != 0) ||
+            n_parts > JITTER_MAX_PARTS || head->n_parts != n_parts ||
+            head->n_parity > JITTER_MAX_PARITY || head->n_parity > n_parts) {
+        trace_event(TRACE_BAD_PART, head->frame_sz, head->n_parts);
+        return false;
+    }
+
+    // Frames that the jitter buffer wasn't set aside for, too.
+
+    if (get_mem_sz(head->frame_sz) > g_mem_sz) {
+        trace_event(TRACE_BAD_PART, head->frame_sz, head->n_parts);
+        return false;
+    }
+
+    return true;
+}
+
+// Get the size of the jitter buffer for frames of the given size with the
+// most parity parts that check_head() accepts for them.
+static size_t get_mem_sz(size_t frame_sz)
+{
+    uint32_t n_parts = (uint32_t)((frame_sz + STREAM_PART_SZ - 1) /
+            STREAM_PART_SZ);
+    uint32_t n_parity = n_parts < JITTER_MAX_PARITY ? n_parts :
+            JITTER_MAX_PARITY;
+
+    return jitter_mem_sz(frame_sz, STREAM_PART_SZ, n_parity);
+}
+
+// Set up the jitter buffer for a new stream, whose frames passed
+// check_head(). Must be called with g_lock held.
+static void start(size_t frame_sz, uint32_t n_parity)
+{
+    g_frame_sz = frame_sz;
+    g_n_parity = n_parity;
+    g_started = true;
+
+    jitter_init(&g_jitter, g_mem, frame_sz, STREAM_PART_SZ, n_parity,
+            MIN_DELAY, MAX_DELAY);
+    jitter_set_delay(&g_jitter, g_delay);
+
+    trace_event(TRACE_STREAM_START, frame_sz, n_parity);
+}
+
+static bool is_active(int64_t now)
+{
+    return now - g_last_time < TIMEOUT_US;
+}
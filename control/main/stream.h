@@ -0,0 +1,83 @@
+// stream.h
+//
+// Copyright (C) 2020 by the contributors
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+// --- Includes ----------------------------------------------------------------
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <jitter.h>
+
+// --- Types and constants -----------------------------------------------------
+
+// A stream ends, when there haven't been any frames for this long. Then the
+// output falls back to the stored show. Override at build time, if the network
+// is known to stall for longer.
+#ifndef STREAM_TIMEOUT_MS
+#define STREAM_TIMEOUT_MS 1000
+#endif
+
+// When a streamed frame was sent, when its first and its last part were
+// received, as show clock times.
+typedef struct {
+    int64_t at;
+    int64_t received;
+    int64_t completed;
+} stream_times_t;
+
+// --- Macros and inline functions ---------------------------------------------
+
+// --- Globals -----------------------------------------------------------------
+
+// --- API ---------------------------------------------------------------------
+
+// Initialize. Sets aside the jitter buffer for frames of up to max_frame_sz
+// bytes. Larger ones are dropped. Until stream_start(), there aren't any
+// streams. Doesn't need the network.
+void stream_init(size_t max_frame_sz);
+
+// Start listening for FRAME_DATA messages, see proto.h. Call, once the network
+// is up.
+void stream_start(void);
+
+// Whether frames have been arriving lately.
+bool stream_active(void);
+
+// Get the size of the streamed frames, 0, if there aren't any.
+size_t stream_frame_sz(void);
+
+// Get the show clock time at which the next frame is due. Returns false, if
+// there isn't one.
+bool stream_next(int64_t *due);
+
+// Play what's due at show clock time now into out, which holds the previous
+// frame and must hold sz bytes. Sets times to when the frame was sent and
+// received. Returns false, if nothing is due or if the frame size doesn't
+// match.
+bool stream_play(int64_t now, uint8_t *out, size_t sz, stream_times_t *times);
+
+// Get the playout delay that we need, 0, if we aren't streaming.
+int64_t stream_target(void);
+
+// Set the playout delay.
+void stream_set_delay(int64_t delay);
+
+// Get the jitter buffer statistics and the playout delay.
+void stream_stats(jitter_stats_t *stats, int64_t *delay);
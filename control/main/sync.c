@@ -0,0 +1,199 @@
+// sync.c
+//
+// Copyright (C) 2020 by the contributors
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+
+// --- Includes ----------------------------------------------------------------
+
+#include <sync.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <warnings.h>
+
+// --- Types and constants -----------------------------------------------------
+
+// Don't estimate the drift from samples that are closer together than this.
+#define MIN_SPAN 1000000
+
+// Crystals are specified to within a few dozen ppm. Anything beyond this is
+// noise.
+#define MAX_DRIFT 0.0005
+
+// Round trips that take this much longer than the shortest one count a
+// quarter as much.
+#define DELAY_SLACK 500
+
+// --- Macros and inline functions ---------------------------------------------
+
+// --- Globals -----------------------------------------------------------------
+
+// --- Helper declarations -----------------------------------------------------
+
+static void estimate(sync_t *sync);
+
+// --- API ---------------------------------------------------------------------
+
+void sync_init(sync_t *sync)
+{
+    sync->n_samples = 0;
+    sync->next = 0;
+    sync->n_resets = 0;
+    sync->valid = false;
+    sync->delay = 0;
+    sync->base = 0;
+    sync->offset = 0;
+    sync->drift = 0.0;
+}
+
+bool sync_add(sync_t *sync, int64_t t1, int64_t t2, int64_t t3, int64_t t4)
+{
+    int64_t delay = (t4 - t1) - (t3 - t2);
+
+    if (delay < 0 || delay > SYNC_MAX_DELAY) {
+        return false;
+    }
+
+    int64_t local = t1 + (t4 - t1) / 2;
+    int64_t offset = ((t2 - t1) + (t3 - t4)) / 2;
+
+    // Whatever the asymmetry of a round trip, the true offset is within
+    // delay / 2 of the measured one. The estimate is at least as good as its
+    // best sample.
+
+    if (sync->valid) {
+        int64_t predicted = sync_to_master(sync, local) - local;
+        int64_t slack = delay / 2 + sync->delay / 2 + SYNC_STEP;
+
+        if (llabs(offset - predicted) > slack) {
+            sync->n_samples = 0;
+            sync->next = 0;
+            sync->valid = false;
+            ++sync->n_resets;
+        }
+    }
+
+    sync_sample_t *sample = sync->samples + sync->next;
+
+    sample->local = local;
+    sample->offset = offset;
+    sample->delay = delay;
+
+    sync->next = (sync->next + 1) % SYNC_N_SAMPLES;
+
+    if (sync->n_samples < SYNC_N_SAMPLES) {
+        ++sync->n_samples;
+    }
+
+    estimate(sync);
+    return true;
+}
+
+int64_t sync_to_master(const sync_t *sync, int64_t local)
+{
+    if (!sync->valid) {
+        return local;
+    }
+
+    return local + sync->offset +
+            (int64_t)(sync->drift * (double)(local - sync->base));
+}
+
+int64_t sync_to_local(const sync_t *sync, int64_t master)
+{
+    if (!sync->valid) {
+        return master;
+    }
+
+    int64_t delta = master - sync->base - sync->offset;
+    return sync->base + (int64_t)((double)delta / (1.0 + sync->drift));
+}
+
+// --- Helpers -----------------------------------------------------------------
+
+static void estimate(sync_t *sync)
+{
+    // Find the shortest round trip. Also, work relative to its sample to keep
+    // the numbers small.
+
+    const sync_sample_t *ref = sync->samples;
+
+    for (uint32_t i = 1; i < sync->n_samples; ++i) {
+        if (sync->samples[i].delay < ref->delay) {
+            ref = sync->samples + i;
+        }
+    }
+
+    // Fit a line through the samples. The longer a sample's round trip was
+    // compared to the shortest one, the less it counts.
+
+    double weights[SYNC_N_SAMPLES];
+    double sum_w = 0.0, sum_x = 0.0, sum_y = 0.0;
+    int64_t min_x = 0, max_x = 0;
+
+    for (uint32_t i = 0; i < sync->n_samples; ++i) {
+        const sync_sample_t *sample = sync->samples + i;
+        int64_t x = sample->local - ref->local;
+        double w = 1.0 / (double)(sample->delay - ref->delay + DELAY_SLACK);
+
+        weights[i] = w * w;
+
+        if (x < min_x) {
+            min_x = x;
+        }
+
+        if (x > max_x) {
+            max_x = x;
+        }
+
+        sum_w += weights[i];
+        sum_x += weights[i] * (double)x;
+        sum_y += weights[i] * (double)(sample->offset - ref->offset);
+    }
+
+    double mean_x = sum_x / sum_w;
+    double mean_y = sum_y / sum_w;
+    double drift = 0.0;
+
+    if (max_x - min_x >= MIN_SPAN) {
+        double sum_xy = 0.0, sum_xx = 0.0;
+
+        for (uint32_t i = 0; i < sync->n_samples; ++i) {
+            const sync_sample_t *sample = sync->samples + i;
+            double dx = (double)(sample->local - ref->local) - mean_x;
+            double dy = (double)(sample->offset - ref->offset) - mean_y;
+
+            sum_xy += weights[i] * dx * dy;
+            sum_xx += weights[i] * dx * dx;
+        }
+
+        drift = sum_xy / sum_xx;
+
+        if (drift > MAX_DRIFT) {
+            drift = MAX_DRIFT;
+        }
+        else if (drift < -MAX_DRIFT) {
+            drift = -MAX_DRIFT;
+        }
+    }
+
+    sync->delay = ref->delay;
+    sync->base = ref->local + (int64_t)mean_x;
+    sync->offset = ref->offset + (int64_t)mean_y;
+    sync->drift = drift;
+    sync->valid = true;
+}
@@ -0,0 +1,88 @@
+// sync.h
+//
+// Copyright (C) 2020 by the contributors
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+// --- Includes ----------------------------------------------------------------
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// --- Types and constants -----------------------------------------------------
+
+// Number of recent samples to estimate from.
+#define SYNC_N_SAMPLES 64
+
+// Samples with a longer round trip than this say too little to be useful.
+#define SYNC_MAX_DELAY 100000
+
+// A sample that contradicts the estimate by more than this, beyond what its
+// round trip can explain, means that the master's clock jumped, e.g., because
+// it was reset.
+#define SYNC_STEP 5000
+
+typedef struct {
+    int64_t local;
+    int64_t offset;
+    int64_t delay;
+} sync_sample_t;
+
+// Estimates the offset and the drift of the master's clock relative to ours,
+// NTP-style, from request/reply exchanges: we send at t1, the master receives
+// at t2 and replies at t3, we receive at t4. Exchanges with short round trips
+// count most, as WiFi delays are anything but symmetric under load. Times are
+// in microseconds.
+typedef struct {
+    sync_sample_t samples[SYNC_N_SAMPLES];
+    uint32_t n_samples;
+    uint32_t next;
+    uint32_t n_resets;
+    bool valid;
+    // Shortest round trip among the samples.
+    int64_t delay;
+    // master = local + offset + drift * (local - base)
+    int64_t base;
+    int64_t offset;
+    double drift;
+} sync_t;
+
+// --- Macros and inline functions ---------------------------------------------
+
+// --- Globals -----------------------------------------------------------------
+
+// --- API ---------------------------------------------------------------------
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Initialize. Until there are samples, both clocks are taken to be the same.
+void sync_init(sync_t *sync);
+
+// Add the result of an exchange and update the estimate. Returns false, if the
+// sample was rejected.
+bool sync_add(sync_t *sync, int64_t t1, int64_t t2, int64_t t3, int64_t t4);
+
+// Convert our time to the master's time.
+int64_t sync_to_master(const sync_t *sync, int64_t local);
+
+// Convert the master's time to our time.
+int64_t sync_to_local(const sync_t *sync, int64_t master);
+
+#ifdef __cplusplus
+}
+#endif
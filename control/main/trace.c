@@ -0,0 +1,178 @@
+// trace.c
+//
+// Copyright (C) 2020 by the contributors
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+
+// --- Includes ----------------------------------------------------------------
+
+#include <trace.h>
+
+#include <freertos/FreeRTOS.h> // pre 4.1, IDF headers depend on this
+#include <freertos/task.h>
+
+#include <assert.h>
+#include <esp_log.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <warnings.h>
+
+// --- Types and constants -----------------------------------------------------
+
+_Static_assert((TRACE_N_EVENTS & (TRACE_N_EVENTS - 1)) == 0,
+        "TRACE_N_EVENTS must be a power of two");
+
+// Log what's in the ring this often, but no more than MAX_LINES events each
+// time. The rest are only counted. The UART can't keep up with logging every
+// packet, and logging would block.
+#define INTERVAL_MS 100
+#define MAX_LINES 8
+
+#define STACK_SZ 3072
+// Below everything else, and away from the output task, so that logging
+// never gets in the way.
+#define PRIORITY 1
+#define CORE 0
+
+// --- Macros and inline functions ---------------------------------------------
+
+// --- Globals -----------------------------------------------------------------
+
+trace_event_t g_trace_ring[TRACE_N_EVENTS];
+uint32_t g_trace_head;
+
+static const char *g_names[TRACE_N_IDS] = {
+    [TRACE_COMMAND] = "command",
+    [TRACE_PART] = "part",
+    [TRACE_PART_DROPPED] = "part-dropped",
+    [TRACE_BAD_PART] = "bad-part",
+    [TRACE_STREAM_START] = "stream-start",
+    [TRACE_SHOW_FRAME] = "show-frame",
+    [TRACE_STREAM_FRAME] = "stream-frame",
+    [TRACE_TEST_PATTERN] = "test-pattern"
+};
+
+// --- Helper declarations -----------------------------------------------------
+
+static void drain_task(void *arg);
+static bool read_event(uint32_t seq, trace_event_t *event);
+static void log_counts(const uint32_t *counts);
+
+// --- API ---------------------------------------------------------------------
+
+void trace_init(void)
+{
+    if (TRACE_LEVEL == TRACE_LEVEL_OFF) {
+        return;
+    }
+
+    BaseType_t res = xTaskCreatePinnedToCore(drain_task, "trace_drain",
+            STACK_SZ, NULL, PRIORITY, NULL, CORE);
+    assert(res == pdPASS);
+}
+
+// --- Helpers -----------------------------------------------------------------
+
+// Log the events, as they come in. Formatting and output happen here, off the
+// paths that are being traced. Cycle counts are per core.
+static void drain_task(void *arg)
+{
+    assert(arg == NULL);
+
+    uint32_t tail = __atomic_load_n(&g_trace_head, __ATOMIC_ACQUIRE);
+
+    while (true) {
+        vTaskDelay(INTERVAL_MS / portTICK_PERIOD_MS);
+
+        uint32_t head = __atomic_load_n(&g_trace_head, __ATOMIC_ACQUIRE);
+        uint32_t n_lost = 0;
+        uint32_t n_lines = 0;
+        uint32_t counts[TRACE_N_IDS + 1] = { 0 };
+
+        if (head - tail > TRACE_N_EVENTS) {
+            n_lost = head - tail - TRACE_N_EVENTS;
+            tail = head - TRACE_N_EVENTS;
+        }
+
+        for (; tail != head; ++tail) {
+            trace_event_t event;
+
+            if (!read_event(tail, &event)) {
+                ++n_lost;
+                continue;
+            }
+
+            uint32_t id = event.id < TRACE_N_IDS ? event.id : TRACE_N_IDS;
+
+            if (n_lines == MAX_LINES) {
+                ++counts[id];
+                continue;
+            }
+
+            const char *name = id < TRACE_N_IDS ? g_names[id] : "unknown";
+
+            ESP_LOGI("NN", "trace %10u/%u %s %u %u", event.cycles, event.core,
+                    name, event.arg_1, event.arg_2);
+            ++n_lines;
+        }
+
+        log_counts(counts);
+
+        if (n_lost > 0) {
+            ESP_LOGW("NN", "trace lost %u event(s)", n_lost);
+        }
+    }
+}
+
+// Copy event number seq out of the ring. Returns false, if it's being written
+// or has already been overwritten.
+static bool read_event(uint32_t seq, trace_event_t *event)
+{
+    const trace_event_t *slot = &g_trace_ring[seq % TRACE_N_EVENTS];
+
+    if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != seq + 1) {
+        return false;
+    }
+
+    memcpy(event, slot, sizeof *event);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    return __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq + 1;
+}
+
+// Log how many events of each kind weren't logged, on a single line.
+static void log_counts(const uint32_t *counts)
+{
+    char line[128];
+    size_t len = 0;
+
+    for (uint32_t id = 0; id <= TRACE_N_IDS; ++id) {
+        if (counts[id] == 0 || len >= sizeof line) {
+            continue;
+        }
+
+        const char *name = id < TRACE_N_IDS ? g_names[id] : "unknown";
+        int32_t n = snprintf(line + len, sizeof line - len, " %s %u", name,
+                counts[id]);
+
+        len += n > 0 ? (size_t)n : 0;
+    }
+
+    if (len > 0) {
+        ESP_LOGI("NN", "trace more:%s", line);
+    }
+}
@@ -0,0 +1,113 @@
+// trace.h
+//
+// Copyright (C) 2020 by the contributors
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+// --- Includes ----------------------------------------------------------------
+
+#include <freertos/FreeRTOS.h> // pre 4.1, IDF headers depend on this
+
+#include <stdint.h>
+
+#include <util.h>
+
+// --- Types and constants -----------------------------------------------------
+
+// Trace levels. Events are for things that happen now and then, hot traces
+// are for every packet and every frame. Traces above TRACE_LEVEL compile to
+// nothing. By default, only the events are kept. Hot traces are for builds
+// with -DTRACE_LEVEL=TRACE_LEVEL_HOT, while hunting a bug. Even then, the
+// logging task only logs a few of them, see trace.c.
+#define TRACE_LEVEL_OFF 0
+#define TRACE_LEVEL_EVENT 1
+#define TRACE_LEVEL_HOT 2
+
+#ifndef TRACE_LEVEL
+#define TRACE_LEVEL TRACE_LEVEL_EVENT
+#endif
+
+// What happened. The comments say what the two arguments are.
+typedef enum {
+    TRACE_COMMAND,       // UDP command received: command, size
+    TRACE_PART,          // stream part received: frame ID, part
+    TRACE_PART_DROPPED,  // stream part dropped: frame ID, part
+    TRACE_BAD_PART,      // stream part refused: frame size, parts
+    TRACE_STREAM_START,  // stream started: frame size, parity parts
+    TRACE_SHOW_FRAME,    // show frame rendered: frame ID, pixels
+    TRACE_STREAM_FRAME,  // stream frame rendered: due time, pixels
+    TRACE_TEST_PATTERN,  // test pattern output: iteration, 0
+    TRACE_N_IDS
+} trace_id_t;
+
+// Must be a power of two.
+#define TRACE_N_EVENTS 256
+
+// A slot in the ring. seq is the number of the event plus one, 0, while the
+// slot is being written.
+typedef struct {
+    uint32_t seq;
+    uint32_t cycles;
+    uint16_t id;
+    uint16_t core;
+    uint32_t arg_1;
+    uint32_t arg_2;
+} trace_event_t;
+
+// --- Macros and inline functions ---------------------------------------------
+
+#define trace_event(id, arg_1, arg_2) do {                      \
+    if (TRACE_LEVEL >= TRACE_LEVEL_EVENT) {                     \
+        trace_add((id), (uint32_t)(arg_1), (uint32_t)(arg_2));  \
+    }                                                           \
+} while (0)
+
+#define trace_hot(id, arg_1, arg_2) do {                        \
+    if (TRACE_LEVEL >= TRACE_LEVEL_HOT) {                       \
+        trace_add((id), (uint32_t)(arg_1), (uint32_t)(arg_2));  \
+    }                                                           \
+} while (0)
+
+// --- Globals -----------------------------------------------------------------
+
+extern trace_event_t g_trace_ring[TRACE_N_EVENTS];
+extern uint32_t g_trace_head;
+
+// --- API ---------------------------------------------------------------------
+
+// Initialize. Starts a low-priority task on core 0 that logs the traced
+// events.
+void trace_init(void);
+
+// Add an event to the ring. Use trace_event() or trace_hot() instead. Lock-free
+// and safe to call from any task, on either core, and from interrupts. When the
+// logging task falls behind, the oldest events are overwritten.
+static inline void trace_add(trace_id_t id, uint32_t arg_1, uint32_t arg_2)
+{
+    uint32_t seq = __atomic_fetch_add(&g_trace_head, 1, __ATOMIC_RELAXED);
+    trace_event_t *event = &g_trace_ring[seq % TRACE_N_EVENTS];
+
+    __atomic_store_n(&event->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    event->cycles = util_cycle_count();
+    event->id = (uint16_t)id;
+    event->core = (uint16_t)xPortGetCoreID();
+    event->arg_1 = arg_1;
+    event->arg_2 = arg_2;
+
+    __atomic_store_n(&event->seq, seq + 1, __ATOMIC_RELEASE);
+}
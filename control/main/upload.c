@@ -0,0 +1,440 @@
+// upload.c
+//
+// Copyright (C) 2020 by the contributors
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+
+// --- Includes ----------------------------------------------------------------
+
+#include <upload.h>
+
+#include <freertos/FreeRTOS.h> // pre 4.1, IDF headers depend on these
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <esp_log.h>
+#include <esp_partition.h>
+#include <lwip/sockets.h>
+#include <nvs.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <panel.h>
+#include <proto.h>
+#include <store.h>
+#include <util.h>
+#include <xfer.h>
+
+#include <warnings.h>
+
+// --- Types and constants -----------------------------------------------------
+
+typedef enum {
+    JOB_WRITE,
+    JOB_NACK,
+    JOB_DRAIN
+} job_kind_t;
+
+typedef struct {
+    job_kind_t kind;
+    uint8_t *buf;
+    uint32_t offset;
+    uint32_t sz;
+} job_t;
+
+// A full window of chunks in the queue, plus one being received, plus one
+// being written.
+#define N_BUFS (UPLOAD_WINDOW + 2)
+
+// Erasing 64-KiB blocks would be faster, but would also stall the panel for
+// as long as a few frames, see panel_pause(). A 4-KiB sector stalls it for
+// about one.
+#define ERASE_SZ 4096
+
+// How often to persist the upload progress.
+#define PERSIST_SZ 65536
+
+#define STACK_SZ 4096
+#define PRIORITY 5
+// With the WiFi driver, away from the output task.
+#define CORE 0
+
+#define NVS_NAMESPACE "nn"
+#define NVS_KEY "upload"
+
+// --- Macros and inline functions ---------------------------------------------
+
+// --- Globals -----------------------------------------------------------------
+
+static uint8_t g_bufs[N_BUFS][UPLOAD_CHUNK_SZ];
+
+static QueueHandle_t g_free_bufs;
+static QueueHandle_t g_jobs;
+static SemaphoreHandle_t g_drained;
+
+// Owned by the writer task while chunks are being received, except for
+// g_xfer.expect, see xfer_t. g_xfer.progress is persisted in NVS.
+static int g_sock;
+static xfer_t g_xfer;
+static volatile bool g_failed;
+
+// --- Helper declarations -----------------------------------------------------
+
+static void serve_task(void *arg);
+static void write_task(void *arg);
+static void handle_connection(int sock);
+static void receive_chunks(int sock);
+static void write_job(const job_t *job);
+static bool write_chunk(const uint8_t *buf, uint32_t offset, uint32_t sz);
+static bool recv_all(int sock, void *data, size_t sz);
+static void send_ack(int sock, result_t res, uint32_t offset);
+static bool load_progress(xfer_progress_t *prog);
+static void save_progress(void);
+static void clear_progress(void);
+
+// --- API ---------------------------------------------------------------------
+
+void upload_init(void)
+{
+    g_free_bufs = xQueueCreate(N_BUFS, sizeof (uint8_t *));
+    g_jobs = xQueueCreate(N_BUFS + 2, sizeof (job_t));
+    g_drained = xSemaphoreCreateBinary();
+
+    assert(g_free_bufs != NULL && g_jobs != NULL && g_drained != NULL);
+
+    for (int32_t i = 0; i < N_BUFS; ++i) {
+        uint8_t *buf = g_bufs[i];
+        xQueueSend(g_free_bufs, &buf, portMAX_DELAY);
+    }
+
+    BaseType_t res = xTaskCreatePinnedToCore(write_task, "upload_write",
+            STACK_SZ, NULL, PRIORITY, NULL, CORE);
+    assert(res == pdPASS);
+
+    res = xTaskCreatePinnedToCore(serve_task, "upload_serve", STACK_SZ, NULL,
+            PRIORITY, NULL, CORE);
+    assert(res == pdPASS);
+}
+
+// --- Helpers -----------------------------------------------------------------
+
+static void serve_task(void *arg)
+{
+    assert(arg == NULL);
+
+    int listen_sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(PROTO_TCP_PORT),
+        .sin_addr = { .s_addr = htonl(INADDR_ANY) }
+    };
+
+    if (listen_sock < 0 ||
+            bind(listen_sock, (struct sockaddr *)&addr, sizeof addr) < 0 ||
+            listen(listen_sock, 1) < 0) {
+        ESP_LOGE("NN", "cannot listen for uploads: %d", errno);
+        vTaskDelete(NULL);
+        return;
+    }
+
+    // One upload at a time. Everybody else waits in the backlog.
+
+    while (true) {
+        int sock = accept(listen_sock, NULL, NULL);
+
+        if (sock < 0) {
+            ESP_LOGE("NN", "accept() failed: %d", errno);
+            vTaskDelay(1000 / portTICK_PERIOD_MS);
+            continue;
+        }
+
+        handle_connection(sock);
+        close(sock);
+    }
+}
+
+static void write_task(void *arg)
+{
+    assert(arg == NULL);
+
+    while (true) {
+        job_t job;
+        xQueueReceive(g_jobs, &job, portMAX_DELAY);
+
+        switch (job.kind) {
+        case JOB_WRITE:
+            write_job(&job);
+            break;
+
+        case JOB_NACK:
+            send_ack(g_sock, RESULT_BAD_CRC, job.offset);
+            break;
+
+        case JOB_DRAIN:
+            xSemaphoreGive(g_drained);
+            break;
+        }
+    }
+}
+
+static void handle_connection(int sock)
+{
+    upload_begin_t begin;
+
+    if (!recv_all(sock, &begin, sizeof begin) ||
+            begin.command != COMMAND_UPLOAD) {
+        ESP_LOGE("NN", "bad upload request");
+        return;
+    }
+
+    const esp_partition_t *part = store_partition();
+    xfer_progress_t saved;
+    bool have_saved = load_progress(&saved);
+
+    result_t res = xfer_begin(&g_xfer, &begin, part != NULL ? part->size : 0,
+            have_saved ? &saved : NULL);
+
+    if (res != RESULT_OK) {
+        send_ack(sock, res, 0);
+        return;
+    }
+
+    // A different upload starts over and overwrites the partition. Forget
+    // the old one right away. Otherwise, if this one gets interrupted before
+    // its first save_progress(), resending the old one would resume on top
+    // of this one's bytes.
+
+    if (have_saved && !xfer_same(&saved, &begin)) {
+        clear_progress();
+    }
+
+    ESP_LOGI("NN", "upload of %u byte(s) from %u", begin.total_sz,
+            g_xfer.expect);
+
+    store_begin_write();
+
+    g_sock = sock;
+    g_failed = false;
+
+    send_ack(sock, RESULT_OK, g_xfer.expect);
+    receive_chunks(sock);
+
+    // Let the writer catch up before the socket goes away. Then remember how
+    // far we got.
+
+    job_t job = { .kind = JOB_DRAIN };
+
+    xQueueSend(g_jobs, &job, portMAX_DELAY);
+    xSemaphoreTake(g_drained, portMAX_DELAY);
+
+    if (g_xfer.progress.offset < g_xfer.progress.total_sz) {
+        ESP_LOGW("NN", "upload interrupted at %u", g_xfer.progress.offset);
+        save_progress();
+    }
+}
+
+static void receive_chunks(int sock)
+{
+    while (!g_failed && g_xfer.expect < g_xfer.progress.total_sz) {
+        upload_chunk_t head;
+
+        if (!recv_all(sock, &head, sizeof head)) {
+            return;
+        }
+
+        if (!xfer_check(&g_xfer, &head)) {
+            ESP_LOGE("NN", "bad chunk %u/%u", head.offset, head.sz);
+            return;
+        }
+
+        uint8_t *buf;
+        xQueueReceive(g_free_bufs, &buf, portMAX_DELAY);
+
+        if (!recv_all(sock, buf, head.sz)) {
+            xQueueSend(g_free_bufs, &buf, portMAX_DELAY);
+            return;
+        }
+
+        xfer_action_t action = xfer_take(&g_xfer, &head, buf);
+
+        if (action == XFER_SKIP) {
+            xQueueSend(g_free_bufs, &buf, portMAX_DELAY);
+            continue;
+        }
+
+        job_t job;
+
+        if (action == XFER_RESEND) {
+            ESP_LOGW("NN", "bad CRC in chunk %u", head.offset);
+            xQueueSend(g_free_bufs, &buf, portMAX_DELAY);
+
+            job.kind = JOB_NACK;
+            job.buf = NULL;
+            job.offset = g_xfer.expect;
+            job.sz = 0;
+        }
+        else {
+            job.kind = JOB_WRITE;
+            job.buf = buf;
+            job.offset = head.offset;
+            job.sz = head.sz;
+        }
+
+        xQueueSend(g_jobs, &job, portMAX_DELAY);
+    }
+}
+
+static void write_job(const job_t *job)
+{
+    bool ok = !g_failed && write_chunk(job->buf, job->offset, job->sz);
+
+    xQueueSend(g_free_bufs, &job->buf, portMAX_DELAY);
+
+    if (!ok) {
+        g_failed = true;
+        send_ack(g_sock, RESULT_FLASH_ERROR, g_xfer.progress.offset);
+        return;
+    }
+
+    const xfer_progress_t *prog = &g_xfer.progress;
+    result_t res = RESULT_OK;
+
+    if (xfer_stored(&g_xfer, job->offset, job->sz)) {
+        clear_progress();
+
+        if (store_end_write(prog->total_sz, prog->crc)) {
+            ESP_LOGI("NN", "upload complete");
+        }
+        else {
+            res = RESULT_BAD_SHOW;
+        }
+    }
+    else if (prog->offset % PERSIST_SZ == 0) {
+        save_progress();
+    }
+
+    send_ack(g_sock, res, prog->offset);
+}
+
+static bool write_chunk(const uint8_t *buf, uint32_t offset, uint32_t sz)
+{
+    const esp_partition_t *part = store_partition();
+    bool ok = true;
+
+    panel_pause();
+
+    // Chunks arrive in order, so erase a sector when we enter it.
+
+    if (offset % ERASE_SZ == 0) {
+        uint32_t erase_sz = part->size - offset;
+
+        if (erase_sz > ERASE_SZ) {
+            erase_sz = ERASE_SZ;
+        }
+
+        ok = !util_failed(esp_partition_erase_range, part, offset, erase_sz);
+    }
+
+    ok = ok && !util_failed(esp_partition_write, part, offset, buf, sz);
+
+    panel_resume();
+    return ok;
+}
+
+static bool recv_all(int sock, void *data, size_t sz)
+{
+    uint8_t *data_8 = data;
+
+    while (sz > 0) {
+        ssize_t len = recv(sock, data_8, sz, 0);
+
+        if (len <= 0) {
+            return false;
+        }
+
+        data_8 += len;
+        sz -= (size_t)len;
+    }
+
+    return true;
+}
+
+static void send_ack(int sock, result_t res, uint32_t offset)
+{
+    upload_ack_t ack;
+    xfer_ack(&ack, res, offset);
+
+    // If this fails, the receiving end notices, too.
+    send(sock, &ack, sizeof ack, 0);
+}
+
+// Get the progress that save_progress() saved, if any. Returns false, if
+// there isn't any.
+static bool load_progress(xfer_progress_t *prog)
+{
+    nvs_handle_t nvs;
+    size_t sz = sizeof *prog;
+
+    // Fails with ESP_ERR_NVS_NOT_FOUND, until the first save_progress().
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) {
+        return false;
+    }
+
+    esp_err_t err = nvs_get_blob(nvs, NVS_KEY, prog, &sz);
+    nvs_close(nvs);
+
+    return err == ESP_OK && sz == sizeof *prog;
+}
+
+static void save_progress(void)
+{
+    nvs_handle_t nvs;
+
+    if (util_failed(nvs_open, NVS_NAMESPACE, NVS_READWRITE, &nvs)) {
+        return;
+    }
+
+    panel_pause();
+
+    if (!util_failed(nvs_set_blob, nvs, NVS_KEY, &g_xfer.progress,
+                sizeof g_xfer.progress)) {
+        util_failed(nvs_commit, nvs);
+    }
+
+    panel_resume();
+    nvs_close(nvs);
+}
+
+static void clear_progress(void)
+{
+    nvs_handle_t nvs;
+
+    if (util_failed(nvs_open, NVS_NAMESPACE, NVS_READWRITE, &nvs)) {
+        return;
+    }
+
+    panel_pause();
+
+    // ESP_ERR_NVS_NOT_FOUND is fine.
+    nvs_erase_key(nvs, NVS_KEY);
+    nvs_commit(nvs);
+
+    panel_resume();
+    nvs_close(nvs);
+}
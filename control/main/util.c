@@ -20,12 +20,14 @@
 #include <util.h>
 
 #include <freertos/FreeRTOS.h> // pre 4.1, IDF headers depend on this
+#include <freertos/task.h>
 
 #include <assert.h>
 #include <esp_err.h>
 #include <esp_log.h>
 #include <esp_spi_flash.h>
 #include <esp_system.h>
+#include <esp_timer.h>
 #include <esp32/clk.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -66,6 +68,11 @@ uint32_t util_ns_to_cycles(uint32_t ns)
     return ns * (uint32_t)g_freq_mhz / 1000;
 }
 
+uint32_t util_cycles_to_us(uint32_t cycles)
+{
+    return cycles / (uint32_t)g_freq_mhz;
+}
+
 void util_enter_critical(void)
 {
     portDISABLE_INTERRUPTS();
@@ -76,6 +83,20 @@ void util_leave_critical(void)
     portENABLE_INTERRUPTS();
 }
 
+void util_wait_until(int64_t us)
+{
+    int64_t ticks = (us - esp_timer_get_time()) / (1000 * portTICK_PERIOD_MS);
+
+    // vTaskDelay(n) can return after only n - 1 tick periods.
+    if (ticks >= 2) {
+        vTaskDelay((TickType_t)(ticks - 1));
+    }
+
+    while (esp_timer_get_time() < us) {
+        // do nothing
+    }
+}
+
 void util_esp_error(const char *func, esp_err_t err)
 {
     ESP_LOGE("NN", "%s() failed: %d (%s)", func, err, esp_err_to_name(err));
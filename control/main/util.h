@@ -15,6 +15,8 @@
 // You should have received a copy of the GNU General Public License along with
 // this program. If not, see <https://www.gnu.org/licenses/>.
 
+#pragma once
+
 // --- Includes ----------------------------------------------------------------
 
 #include <esp_err.h>
@@ -42,6 +44,9 @@ static inline uint32_t util_cycle_count(void)
 // Convert the given number of nanoseconds to CPU cycles.
 uint32_t util_ns_to_cycles(uint32_t ns);
 
+// Convert the given number of CPU cycles to microseconds.
+uint32_t util_cycles_to_us(uint32_t cycles);
+
 // Disable interrupts on the current core.
 void util_enter_critical(void);
 
@@ -57,6 +62,10 @@ static inline void util_delay_in_critical(uint32_t start, uint32_t cycles)
     }
 }
 
+// Sleep until the given esp_timer_get_time() time. Sleeps in ticks for as long
+// as possible, then busy-waits for the remainder.
+void util_wait_until(int64_t us);
+
 void util_esp_error(const char *func, esp_err_t err);
 
 #define util_failed(func, ...) ({      \
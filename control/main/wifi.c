@@ -19,12 +19,18 @@
 
 #include <wifi.h>
 
+#include <freertos/FreeRTOS.h> // pre 4.1, IDF headers depend on this
+#include <freertos/event_groups.h>
+#include <freertos/task.h>
+
+#include <assert.h>
 #include <esp_err.h>
 #include <esp_event.h>
 #include <esp_log.h>
 #include <esp_netif.h>
+#include <esp_timer.h>
 #include <esp_wifi.h>
-#include <freertos/task.h>
+#include <nvs.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -36,34 +42,75 @@
 
 // --- Types and constants -----------------------------------------------------
 
+// What the event handler tells the rest of us, see wait_for().
+#define EVENT_UP (1u << 0)
+#define EVENT_DOWN (1u << 1)
+#define EVENT_JOIN (1u << 2)
+#define EVENT_LEAVE (1u << 3)
+#define EVENT_SCAN_DONE (1u << 4)
+#define EVENT_SCAN_FAILED (1u << 5)
+
 typedef enum {
-    SCAN_PENDING,
-    SCAN_FAILED,
-    SCAN_DONE
-} scan_state_t;
+    ROLE_NONE,
+    ROLE_STATION,
+    ROLE_NETWORK
+} role_t;
+
+// How we got onto the network last time, kept in NVS. For a station, the
+// network's channel and BSSID. For the controller that created the network,
+// its channel and our own BSSID.
+typedef struct {
+    uint8_t role;
+    uint8_t channel;
+    uint8_t bssid[6];
+} cache_t;
 
 #define N_SCAN_ATTEMPTS 3
 
+// After a power cycle, the controller that creates the network may come up a
+// little later than the others.
+#define N_REJOIN_ATTEMPTS 3
+
+// When we lose the network, try to rejoin after this long, then back off up
+// to this long. After a few attempts, take any access point of the network,
+// not just the one that we were on.
+#define REJOIN_MIN_MS 50
+#define REJOIN_MAX_MS 2000
+#define N_REJOIN_SAME 5
+
+#define STACK_SZ 3072
+// Below the upload tasks. Rejoining doesn't have to be quick to the tick.
+#define PRIORITY 4
+// With the WiFi driver, away from the output task.
+#define CORE 0
+
 #define SSID "No Noise 3000"
 #define PASSWORD "no-noise"
 
-// --- Macros and inline functions ---------------------------------------------
+#define NVS_NAMESPACE "nn"
+#define NVS_KEY "wifi"
 
-#define wait_for(flag)                        \
-    while (!(flag)) {                         \
-        vTaskDelay(500 / portTICK_PERIOD_MS); \
-    }
+// --- Macros and inline functions ---------------------------------------------
 
 // --- Globals -----------------------------------------------------------------
 
-static volatile bool g_up, g_down, g_join, g_leave;
-static volatile scan_state_t g_scan_state;
+static EventGroupHandle_t g_events;
 
 static esp_netif_t *g_station_if, *g_network_if;
 
+static uint32_t g_ip;
+
+// The network that we joined.
+static uint8_t g_bssid[6];
+static uint8_t g_channel;
+
 // --- Helper declarations -----------------------------------------------------
 
-static bool try_init(void);
+static bool try_cached(const cache_t *cache);
+static bool try_scan(void);
+static void rejoin_task(void *arg);
+static bool rejoin(uint32_t attempt);
+static EventBits_t wait_for(EventBits_t bits);
 static bool start(void);
 static void stop(void);
 static void event_handler(void *arg, esp_event_base_t base, int32_t event,
@@ -77,52 +124,150 @@ static void network_up_event(void);
 static void network_down_event(void);
 static void network_join_event(wifi_event_ap_staconnected_t *data);
 static void network_leave_event(wifi_event_ap_stadisconnected_t *data);
-static bool run_scan(void);
+static bool run_scan(uint8_t channel);
 static bool network_exists(void);
-static bool connect(void);
-static bool create_network(void);
+static bool connect(const cache_t *cache);
+static bool create_network(uint8_t channel);
 static bool assign_addr(wifi_interface_t wifi_if, esp_netif_t *net_if);
 static uint32_t mac_to_ip(const uint8_t *mac);
+static bool load_cache(cache_t *cache);
+static void save_cache(const cache_t *old, role_t role);
 
 // --- API ---------------------------------------------------------------------
 
 void wifi_init(void)
 {
+    int64_t start_time = esp_timer_get_time();
+
+    g_events = xEventGroupCreate();
+    assert(g_events != NULL);
+
     util_never_fails(esp_netif_init);
 
     g_station_if = esp_netif_create_default_wifi_sta();
     g_network_if = esp_netif_create_default_wifi_ap();
 
-    while (!try_init()) {
-        vTaskDelay(2000 / portTICK_PERIOD_MS);
+    wifi_init_config_t conf = WIFI_INIT_CONFIG_DEFAULT();
+
+    util_never_fails(esp_wifi_init, &conf);
+    util_never_fails(esp_event_handler_register, WIFI_EVENT, ESP_EVENT_ANY_ID,
+            event_handler, NULL);
+
+    // We keep our own cache. Don't let the driver write to flash on every
+    // configuration change.
+    util_never_fails(esp_wifi_set_storage, WIFI_STORAGE_RAM);
+
+    // Try what worked last time, before scanning.
+
+    cache_t cache;
+    bool cached = load_cache(&cache);
+
+    if (!cached || !try_cached(&cache)) {
+        while (!try_scan()) {
+            vTaskDelay(2000 / portTICK_PERIOD_MS);
+        }
+    }
+
+    ESP_LOGI("NN", "network ready after %lld ms",
+            (esp_timer_get_time() - start_time) / 1000);
+
+    // As a station, we may lose the network. Whoever created it, keeps it.
+
+    wifi_mode_t mode;
+    util_never_fails(esp_wifi_get_mode, &mode);
+
+    if (mode == WIFI_MODE_STA) {
+        BaseType_t res = xTaskCreatePinnedToCore(rejoin_task, "wifi_rejoin",
+                STACK_SZ, NULL, PRIORITY, NULL, CORE);
+        assert(res == pdPASS);
     }
 }
 
+uint32_t wifi_ip(void)
+{
+    return g_ip;
+}
+
+int8_t wifi_rssi(void)
+{
+    wifi_ap_record_t ap;
+
+    if (esp_wifi_sta_get_ap_info(&ap) != ESP_OK) {
+        return 0;
+    }
+
+    return ap.rssi;
+}
+
 // --- Helpers -----------------------------------------------------------------
 
-static bool try_init(void)
+// Rejoin the network that we were on last time, straight away, or, if we
+// created it, create it again - on the same channel, so that the others find
+// it where they expect it. Returns false, if we have to scan.
+static bool try_cached(const cache_t *cache)
 {
-    wifi_init_config_t conf = WIFI_INIT_CONFIG_DEFAULT();
+    if (cache->role == ROLE_STATION) {
+        ESP_LOGI("NN", "rejoining on channel %u", cache->channel);
+
+        for (uint32_t i = 0; i < N_REJOIN_ATTEMPTS; ++i) {
+            if (connect(cache)) {
+                save_cache(cache, ROLE_STATION);
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    // Make sure that nobody else has created the network by now. Scanning a
+    // single channel is quick.
+
+    if (util_failed(esp_wifi_set_mode, WIFI_MODE_STA) || !start()) {
+        return false;
+    }
+
+    bool scanned = run_scan(cache->channel);
+    bool found = scanned && network_exists();
+
+    stop();
 
-    if (util_failed(esp_wifi_init, &conf)) {
-        goto done_0;
+    if (!scanned) {
+        return false;
     }
 
-    if (util_failed(esp_event_handler_register, WIFI_EVENT, ESP_EVENT_ANY_ID,
-                event_handler, NULL)) {
-        goto done_1;
+    if (found) {
+        bool ok = connect(NULL);
+
+        if (ok) {
+            save_cache(cache, ROLE_STATION);
+        }
+
+        return ok;
     }
 
+    ESP_LOGI("NN", "recreating network on channel %u", cache->channel);
+
+    if (!create_network(cache->channel)) {
+        return false;
+    }
+
+    save_cache(cache, ROLE_NETWORK);
+    return true;
+}
+
+// Look for the network. Join it, if it's there, otherwise create it.
+static bool try_scan(void)
+{
     if (util_failed(esp_wifi_set_mode, WIFI_MODE_STA) || !start()) {
-        goto done_2;
+        return false;
     }
 
     bool found;
 
     for (uint32_t i = 0; i < N_SCAN_ATTEMPTS; ++i) {
-        if (!run_scan()) {
+        if (!run_scan(0)) {
             stop();
-            goto done_2;
+            return false;
         }
 
         found = network_exists();
@@ -136,42 +281,93 @@ static bool try_init(void)
 
     stop();
 
-    bool ok = found ? connect() : create_network();
+    bool ok = found ? connect(NULL) : create_network(0);
 
-    if (!ok) {
-        goto done_2;
+    if (ok) {
+        save_cache(NULL, found ? ROLE_STATION : ROLE_NETWORK);
     }
 
-    return true;
+    return ok;
+}
+
+// Rejoin the network, whenever we lose it. Only the driver's connection is
+// redone - our address, our sockets and the panel output carry on as if
+// nothing happened.
+static void rejoin_task(void *arg)
+{
+    assert(arg == NULL);
+
+    while (true) {
+        wait_for(EVENT_LEAVE);
+
+        int64_t lost = esp_timer_get_time();
+        uint32_t delay = REJOIN_MIN_MS;
+
+        for (uint32_t attempt = 0; !rejoin(attempt); ++attempt) {
+            vTaskDelay(delay / portTICK_PERIOD_MS);
+            delay = delay * 2 < REJOIN_MAX_MS ? delay * 2 : REJOIN_MAX_MS;
+        }
+
+        ESP_LOGI("NN", "rejoined after %lld ms",
+                (esp_timer_get_time() - lost) / 1000);
+
+        // After the fallback, we may be on a different access point, or even
+        // on a different channel. Make the next boot go there directly. Only
+        // writes to flash, if something changed.
+        cache_t cache;
+        save_cache(load_cache(&cache) ? &cache : NULL, ROLE_STATION);
+    }
+}
+
+static bool rejoin(uint32_t attempt)
+{
+    // The access point that we were on may be gone for good. Take any one
+    // with our SSID.
+
+    if (attempt == N_REJOIN_SAME) {
+        wifi_config_t conf;
 
-done_2:
-    util_never_fails(esp_event_handler_unregister, WIFI_EVENT,
-            ESP_EVENT_ANY_ID, event_handler);
+        if (!util_failed(esp_wifi_get_config, WIFI_IF_STA, &conf)) {
+            conf.sta.bssid_set = false;
+            conf.sta.channel = 0;
+            util_failed(esp_wifi_set_config, WIFI_IF_STA, &conf);
+        }
+    }
 
-done_1:
-    util_never_fails(esp_wifi_deinit);
+    xEventGroupClearBits(g_events, EVENT_JOIN | EVENT_LEAVE);
 
-done_0:
-    return false;
+    if (util_failed(esp_wifi_connect)) {
+        return false;
+    }
+
+    return (wait_for(EVENT_JOIN | EVENT_LEAVE) & EVENT_JOIN) != 0;
+}
+
+// Wait for any of the given events, without polling. Returns the ones that
+// happened and clears them.
+static EventBits_t wait_for(EventBits_t bits)
+{
+    return xEventGroupWaitBits(g_events, bits, pdTRUE, pdFALSE,
+            portMAX_DELAY) & bits;
 }
 
 static bool start(void)
 {
-    g_up = false;
+    xEventGroupClearBits(g_events, EVENT_UP);
 
     if (util_failed(esp_wifi_start)) {
         return false;
     }
 
-    wait_for(g_up);
+    wait_for(EVENT_UP);
     return true;
 }
 
 static void stop(void)
 {
-    g_down = false;
+    xEventGroupClearBits(g_events, EVENT_DOWN);
     util_never_fails(esp_wifi_stop);
-    wait_for(g_down);
+    wait_for(EVENT_DOWN);
 }
 
 static void event_handler(void *arg, esp_event_base_t base, int32_t event,
@@ -226,24 +422,24 @@ static void scan_event(wifi_event_sta_scan_done_t *data)
 {
     if (data->status != 0) {
         ESP_LOGE("NN", "scan failed: %u", data->status);
-        g_scan_state = SCAN_FAILED;
+        xEventGroupSetBits(g_events, EVENT_SCAN_FAILED);
     }
     else {
         ESP_LOGI("NN", "found %d network(s)", data->number);
-        g_scan_state = SCAN_DONE;
+        xEventGroupSetBits(g_events, EVENT_SCAN_DONE);
     }
 }
 
 static void station_up_event(void)
 {
     ESP_LOGI("NN", "station up");
-    g_up = true;
+    xEventGroupSetBits(g_events, EVENT_UP);
 }
 
 static void station_down_event(void)
 {
     ESP_LOGI("NN", "station down");
-    g_down = true;
+    xEventGroupSetBits(g_events, EVENT_DOWN);
 }
 
 static void station_join_event(wifi_event_sta_connected_t *data)
@@ -252,7 +448,9 @@ static void station_join_event(wifi_event_sta_connected_t *data)
             data->bssid[0], data->bssid[1], data->bssid[2], data->bssid[3],
             data->bssid[4], data->bssid[5]);
 
-    g_join = true;
+    memcpy(g_bssid, data->bssid, sizeof g_bssid);
+    g_channel = data->channel;
+    xEventGroupSetBits(g_events, EVENT_JOIN);
 }
 
 static void station_leave_event(wifi_event_sta_disconnected_t *data)
@@ -261,19 +459,19 @@ static void station_leave_event(wifi_event_sta_disconnected_t *data)
             data->bssid[0], data->bssid[1], data->bssid[2], data->bssid[3],
             data->bssid[4], data->bssid[5]);
 
-    g_leave = true;
+    xEventGroupSetBits(g_events, EVENT_LEAVE);
 }
 
 static void network_up_event(void)
 {
     ESP_LOGI("NN", "network up");
-    g_up = true;
+    xEventGroupSetBits(g_events, EVENT_UP);
 }
 
 static void network_down_event(void)
 {
     ESP_LOGI("NN", "network down");
-    g_down = true;
+    xEventGroupSetBits(g_events, EVENT_DOWN);
 }
 
 static void network_join_event(wifi_event_ap_staconnected_t *data)
@@ -290,12 +488,13 @@ static void network_leave_event(wifi_event_ap_stadisconnected_t *data)
             data->mac[4], data->mac[5]);
 }
 
-static bool run_scan(void)
+// Scan the given channel, 0 for all channels.
+static bool run_scan(uint8_t channel)
 {
     wifi_scan_config_t scan_conf = {
         .ssid = NULL,
         .bssid = NULL,
-        .channel = 0,
+        .channel = channel,
         .show_hidden = false,
         .scan_type = WIFI_SCAN_TYPE_ACTIVE,
         .scan_time = {
@@ -305,17 +504,14 @@ static bool run_scan(void)
     };
 
     ESP_LOGI("NN", "scanning...");
-    g_scan_state = SCAN_PENDING;
+    xEventGroupClearBits(g_events, EVENT_SCAN_DONE | EVENT_SCAN_FAILED);
 
     if (util_failed(esp_wifi_scan_start, &scan_conf, false)) {
         return false;
     }
 
-    while (g_scan_state == SCAN_PENDING) {
-        vTaskDelay(500 / portTICK_PERIOD_MS);
-    }
-
-    return g_scan_state == SCAN_DONE;
+    return (wait_for(EVENT_SCAN_DONE | EVENT_SCAN_FAILED) &
+            EVENT_SCAN_DONE) != 0;
 }
 
 static bool network_exists(void)
@@ -348,7 +544,9 @@ static bool network_exists(void)
     return found;
 }
 
-static bool connect(void)
+// Join the network. With a cache, go straight to the access point that we
+// were on last time, without scanning.
+static bool connect(const cache_t *cache)
 {
     wifi_config_t conf = {
         .sta = {
@@ -371,6 +569,12 @@ static bool connect(void)
         }
     };
 
+    if (cache != NULL) {
+        conf.sta.bssid_set = true;
+        memcpy(conf.sta.bssid, cache->bssid, sizeof conf.sta.bssid);
+        conf.sta.channel = cache->channel;
+    }
+
     if (util_failed(esp_wifi_set_mode, WIFI_MODE_STA) ||
             util_failed(esp_wifi_set_config, WIFI_IF_STA, &conf) ||
             !start()) {
@@ -384,14 +588,14 @@ static bool connect(void)
         return false;
     }
 
+    xEventGroupClearBits(g_events, EVENT_JOIN | EVENT_LEAVE);
+
     if (util_failed(esp_wifi_connect)) {
         stop();
         return false;
     }
 
-    wait_for(g_join || g_leave);
-
-    if (!g_join) {
+    if ((wait_for(EVENT_JOIN | EVENT_LEAVE) & EVENT_JOIN) == 0) {
         stop();
         return false;
     }
@@ -399,14 +603,15 @@ static bool connect(void)
     return true;
 }
 
-static bool create_network(void)
+// Create the network on the given channel, 0 for the default one.
+static bool create_network(uint8_t channel)
 {
     wifi_config_t conf = {
         .ap = {
             .ssid = SSID,
             .password = PASSWORD,
             .ssid_len = strlen(SSID),
-            .channel = 0,
+            .channel = channel,
             .authmode = WIFI_AUTH_WPA_WPA2_PSK,
             .ssid_hidden = 0,
             .max_connection = 10,
@@ -448,6 +653,7 @@ static bool assign_addr(wifi_interface_t wifi_if, esp_netif_t *net_if)
         return false;
     }
 
+    g_ip = tmp;
     return true;
 }
 
@@ -466,3 +672,57 @@ static uint32_t mac_to_ip(const uint8_t *mac)
 
     return ip[0] << 24 | ip[1] << 16 | ip[2] << 8 | ip[3];
 }
+
+static bool load_cache(cache_t *cache)
+{
+    nvs_handle_t nvs;
+    size_t sz = sizeof *cache;
+
+    // Fails with ESP_ERR_NVS_NOT_FOUND, until the first save_cache().
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) {
+        return false;
+    }
+
+    esp_err_t err = nvs_get_blob(nvs, NVS_KEY, cache, &sz);
+    nvs_close(nvs);
+
+    return err == ESP_OK && sz == sizeof *cache &&
+            (cache->role == ROLE_STATION || cache->role == ROLE_NETWORK) &&
+            cache->channel >= 1 && cache->channel <= 14;
+}
+
+// Remember how we got onto the network. Only writes to flash, if that's
+// different from old, the cache that we started with, if any.
+static void save_cache(const cache_t *old, role_t role)
+{
+    cache_t cache = { .role = (uint8_t)role };
+
+    if (role == ROLE_STATION) {
+        cache.channel = g_channel;
+        memcpy(cache.bssid, g_bssid, sizeof cache.bssid);
+    }
+    else {
+        wifi_second_chan_t second;
+
+        if (util_failed(esp_wifi_get_channel, &cache.channel, &second) ||
+                util_failed(esp_wifi_get_mac, WIFI_IF_AP, cache.bssid)) {
+            return;
+        }
+    }
+
+    if (old != NULL && memcmp(old, &cache, sizeof cache) == 0) {
+        return;
+    }
+
+    nvs_handle_t nvs;
+
+    if (util_failed(nvs_open, NVS_NAMESPACE, NVS_READWRITE, &nvs)) {
+        return;
+    }
+
+    if (!util_failed(nvs_set_blob, nvs, NVS_KEY, &cache, sizeof cache)) {
+        util_failed(nvs_commit, nvs);
+    }
+
+    nvs_close(nvs);
+}
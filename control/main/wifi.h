@@ -17,6 +17,8 @@
 
 // --- Includes ----------------------------------------------------------------
 
+#include <stdint.h>
+
 // --- Types and constants -----------------------------------------------------
 
 // --- Macros and inline functions ---------------------------------------------
@@ -27,3 +29,10 @@
 
 // Initialize.
 void wifi_init(void);
+
+// Get our IP address, in host byte order.
+uint32_t wifi_ip(void);
+
+// Get the signal strength of the access point that we're connected to, in dBm,
+// 0, if we aren't, e.g., because we are the access point.
+int8_t wifi_rssi(void);
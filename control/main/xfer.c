@@ -0,0 +1,120 @@
+// xfer.c
+//
+// Copyright (C) 2020 by the contributors
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+
+// --- Includes ----------------------------------------------------------------
+
+#include <xfer.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <crc.h>
+#include <proto.h>
+
+#include <warnings.h>
+
+// --- Types and constants -----------------------------------------------------
+
+// --- Macros and inline functions ---------------------------------------------
+
+// --- Globals -----------------------------------------------------------------
+
+// --- Helper declarations -----------------------------------------------------
+
+// --- API ---------------------------------------------------------------------
+
+bool xfer_same(const xfer_progress_t *saved, const upload_begin_t *begin)
+{
+    return saved->total_sz == begin->total_sz && saved->crc == begin->crc &&
+            saved->offset <= saved->total_sz;
+}
+
+result_t xfer_begin(xfer_t *xfer, const upload_begin_t *begin,
+        uint32_t max_sz, const xfer_progress_t *saved)
+{
+    if (begin->total_sz == 0 || begin->total_sz > max_sz) {
+        return RESULT_TOO_LARGE;
+    }
+
+    // saved may well be xfer's own progress.
+
+    uint32_t offset = 0;
+
+    if (saved != NULL && xfer_same(saved, begin)) {
+        offset = saved->offset - saved->offset % UPLOAD_CHUNK_SZ;
+    }
+
+    xfer->progress.total_sz = begin->total_sz;
+    xfer->progress.crc = begin->crc;
+    xfer->progress.offset = offset;
+    xfer->expect = offset;
+
+    return RESULT_OK;
+}
+
+bool xfer_check(const xfer_t *xfer, const upload_chunk_t *head)
+{
+    uint32_t total_sz = xfer->progress.total_sz;
+
+    if (head->offset % UPLOAD_CHUNK_SZ != 0 || head->offset >= total_sz) {
+        return false;
+    }
+
+    uint32_t max_sz = total_sz - head->offset;
+
+    if (max_sz > UPLOAD_CHUNK_SZ) {
+        max_sz = UPLOAD_CHUNK_SZ;
+    }
+
+    return head->sz == max_sz;
+}
+
+xfer_action_t xfer_take(xfer_t *xfer, const upload_chunk_t *head,
+        const uint8_t *data)
+{
+    // After a bad chunk, the host resends from the bad chunk. Until then,
+    // ignore whatever was already in flight.
+
+    if (head->offset != xfer->expect) {
+        return XFER_SKIP;
+    }
+
+    if (crc_32(CRC_INIT, data, head->sz) != head->crc) {
+        return XFER_RESEND;
+    }
+
+    xfer->expect += head->sz;
+    return XFER_STORE;
+}
+
+bool xfer_stored(xfer_t *xfer, uint32_t offset, uint32_t sz)
+{
+    xfer->progress.offset = offset + sz;
+    return xfer->progress.offset == xfer->progress.total_sz;
+}
+
+void xfer_ack(upload_ack_t *ack, result_t res, uint32_t offset)
+{
+    memset(ack, 0, sizeof *ack);
+
+    ack->result = (uint8_t)res;
+    ack->offset = offset;
+}
+
+// --- Helpers -----------------------------------------------------------------
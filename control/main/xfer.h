@@ -0,0 +1,97 @@
+// xfer.h
+//
+// Copyright (C) 2020 by the contributors
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+// --- Includes ----------------------------------------------------------------
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <proto.h>
+
+// --- Types and constants -----------------------------------------------------
+
+// How far an upload got. Controllers persist this, so that an upload can be
+// resumed after a disconnect or a reset.
+typedef struct {
+    uint32_t total_sz;
+    uint32_t crc;
+    // Stored up to here.
+    uint32_t offset;
+} xfer_progress_t;
+
+// The receiving end of an upload, see proto.h, without the sockets and the
+// storage: which uploads to take, where to resume, which chunks to keep and
+// which to have resent. Chunks are received, then stored, possibly by
+// someone else. Only xfer_take() changes expect, only xfer_stored() changes
+// progress, so that the two can run in different tasks.
+typedef struct {
+    xfer_progress_t progress;
+    // The offset of the next chunk to take.
+    uint32_t expect;
+} xfer_t;
+
+typedef enum {
+    // Drop the chunk. It was in flight, when we asked for a resend.
+    XFER_SKIP,
+    // The chunk is corrupt. Acknowledge with RESULT_BAD_CRC and expect.
+    XFER_RESEND,
+    // Store the chunk, then call xfer_stored().
+    XFER_STORE
+} xfer_action_t;
+
+// --- Macros and inline functions ---------------------------------------------
+
+// --- Globals -----------------------------------------------------------------
+
+// --- API ---------------------------------------------------------------------
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Check whether saved is the progress of the upload that begin starts, i.e.,
+// whether it can be resumed.
+bool xfer_same(const xfer_progress_t *saved, const upload_begin_t *begin);
+
+// Start the upload that begin asks for, into storage of max_sz bytes. saved
+// is how far an earlier upload got, NULL, if there wasn't any. If it's the
+// same upload, it resumes at the last whole chunk, otherwise it starts over.
+// Returns the result to acknowledge with. The offset to acknowledge is
+// xfer->expect.
+result_t xfer_begin(xfer_t *xfer, const upload_begin_t *begin,
+        uint32_t max_sz, const xfer_progress_t *saved);
+
+// Check a chunk's header, before receiving its data. Returns false, if it
+// breaks the protocol. Then, the connection is better closed.
+bool xfer_check(const xfer_t *xfer, const upload_chunk_t *head);
+
+// Decide what to do with a received chunk, whose header passed xfer_check().
+xfer_action_t xfer_take(xfer_t *xfer, const upload_chunk_t *head,
+        const uint8_t *data);
+
+// Record that a chunk that xfer_take() said to store is stored. Returns true,
+// if that completes the upload.
+bool xfer_stored(xfer_t *xfer, uint32_t offset, uint32_t sz);
+
+// Fill in an acknowledgement.
+void xfer_ack(upload_ack_t *ack, result_t res, uint32_t offset);
+
+#ifdef __cplusplus
+}
+#endif
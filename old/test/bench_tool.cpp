@@ -0,0 +1,333 @@
+// bench_tool.cpp
+//
+// Copyright (C) 2020 by the contributors
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+
+// --- Includes ----------------------------------------------------------------
+
+#include "show_writer.h"
+#include "test.h"
+
+#include <crc.h>
+#include <encode.h>
+#include <hist.h>
+#include <jitter.h>
+#include <show.h>
+#include <sync.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// --- Types -------------------------------------------------------------------
+
+// --- Constants and macros ----------------------------------------------------
+
+// Like a controller with two lanes of 1200 LEDs.
+#define BENCH_N_LANES 2
+#define BENCH_LANE_PIXELS 1200
+#define BENCH_N_PIXELS (BENCH_N_LANES * BENCH_LANE_PIXELS)
+#define BENCH_WIDTH 80
+#define BENCH_HEIGHT (BENCH_N_PIXELS / BENCH_WIDTH)
+
+// Streamed frames of three parts plus a parity part, see stream.c.
+#define BENCH_PART_SZ 1200
+#define BENCH_FRAME_SZ 3600
+#define BENCH_N_PARITY 1
+#define BENCH_PERIOD 25000
+#define BENCH_DELAY 10000
+
+#define DEFAULT_MS 200
+
+// --- Globals -----------------------------------------------------------------
+
+// Keeps results alive, so that the compiler doesn't optimize the work away.
+static volatile uint32_t g_sink;
+
+// --- Helper declarations -----------------------------------------------------
+
+static void run_case(const char *name, const char *unit, uint64_t n_units,
+        int64_t budget, const std::function<void()> &call);
+static bool bench_stream(int64_t budget, bool lossy);
+static void make_frame(uint32_t frame_id, uint8_t *pixels, size_t n_pixels);
+static int64_t get_us();
+
+// --- API ---------------------------------------------------------------------
+
+// Time the hardware-independent parts of the firmware, one at a time, with
+// the data sizes of a real controller. Compile with optimization to get
+// numbers that compare, see CMakeLists.txt.
+bool run_core_bench(int argc, char *argv[])
+{
+    if (argc > 1) {
+        std::cerr << "usage: test core-bench [ms-per-case]" << std::endl;
+        return false;
+    }
+
+    int64_t budget = (argc > 0 ? std::atoi(argv[0]) : DEFAULT_MS) * 1000;
+
+    if (budget <= 0) {
+        std::cerr << "need at least 1 ms per case" << std::endl;
+        return false;
+    }
+
+    std::vector<uint8_t> pixels(BENCH_N_PIXELS * 3);
+    std::vector<uint8_t> masks(BENCH_N_PIXELS * 3);
+    std::vector<uint16_t> samples(BENCH_LANE_PIXELS *
+            ENCODE_SAMPLES_PER_PIXEL);
+    const uint8_t *lanes[BENCH_N_LANES];
+
+    for (size_t i = 0; i < BENCH_N_LANES; ++i) {
+        lanes[i] = pixels.data() + i * BENCH_LANE_PIXELS * 3;
+    }
+
+    make_frame(0, pixels.data(), BENCH_N_PIXELS);
+    encode_masks(lanes, BENCH_N_LANES, 0, BENCH_LANE_PIXELS, masks.data());
+
+    std::cout << "case                unit       ns/unit       units/s" <<
+            std::endl;
+    std::cout << "-----------------------------------------------------" <<
+            std::endl;
+
+    // Output.
+
+    run_case("encode", "pixel", BENCH_N_PIXELS, budget, [&] {
+        encode_pixels(lanes, BENCH_N_LANES, 0, BENCH_LANE_PIXELS,
+                samples.data());
+        g_sink = samples[0];
+    });
+
+    // The other chips' encoders, with their own pixel sizes.
+
+    std::vector<uint8_t> chip_pixels(BENCH_N_PIXELS * ENCODE_MAX_PIXEL_SZ);
+    std::vector<uint16_t> chip_samples(BENCH_LANE_PIXELS *
+            ENCODE_MAX_PIXEL_SZ * 8 * ENCODE_SAMPLES_PER_BIT);
+
+    for (size_t i = 0; i < chip_pixels.size(); ++i) {
+        chip_pixels[i] = (uint8_t)(i * 7);
+    }
+
+    for (int32_t id = 0; id < ENCODE_N_CHIPS; ++id) {
+        const encode_chip_t *chip = encode_get_chip((encode_chip_id_t)id);
+        const uint8_t *chip_lanes[BENCH_N_LANES];
+
+        if (chip->encode == encode_pixels) {
+            continue;
+        }
+
+        for (size_t i = 0; i < BENCH_N_LANES; ++i) {
+            chip_lanes[i] = chip_pixels.data() +
+                    i * BENCH_LANE_PIXELS * chip->pixel_sz;
+        }
+
+        std::string name = std::string{"encode-"} + chip->name;
+
+        run_case(name.c_str(), "pixel", BENCH_N_PIXELS, budget, [&] {
+            chip->encode(chip_lanes, BENCH_N_LANES, 0, BENCH_LANE_PIXELS,
+                    chip_samples.data());
+            g_sink = chip_samples[0];
+        });
+    }
+
+    run_case("encode-masks", "pixel", BENCH_N_PIXELS, budget, [&] {
+        encode_masks(lanes, BENCH_N_LANES, 0, BENCH_LANE_PIXELS,
+                masks.data());
+        g_sink = masks[0];
+    });
+
+    run_case("encode-wave", "pixel", BENCH_N_PIXELS, budget, [&] {
+        encode_wave(masks.data(), BENCH_N_LANES, 0, BENCH_LANE_PIXELS,
+                samples.data());
+        g_sink = samples[0];
+    });
+
+    // Shows. A key frame followed by a delta frame, as made by show-make.
+
+    show_writer writer{BENCH_WIDTH, BENCH_HEIGHT, 40, SHOW_FORMAT_RGB,
+            SHOW_CODEC_RLE, 2};
+    std::vector<uint8_t> frame(BENCH_N_PIXELS * 3);
+
+    for (uint32_t i = 0; i < 2; ++i) {
+        make_frame(i, frame.data(), BENCH_N_PIXELS);
+        writer.add_frame(frame.data());
+    }
+
+    const std::vector<uint8_t> data = writer.finish();
+    show_t show;
+
+    if (show_open(&show, data.data(), data.size()) != SHOW_OK ||
+            show_check(&show, frame.data()) != SHOW_OK) {
+        std::cerr << "bad show" << std::endl;
+        return false;
+    }
+
+    run_case("show-key", "pixel", BENCH_N_PIXELS, budget, [&] {
+        g_sink = show_apply(&show, 0, frame.data());
+    });
+
+    run_case("show-delta", "pixel", BENCH_N_PIXELS, budget, [&] {
+        g_sink = show_apply(&show, 1, frame.data());
+    });
+
+    run_case("crc", "byte", data.size(), budget, [&] {
+        g_sink = crc_32(CRC_INIT, data.data(), data.size());
+    });
+
+    // Streams and the protocol.
+
+    if (!bench_stream(budget, false) || !bench_stream(budget, true)) {
+        return false;
+    }
+
+    std::vector<uint8_t> parity(BENCH_PART_SZ);
+
+    run_case("stream-parity", "frame", 1, budget, [&] {
+        jitter_make_parity(pixels.data(), BENCH_FRAME_SZ, BENCH_PART_SZ,
+                BENCH_N_PARITY, 0, parity.data());
+        g_sink = parity[0];
+    });
+
+    sync_t sync;
+    sync_init(&sync);
+    int64_t t = 0;
+
+    run_case("sync-add", "exchange", 1, budget, [&] {
+        t += 100000;
+        sync_add(&sync, t, t + 5000 + 500, t + 5000 + 600, t + 1100);
+        g_sink = (uint32_t)sync_to_master(&sync, t);
+    });
+
+    run_case("hist-bucket", "value", 1000, budget, [&] {
+        uint32_t sum = 0;
+
+        for (uint32_t v = 0; v < 1000; ++v) {
+            sum += hist_bucket(v * 997);
+        }
+
+        g_sink = sum;
+    });
+
+    return true;
+}
+
+// --- Helpers -----------------------------------------------------------------
+
+// Call the given function repeatedly for about budget microseconds. Each call
+// does n_units units of work.
+static void run_case(const char *name, const char *unit, uint64_t n_units,
+        int64_t budget, const std::function<void()> &call)
+{
+    // Warm up the caches.
+
+    call();
+
+    uint64_t n_calls = 0;
+    int64_t start = get_us();
+    int64_t elapsed;
+
+    do {
+        for (uint32_t i = 0; i < 16; ++i) {
+            call();
+        }
+
+        n_calls += 16;
+        elapsed = get_us() - start;
+    } while (elapsed < budget);
+
+    double ns = (double)elapsed * 1000.0 / (double)(n_calls * n_units);
+
+    std::cout << std::left << std::setw(20) << name << std::setw(8) <<
+            unit << std::right << std::fixed << std::setprecision(2) <<
+            std::setw(10) << ns << std::setw(14) << std::setprecision(0) <<
+            1e9 / ns << std::endl;
+}
+
+// Put frames into a jitter buffer part by part, like stream.c, and play them
+// back. Lossy streams lose one part of each frame, which the parity part then
+// recovers. Fails, if any frame doesn't come out.
+static bool bench_stream(int64_t budget, bool lossy)
+{
+    std::vector<uint8_t> mem(jitter_mem_sz(BENCH_FRAME_SZ, BENCH_PART_SZ,
+            BENCH_N_PARITY));
+    std::vector<uint8_t> frame(BENCH_FRAME_SZ);
+    std::vector<uint8_t> parity(BENCH_PART_SZ);
+    std::vector<uint8_t> out(BENCH_FRAME_SZ);
+
+    make_frame(0, frame.data(), BENCH_FRAME_SZ / 3);
+    jitter_make_parity(frame.data(), BENCH_FRAME_SZ, BENCH_PART_SZ,
+            BENCH_N_PARITY, 0, parity.data());
+
+    jitter_t jitter;
+    jitter_init(&jitter, mem.data(), BENCH_FRAME_SZ, BENCH_PART_SZ,
+            BENCH_N_PARITY, BENCH_DELAY, BENCH_DELAY);
+
+    uint32_t n_parts = BENCH_FRAME_SZ / BENCH_PART_SZ;
+    uint32_t frame_id = 0;
+    uint32_t n_played = 0;
+
+    run_case(lossy ? "stream-recover" : "stream", "packet",
+            lossy ? n_parts : n_parts + BENCH_N_PARITY, budget, [&] {
+        int64_t at = (int64_t)frame_id * BENCH_PERIOD;
+
+        for (uint32_t part = 0; part < n_parts + BENCH_N_PARITY; ++part) {
+            if ((lossy && part == 1) || (!lossy && part == n_parts)) {
+                continue;
+            }
+
+            const uint8_t *data = part < n_parts ?
+                    frame.data() + part * BENCH_PART_SZ : parity.data();
+            jitter_put(&jitter, frame_id, at, part, data, BENCH_PART_SZ,
+                    at + 1000);
+        }
+
+        n_played += jitter_play(&jitter, at + 2 * BENCH_DELAY, out.data());
+        ++frame_id;
+    });
+
+    if (n_played != frame_id || memcmp(out.data(), frame.data(),
+            BENCH_FRAME_SZ) != 0) {
+        std::cerr << "played " << n_played << " of " << frame_id <<
+                " frame(s)" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+// A moving gradient, which codes about as well as typical shows.
+static void make_frame(uint32_t frame_id, uint8_t *pixels, size_t n_pixels)
+{
+    for (uint32_t i = 0; i < n_pixels; ++i) {
+        uint32_t x = i % BENCH_WIDTH + frame_id;
+        uint32_t y = i / BENCH_WIDTH;
+
+        pixels[i * 3] = (uint8_t)(x * 4);
+        pixels[i * 3 + 1] = (uint8_t)(y * 8);
+        pixels[i * 3 + 2] = (uint8_t)((x + y) * 2);
+    }
+}
+
+// steady_clock is CLOCK_MONOTONIC on Linux.
+static int64_t get_us()
+{
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::microseconds>(now).count();
+}
@@ -0,0 +1,243 @@
+// elect_tool.cpp
+//
+// Copyright (C) 2020 by the contributors
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+
+// --- Includes ----------------------------------------------------------------
+
+#include "test.h"
+
+#include <elect.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+
+// --- Types -------------------------------------------------------------------
+
+struct sim_node {
+    elect_t elect;
+    bool alive = true;
+    int64_t next_beat = 0;
+    int64_t following_since = -1;
+};
+
+// --- Constants and macros ----------------------------------------------------
+
+// Simulated controllers for elect-bench. Like the firmware, they send a
+// heartbeat every HEARTBEAT and are ready to lead after following the leader
+// for READY_AFTER, i.e., once their show clock is in sync. A small network,
+// run many times, and one with more controllers than ELECT_MAX_PEERS, run
+// fewer times, as every heartbeat goes to everybody.
+#define SIM_N_NODES 8
+#define SIM_N_RUNS 200
+#define SIM_N_MANY_NODES (ELECT_MAX_PEERS + 16)
+#define SIM_N_MANY_RUNS 20
+#define SIM_STEP 10000
+#define SIM_HEARTBEAT 100000
+#define SIM_READY_AFTER 3200000
+#define SIM_LOSS 0.2
+#define SIM_KILL_AT 10000000
+#define SIM_END 15000000
+
+// A new leader must take over within this long after the old one is gone:
+// the old one's last heartbeat times out, then everybody re-elects with the
+// next heartbeat.
+#define SIM_LIMIT (ELECT_TIMEOUT + SIM_HEARTBEAT)
+
+// --- Globals -----------------------------------------------------------------
+
+// --- Helper declarations -----------------------------------------------------
+
+static bool simulate(int32_t n_nodes, int32_t n_runs);
+static bool agree(const std::vector<sim_node> &nodes, uint32_t &leader);
+
+// --- API ---------------------------------------------------------------------
+
+// Simulate controllers that boot together, elect a leader over a lossy
+// network and then lose the leader. Reports how long it takes until everybody
+// agrees on the new one, and how often they disagree otherwise.
+bool run_elect_bench(int argc, char *argv[])
+{
+    (void)argv;
+
+    if (argc != 0) {
+        std::cerr << "usage: test elect-bench" << std::endl;
+        return false;
+    }
+
+    bool ok = simulate(SIM_N_NODES, SIM_N_RUNS);
+    ok = simulate(SIM_N_MANY_NODES, SIM_N_MANY_RUNS) && ok;
+
+    std::cout << (ok ? "ok" : "FAILED") << std::endl;
+    return ok;
+}
+
+// --- Helpers -----------------------------------------------------------------
+
+// Simulate the given number of controllers the given number of times.
+static bool simulate(int32_t n_nodes, int32_t n_runs)
+{
+    std::mt19937 rng{1972};
+    std::uniform_int_distribution<uint32_t> any_ip{0x0a000001, 0x0affffff};
+    std::uniform_int_distribution<int64_t> any_phase{0, SIM_HEARTBEAT - 1};
+    std::uniform_real_distribution<double> unit{0.0, 1.0};
+
+    std::vector<int64_t> takeovers;
+    int64_t n_steps = 0;
+    int64_t n_split = 0;
+    int32_t n_wrong = 0;
+
+    for (int32_t run = 0; run < n_runs; ++run) {
+        std::vector<sim_node> nodes((size_t)n_nodes);
+
+        for (auto &node: nodes) {
+            elect_init(&node.elect, any_ip(rng), 0);
+            node.next_beat = any_phase(rng);
+        }
+
+        int64_t takeover = -1;
+
+        for (int64_t now = 0; now < SIM_END; now += SIM_STEP) {
+            if (now == SIM_KILL_AT) {
+                uint32_t leader;
+
+                if (agree(nodes, leader)) {
+                    for (auto &node: nodes) {
+                        node.alive = node.alive && node.elect.self != leader;
+                    }
+                }
+            }
+
+            for (auto &node: nodes) {
+                if (!node.alive || now < node.next_beat) {
+                    continue;
+                }
+
+                node.next_beat += SIM_HEARTBEAT;
+
+                uint32_t leader = elect_update(&node.elect, now);
+
+                // Follow and get in sync, if there's somebody else to follow.
+
+                if (leader == ELECT_NONE || leader == node.elect.self) {
+                    node.following_since = -1;
+                }
+                else if (node.following_since < 0) {
+                    node.following_since = now;
+                }
+                else if (now - node.following_since >= SIM_READY_AFTER) {
+                    elect_ready(&node.elect);
+                }
+
+                for (auto &peer: nodes) {
+                    if (&peer != &node && peer.alive &&
+                            unit(rng) >= SIM_LOSS) {
+                        elect_heard(&peer.elect, node.elect.self,
+                                node.elect.ready, now);
+                    }
+                }
+            }
+
+            // Only judge once everybody has had a chance to hear everybody.
+
+            if (now < 2 * ELECT_TIMEOUT) {
+                continue;
+            }
+
+            uint32_t leader;
+            bool agreed = agree(nodes, leader);
+
+            if (now >= SIM_KILL_AT && takeover < 0) {
+                if (agreed) {
+                    takeover = now - SIM_KILL_AT;
+                }
+
+                continue;
+            }
+
+            ++n_steps;
+
+            if (!agreed) {
+                ++n_split;
+            }
+        }
+
+        takeovers.push_back(takeover < 0 ? SIM_END : takeover);
+
+        // Whoever leads in the end must be the lowest of the survivors.
+
+        uint32_t lowest = 0xffffffff;
+
+        for (auto &node: nodes) {
+            if (node.alive) {
+                lowest = std::min(lowest, node.elect.self);
+            }
+        }
+
+        uint32_t leader;
+
+        if (!agree(nodes, leader) || leader != lowest) {
+            ++n_wrong;
+        }
+    }
+
+    std::sort(takeovers.begin(), takeovers.end());
+
+    int64_t p50 = takeovers[takeovers.size() / 2];
+    int64_t max = takeovers.back();
+
+    std::cout << n_nodes << " controllers: takeover p50 " << p50 / 1000 <<
+            " ms, max " << max / 1000 << " ms (limit " << SIM_LIMIT / 1000 <<
+            " ms)" << std::endl;
+    std::cout << n_nodes << " controllers: disagreement " << std::fixed << std::setprecision(3) <<
+            100.0 * (double)n_split / (double)n_steps << "% of the time, " <<
+            n_wrong << " wrong leader(s) in " << n_runs << " run(s), " <<
+            SIM_LOSS * 100.0 << "% loss" << std::endl;
+
+    return max <= SIM_LIMIT && n_wrong == 0;
+}
+
+// Check whether the live controllers all see the same live leader.
+static bool agree(const std::vector<sim_node> &nodes, uint32_t &leader)
+{
+    leader = ELECT_NONE;
+    bool alive = false;
+
+    for (auto &node: nodes) {
+        if (!node.alive) {
+            continue;
+        }
+
+        if (node.elect.leader == ELECT_NONE) {
+            return false;
+        }
+
+        if (leader == ELECT_NONE) {
+            leader = node.elect.leader;
+        }
+        else if (node.elect.leader != leader) {
+            return false;
+        }
+
+        alive = alive || node.elect.self == leader;
+    }
+
+    return alive;
+}
@@ -0,0 +1,299 @@
+// golden_tool.cpp
+//
+// Copyright (C) 2020 by the contributors
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+
+// --- Includes ----------------------------------------------------------------
+
+#include "test.h"
+
+#include <crc.h>
+#include <encode.h>
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// --- Types -------------------------------------------------------------------
+
+// An encoder run: the LEDs, a pattern, a number of lanes, and the pixels to
+// encode.
+struct golden_case {
+    std::string chip;
+    std::string pattern;
+    uint32_t n_lanes;
+    size_t first;
+    size_t n_pixels;
+};
+
+// --- Constants and macros ----------------------------------------------------
+
+// Pixels per lane. Not a multiple of anything, so that odd tails get tested.
+#define GOLDEN_LANE_PIXELS 53
+
+// --- Globals -----------------------------------------------------------------
+
+// --- Helper declarations -----------------------------------------------------
+
+static std::vector<golden_case> get_cases();
+static std::string case_key(const golden_case &c);
+static std::vector<uint8_t> make_pattern(const std::string &pattern,
+        uint32_t n_lanes, size_t pixel_sz);
+static uint32_t encode_case(const golden_case &c, bool &wave_ok);
+
+// --- API ---------------------------------------------------------------------
+
+// Write the CRC-32 of the samples of each case to a corpus file. Only after
+// checking a change to the samples on real LEDs.
+bool run_encode_golden(int argc, char *argv[])
+{
+    if (argc != 1) {
+        std::cerr << "usage: test encode-golden out.golden" << std::endl;
+        return false;
+    }
+
+    std::ostringstream out;
+
+    out << "# Golden encoder output, see golden_tool.cpp. One case per line:" <<
+            std::endl <<
+            "# chip pattern lanes first pixels crc-32-of-samples" << std::endl;
+
+    for (const golden_case &c : get_cases()) {
+        bool wave_ok;
+        uint32_t crc = encode_case(c, wave_ok);
+
+        if (!wave_ok) {
+            std::cerr << case_key(c) << ": masks don't match" << std::endl;
+            return false;
+        }
+
+        out << case_key(c) << " " << std::hex << std::setw(8) <<
+                std::setfill('0') << crc << std::dec << std::setfill(' ') <<
+                std::endl;
+    }
+
+    std::string str = out.str();
+    return write_file(argv[0], std::vector<uint8_t>{str.begin(), str.end()});
+}
+
+// Check that the encoder still produces the exact same samples as recorded in
+// the corpus file, bit for bit, with and without pre-encoding. Every case is
+// checked, and every case in the corpus must still exist.
+bool run_encode_check(int argc, char *argv[])
+{
+    if (argc != 1) {
+        std::cerr << "usage: test encode-check in.golden" << std::endl;
+        return false;
+    }
+
+    std::ifstream in{argv[0]};
+
+    if (!in) {
+        std::cerr << argv[0] << ": cannot open" << std::endl;
+        return false;
+    }
+
+    std::map<std::string, uint32_t> golden;
+    std::string line;
+
+    while (std::getline(in, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+
+        std::istringstream fields{line};
+        golden_case c;
+        uint32_t crc;
+
+        if (!(fields >> c.chip >> c.pattern >> c.n_lanes >> c.first >>
+                c.n_pixels >> std::hex >> crc)) {
+            std::cerr << argv[0] << ": bad line: " << line << std::endl;
+            return false;
+        }
+
+        golden[case_key(c)] = crc;
+    }
+
+    uint32_t n_failed = 0;
+    uint32_t n_checked = 0;
+
+    for (const golden_case &c : get_cases()) {
+        std::string key = case_key(c);
+        auto it = golden.find(key);
+
+        if (it == golden.end()) {
+            std::cerr << key << ": not in corpus" << std::endl;
+            ++n_failed;
+            continue;
+        }
+
+        bool wave_ok;
+        uint32_t crc = encode_case(c, wave_ok);
+
+        if (crc != it->second || !wave_ok) {
+            std::cerr << key << ": " << (crc != it->second ? "samples" :
+                    "masks") << " don't match" << std::endl;
+            ++n_failed;
+        }
+
+        golden.erase(it);
+        ++n_checked;
+    }
+
+    for (const auto &kv : golden) {
+        std::cerr << kv.first << ": no such case" << std::endl;
+        ++n_failed;
+    }
+
+    std::cout << n_checked << " case(s), " << n_failed << " failure(s)" <<
+            std::endl;
+
+    return n_failed == 0;
+}
+
+// --- Helpers -----------------------------------------------------------------
+
+// For every chip, every pattern with every lane count, once for all pixels,
+// once for a DMA buffer's worth in the middle, see panel.c, once for the last
+// pixel.
+static std::vector<golden_case> get_cases()
+{
+    static const char *const patterns[] = {
+        "black", "white", "walk", "lanes", "gradient", "random"
+    };
+
+    static const uint32_t lane_counts[] = { 1, 2, 3, 4, 8, 15, 16 };
+
+    static const size_t ranges[][2] = {
+        { 0, GOLDEN_LANE_PIXELS }, { 6, 6 }, { GOLDEN_LANE_PIXELS - 1, 1 }
+    };
+
+    std::vector<golden_case> cases;
+
+    for (int32_t id = 0; id < ENCODE_N_CHIPS; ++id) {
+        const encode_chip_t *chip = encode_get_chip((encode_chip_id_t)id);
+
+        for (const char *pattern : patterns) {
+            for (uint32_t n_lanes : lane_counts) {
+                // Clocked chips need a lane for the clock.
+
+                if (chip->clocked && n_lanes == ENCODE_MAX_LANES) {
+                    continue;
+                }
+
+                for (const auto &range : ranges) {
+                    cases.push_back({chip->name, pattern, n_lanes, range[0],
+                            range[1]});
+                }
+            }
+        }
+    }
+
+    return cases;
+}
+
+static std::string case_key(const golden_case &c)
+{
+    return c.chip + " " + c.pattern + " " + std::to_string(c.n_lanes) + " " +
+            std::to_string(c.first) + " " + std::to_string(c.n_pixels);
+}
+
+// The pixels of all lanes, lane after lane. Patterns catch mixed-up bits,
+// channels, lanes and pixels.
+static std::vector<uint8_t> make_pattern(const std::string &pattern,
+        uint32_t n_lanes, size_t pixel_sz)
+{
+    size_t sz = (size_t)n_lanes * GOLDEN_LANE_PIXELS * pixel_sz;
+    std::vector<uint8_t> pixels(sz);
+
+    // mt19937's output is the same everywhere, unlike the distributions'.
+    std::mt19937 rng{1972};
+
+    for (size_t i = 0; i < sz; ++i) {
+        size_t lane = i / (GOLDEN_LANE_PIXELS * pixel_sz);
+        size_t pixel = i / pixel_sz % GOLDEN_LANE_PIXELS;
+        size_t channel = i % pixel_sz;
+
+        if (pattern == "white") {
+            pixels[i] = 0xff;
+        }
+        else if (pattern == "walk") {
+            // A single bit, moving through bits, channels and lanes.
+            size_t step = (lane + pixel) % (pixel_sz * 8);
+            pixels[i] = step / 8 == channel ? (uint8_t)(0x80 >> step % 8) : 0;
+        }
+        else if (pattern == "lanes") {
+            pixels[i] = (uint8_t)((lane + 1) * 16 + channel);
+        }
+        else if (pattern == "gradient") {
+            pixels[i] = (uint8_t)(pixel * 5 + channel * 85 + lane * 7);
+        }
+        else if (pattern == "random") {
+            pixels[i] = (uint8_t)rng();
+        }
+    }
+
+    return pixels;
+}
+
+// Encode the case with the chip's encoder and get the CRC-32 of the samples.
+// For WS2815 and lane counts that pre-encoding supports, also check that
+// encoding via masks produces the same samples.
+static uint32_t encode_case(const golden_case &c, bool &wave_ok)
+{
+    const encode_chip_t *chip = encode_find_chip(c.chip.c_str());
+    std::vector<uint8_t> pixels = make_pattern(c.pattern, c.n_lanes,
+            chip->pixel_sz);
+    std::vector<const uint8_t *> lanes;
+
+    for (uint32_t l = 0; l < c.n_lanes; ++l) {
+        lanes.push_back(pixels.data() + l * GOLDEN_LANE_PIXELS *
+                chip->pixel_sz);
+    }
+
+    size_t n_samples = encode_n_samples(chip, c.n_pixels);
+    std::vector<uint16_t> samples(n_samples);
+
+    chip->encode(lanes.data(), c.n_lanes, c.first, c.n_pixels,
+            samples.data());
+
+    uint32_t crc = crc_32(CRC_INIT, samples.data(),
+            n_samples * sizeof (uint16_t));
+
+    wave_ok = true;
+
+    if (chip == encode_get_chip(ENCODE_CHIP_WS2815) &&
+            (c.n_lanes == 1 || c.n_lanes == 2 || c.n_lanes == 4)) {
+        std::vector<uint8_t> masks(pixels.size());
+        std::vector<uint16_t> wave(n_samples);
+
+        encode_masks(lanes.data(), c.n_lanes, 0, GOLDEN_LANE_PIXELS,
+                masks.data());
+        encode_wave(masks.data(), c.n_lanes, c.first, c.n_pixels,
+                wave.data());
+
+        wave_ok = memcmp(samples.data(), wave.data(),
+                n_samples * sizeof (uint16_t)) == 0;
+    }
+
+    return crc;
+}
@@ -0,0 +1,401 @@
+// jitter_tool.cpp
+//
+// Copyright (C) 2020 by the contributors
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+
+// --- Includes ----------------------------------------------------------------
+
+#include "test.h"
+
+#include <jitter.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+
+// --- Types -------------------------------------------------------------------
+
+struct sim_part {
+    int64_t arrival;
+    uint32_t frame_id;
+    int64_t at;
+    uint32_t part;
+};
+
+// --- Constants and macros ----------------------------------------------------
+
+// Simulated stream for jitter-bench: 40 frames per second, three parts each.
+#define SIM_PERIOD 25000
+#define SIM_PART_SZ 1200
+#define SIM_FRAME_SZ 3000
+#define SIM_N_FRAMES 4800
+
+// Simulated WiFi. One-way delays are a base delay plus an exponentially
+// distributed queueing delay. Now and then, the link stalls and then delivers
+// everything that piled up in one burst. Some parts get lost.
+#define SIM_BASE_DELAY 1500.0
+#define SIM_MEAN_QUEUE 2000.0
+#define SIM_STALL_RATE 0.5
+#define SIM_MAX_STALL 80000.0
+#define SIM_LOSS 0.01
+
+// Like the firmware, see stream.c and net.c.
+#define SIM_MIN_DELAY 10000
+#define SIM_MAX_DELAY 250000
+#define SIM_HEARTBEAT 100000
+#define SIM_STEP 100
+
+// Only judge once the delay has had time to adapt.
+#define SIM_WARMUP 10000000
+
+// jitter-bench fails, if the 99th percentile deviation of the time between
+// frames from the frame period exceeds this, or if more parts than this
+// fraction come too late.
+#define SIM_LIMIT 1000
+#define SIM_LATE_LIMIT 0.002
+
+// Simulated lossy channel for fec-bench. Losses come in bursts: the channel
+// switches between a good and a bad state, Gilbert-Elliott style.
+#define FEC_FRAME_SZ 9000
+#define FEC_N_FRAMES 20000
+#define FEC_N_CONTENTS 16
+#define FEC_GOOD_LOSS 0.01
+#define FEC_BAD_LOSS 0.3
+#define FEC_TO_BAD 0.01
+#define FEC_TO_GOOD 0.2
+
+// fec-bench fails, if a single parity part doesn't get at least this fraction
+// of frames through complete, or if more parity doesn't help.
+#define FEC_LIMIT 0.95
+
+// --- Globals -----------------------------------------------------------------
+
+// --- Helper declarations -----------------------------------------------------
+
+static void add_interval(std::vector<int64_t> &errors, int64_t &prev_time,
+        int64_t &prev_at, int64_t time, int64_t at);
+static int64_t percentile(std::vector<int64_t> &values, double p);
+
+// --- API ---------------------------------------------------------------------
+
+// Stream frames over a simulated bursty network. Compares showing each frame
+// as soon as it's complete with playing it out of the jitter buffer, by how
+// much the time between frames deviates from the frame period.
+bool run_jitter_bench(int argc, char *argv[])
+{
+    (void)argv;
+
+    if (argc != 0) {
+        std::cerr << "usage: test jitter-bench" << std::endl;
+        return false;
+    }
+
+    std::mt19937 rng{1972};
+    std::exponential_distribution<double> queue{1.0 / SIM_MEAN_QUEUE};
+    std::exponential_distribution<double> between_stalls{SIM_STALL_RATE / 1e6};
+    std::uniform_real_distribution<double> unit{0.0, 1.0};
+
+    // Send everything, then sort by arrival.
+
+    uint32_t n_parts = (SIM_FRAME_SZ + SIM_PART_SZ - 1) / SIM_PART_SZ;
+    std::vector<sim_part> parts;
+
+    int64_t stall_start = (int64_t)between_stalls(rng);
+    int64_t stall_end = stall_start + (int64_t)(unit(rng) * SIM_MAX_STALL);
+
+    for (uint32_t frame_id = 0; frame_id < SIM_N_FRAMES; ++frame_id) {
+        int64_t at = (int64_t)frame_id * SIM_PERIOD;
+
+        for (uint32_t part = 0; part < n_parts; ++part) {
+            int64_t sent = at + part * 100;
+
+            if (sent >= stall_end) {
+                stall_start = sent + (int64_t)between_stalls(rng);
+                stall_end = stall_start +
+                        (int64_t)(unit(rng) * SIM_MAX_STALL);
+            }
+
+            int64_t arrival = sent + (int64_t)(SIM_BASE_DELAY + queue(rng));
+
+            if (sent >= stall_start) {
+                arrival = std::max(arrival, stall_end + part * 100);
+            }
+
+            if (unit(rng) >= SIM_LOSS) {
+                parts.push_back({arrival, frame_id, at, part});
+            }
+        }
+    }
+
+    std::stable_sort(parts.begin(), parts.end(),
+            [](const sim_part &a, const sim_part &b) {
+                return a.arrival < b.arrival;
+            });
+
+    // Show frames as soon as they're complete.
+
+    std::vector<int64_t> arrival_errors;
+    std::vector<uint32_t> have(SIM_N_FRAMES);
+    int64_t prev_time = -1;
+    int64_t prev_at = 0;
+
+    for (auto &part: parts) {
+        if (++have[part.frame_id] == n_parts && part.arrival >= SIM_WARMUP) {
+            add_interval(arrival_errors, prev_time, prev_at, part.arrival,
+                    part.at);
+        }
+    }
+
+    // Play them out of the jitter buffer, adapting the playout delay with
+    // every heartbeat.
+
+    std::vector<uint8_t> mem(jitter_mem_sz(SIM_FRAME_SZ, SIM_PART_SZ, 0));
+    std::vector<uint8_t> data(SIM_PART_SZ);
+    std::vector<uint8_t> out(SIM_FRAME_SZ);
+
+    jitter_t jitter;
+    jitter_init(&jitter, mem.data(), SIM_FRAME_SZ, SIM_PART_SZ, 0,
+            SIM_MIN_DELAY, SIM_MAX_DELAY);
+
+    std::vector<int64_t> jitter_errors;
+    prev_time = -1;
+
+    jitter_stats_t warm = {};
+    size_t next = 0;
+
+    for (int64_t now = 0; next < parts.size() || jitter.stats.occupancy > 0;
+            now += SIM_STEP) {
+        for (; next < parts.size() && parts[next].arrival <= now; ++next) {
+            auto &part = parts[next];
+            size_t sz = std::min<size_t>(SIM_PART_SZ,
+                    SIM_FRAME_SZ - part.part * SIM_PART_SZ);
+
+            jitter_put(&jitter, part.frame_id, part.at, part.part,
+                    data.data(), sz, now);
+        }
+
+        if (now % SIM_HEARTBEAT == 0) {
+            jitter_set_delay(&jitter, jitter_target(&jitter));
+        }
+
+        if (now == SIM_WARMUP) {
+            warm = jitter.stats;
+        }
+
+        if (jitter_play(&jitter, now, out.data()) && now >= SIM_WARMUP) {
+            add_interval(jitter_errors, prev_time, prev_at, now,
+                    (int64_t)jitter.last_id * SIM_PERIOD);
+        }
+    }
+
+    const jitter_stats_t &stats = jitter.stats;
+    uint32_t n_late = stats.n_late - warm.n_late;
+    uint32_t n_judged = stats.n_parts - warm.n_parts;
+    double late = (double)n_late / (double)n_judged;
+
+    std::cout << "             p50    p90    p99    max" << std::endl;
+    std::cout << "--------------------------------------" << std::endl;
+
+    int64_t p99 = 0;
+
+    for (auto *values: {&jitter_errors, &arrival_errors}) {
+        std::cout << (values == &jitter_errors ? "buffered " : "on arrival") <<
+                std::setw(values == &jitter_errors ? 7 : 6) <<
+                percentile(*values, 0.5) <<
+                std::setw(7) << percentile(*values, 0.9) <<
+                std::setw(7) << percentile(*values, 0.99) <<
+                std::setw(7) << percentile(*values, 1.0) << std::endl;
+
+        if (values == &jitter_errors) {
+            p99 = percentile(*values, 0.99);
+        }
+    }
+
+    std::cout << "frame interval error in us, playout delay " <<
+            jitter.delay / 1000 << " ms, buffered at most " <<
+            stats.max_occupancy << " frame(s)" << std::endl;
+    std::cout << "late " << n_late << " part(s) (" << std::fixed <<
+            std::setprecision(3) << late * 100.0 << "%), dropped " <<
+            stats.n_dropped << ", partial " << stats.n_partial <<
+            " frame(s), missing " << stats.n_missing << ", skipped " <<
+            stats.n_skipped << ", " << SIM_LOSS * 100.0 << "% loss" <<
+            std::endl;
+    std::cout << "lost " << stats.n_lost << " part(s), reordered " <<
+            stats.n_reordered << std::endl;
+
+    bool ok = p99 <= SIM_LIMIT && late <= SIM_LATE_LIMIT &&
+            stats.n_dropped == 0;
+    std::cout << (ok ? "ok" : "FAILED") << std::endl;
+
+    return ok;
+}
+
+// Stream frames with 0 to JITTER_MAX_PARITY parity parts over a simulated
+// channel with bursty loss. Reports the overhead and how many frames arrive
+// complete, and checks that rebuilt frames are correct.
+bool run_fec_bench(int argc, char *argv[])
+{
+    (void)argv;
+
+    if (argc != 0) {
+        std::cerr << "usage: test fec-bench" << std::endl;
+        return false;
+    }
+
+    std::mt19937 rng{1972};
+    std::uniform_int_distribution<uint32_t> any_byte{0, 255};
+    std::uniform_real_distribution<double> unit{0.0, 1.0};
+
+    std::vector<std::vector<uint8_t>> contents(FEC_N_CONTENTS);
+
+    for (auto &content: contents) {
+        content.resize(FEC_FRAME_SZ);
+        std::generate(content.begin(), content.end(),
+                [&]() { return (uint8_t)any_byte(rng); });
+    }
+
+    uint32_t n_parts = (FEC_FRAME_SZ + SIM_PART_SZ - 1) / SIM_PART_SZ;
+
+    std::cout << "parity  overhead    loss  complete  recovered" << std::endl;
+    std::cout << "-------------------------------------------" << std::endl;
+
+    bool ok = true;
+    double prev_complete = 0.0;
+
+    for (uint32_t n_parity = 0; n_parity <= JITTER_MAX_PARITY;
+            n_parity = n_parity == 0 ? 1 : 2 * n_parity) {
+        std::vector<uint8_t> mem(jitter_mem_sz(FEC_FRAME_SZ, SIM_PART_SZ,
+                n_parity));
+        std::vector<uint8_t> parity(SIM_PART_SZ);
+        std::vector<uint8_t> out(FEC_FRAME_SZ);
+
+        jitter_t jitter;
+        jitter_init(&jitter, mem.data(), FEC_FRAME_SZ, SIM_PART_SZ, n_parity,
+                0, 0);
+
+        bool bad = false;
+        uint32_t n_sent = 0;
+        uint32_t n_lost = 0;
+        uint32_t n_complete = 0;
+        uint32_t n_wrong = 0;
+
+        for (uint32_t frame_id = 0; frame_id < FEC_N_FRAMES; ++frame_id) {
+            const uint8_t *frame = contents[frame_id % FEC_N_CONTENTS].data();
+            int64_t at = (int64_t)frame_id * SIM_PERIOD;
+
+            for (uint32_t part = 0; part < n_parts + n_parity; ++part) {
+                const uint8_t *data = frame + part * SIM_PART_SZ;
+                size_t sz = std::min<size_t>(SIM_PART_SZ,
+                        FEC_FRAME_SZ - part * SIM_PART_SZ);
+
+                if (part >= n_parts) {
+                    jitter_make_parity(frame, FEC_FRAME_SZ, SIM_PART_SZ,
+                            n_parity, part - n_parts, parity.data());
+                    data = parity.data();
+                    sz = SIM_PART_SZ;
+                }
+
+                bad = unit(rng) < (bad ? 1.0 - FEC_TO_GOOD : FEC_TO_BAD);
+                ++n_sent;
+
+                if (unit(rng) < (bad ? FEC_BAD_LOSS : FEC_GOOD_LOSS)) {
+                    ++n_lost;
+                    continue;
+                }
+
+                jitter_put(&jitter, frame_id, at, part, data, sz, at);
+            }
+
+            uint32_t n_partial = jitter.stats.n_partial;
+
+            if (!jitter_play(&jitter, at, out.data()) ||
+                    jitter.stats.n_partial != n_partial) {
+                continue;
+            }
+
+            ++n_complete;
+
+            if (std::memcmp(out.data(), frame, FEC_FRAME_SZ) != 0) {
+                ++n_wrong;
+            }
+        }
+
+        double complete = (double)n_complete / FEC_N_FRAMES;
+
+        std::cout << std::setw(6) << n_parity << std::fixed <<
+                std::setprecision(1) <<
+                std::setw(9) << 100.0 * n_parity / n_parts << "%" <<
+                std::setw(7) << 100.0 * n_lost / n_sent << "%" <<
+                std::setprecision(2) <<
+                std::setw(9) << 100.0 * complete << "%" <<
+                std::setw(11) << jitter.stats.n_recovered << std::endl;
+
+        if (n_wrong > 0) {
+            std::cout << n_wrong << " frame(s) rebuilt wrong" << std::endl;
+            ok = false;
+        }
+
+        // Only losses at the very end go unnoticed.
+
+        if (jitter.stats.n_lost > n_lost ||
+                n_lost - jitter.stats.n_lost > n_parts + n_parity) {
+            std::cout << jitter.stats.n_lost << " of " << n_lost <<
+                    " lost part(s) noticed" << std::endl;
+            ok = false;
+        }
+
+        if ((n_parity == 1 && complete < FEC_LIMIT) ||
+                complete <= prev_complete) {
+            ok = false;
+        }
+
+        prev_complete = complete;
+    }
+
+    std::cout << (ok ? "ok" : "FAILED") << std::endl;
+    return ok;
+}
+
+// --- Helpers -----------------------------------------------------------------
+
+// Record how far the time since the previous frame is off from the time
+// between their timestamps.
+static void add_interval(std::vector<int64_t> &errors, int64_t &prev_time,
+        int64_t &prev_at, int64_t time, int64_t at)
+{
+    if (prev_time >= 0) {
+        errors.push_back(std::abs((time - prev_time) - (at - prev_at)));
+    }
+
+    prev_time = time;
+    prev_at = at;
+}
+
+static int64_t percentile(std::vector<int64_t> &values, double p)
+{
+    if (values.empty()) {
+        return 0;
+    }
+
+    std::sort(values.begin(), values.end());
+
+    size_t i = (size_t)(p * (double)(values.size() - 1));
+    return values[i];
+}
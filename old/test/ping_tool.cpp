@@ -0,0 +1,347 @@
+// ping_tool.cpp
+//
+// Copyright (C) 2020 by the contributors
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+
+// --- Includes ----------------------------------------------------------------
+
+#include "test.h"
+
+#include <hist.h>
+#include <proto.h>
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <netinet/in.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// --- Types -------------------------------------------------------------------
+
+// A ping in flight. Pings carry an 8-bit sequence number, so there's one slot
+// per possible value.
+struct ping {
+    uint32_t seq = 0;
+    int64_t sent = -1;
+};
+
+// What we know about a controller.
+struct node {
+    std::vector<int64_t> rtts;
+    std::vector<bool> seen;
+    bool leader = false;
+};
+
+// State shared by the sending and the receiving thread.
+struct bench {
+    std::mutex lock;
+    ping pings[256];
+    uint32_t n_sent = 0;
+    std::map<std::string, node> nodes;
+    uint32_t counts[HIST_N_BUCKETS] = {};
+    std::atomic<bool> done{false};
+};
+
+// --- Constants and macros ----------------------------------------------------
+
+// Replies that take longer than this count as lost. The controllers hold
+// their replies randomly for up to 1 ms, see PING_DELAY_LIMIT in net.c, and
+// say for how long, which round trip times leave out.
+#define PING_TIMEOUT 100000
+
+#define DEFAULT_SECONDS 10
+#define DEFAULT_RATE 100
+
+// Pings carry 8-bit sequence numbers. Keep late replies from being taken for
+// replies to later pings.
+#define MAX_RATE (128 * 1000000 / PING_TIMEOUT)
+
+// --- Globals -----------------------------------------------------------------
+
+// --- Helper declarations -----------------------------------------------------
+
+static void receive(int sock, bench &b);
+static void print_report(bench &b);
+static bool write_csv(const std::string &path, const std::string &label,
+        bench &b);
+static int64_t percentile(const std::vector<int64_t> &sorted, uint32_t
+        per_mille);
+static int64_t get_us();
+
+// --- API ---------------------------------------------------------------------
+
+bool run_ping_bench(int argc, char *argv[])
+{
+    if (argc > 4) {
+        std::cerr << "usage: test ping-bench [seconds] [rate] [out.csv] "
+                "[label]" << std::endl;
+        return false;
+    }
+
+    int64_t seconds = argc > 0 ? std::atoi(argv[0]) : DEFAULT_SECONDS;
+    int64_t rate = argc > 1 ? std::atoi(argv[1]) : DEFAULT_RATE;
+    std::string csv = argc > 2 ? argv[2] : "";
+    std::string label = argc > 3 ? argv[3] : "-";
+
+    if (seconds < 1 || rate < 1 || rate > MAX_RATE) {
+        std::cerr << "need at least 1 second, 1 to " << MAX_RATE <<
+                " pings per second" << std::endl;
+        return false;
+    }
+
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    assert(sock >= 0);
+
+    // Short receive timeouts, so that the receiving thread notices when
+    // we're done.
+
+    timeval tv = {0, 10000};
+    int32_t res = setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+    assert(res == 0);
+
+    static const int32_t one = 1;
+    res = setsockopt(sock, SOL_SOCKET, SO_BROADCAST, &one, sizeof one);
+    assert(res == 0);
+
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(PROTO_UDP_PORT);
+    addr.sin_addr.s_addr = inet_addr(broadcast_ip());
+
+    bench b;
+    std::thread receiver{receive, sock, std::ref(b)};
+
+    // Send at a fixed rate, no matter how many pings are in flight. Times
+    // are from the monotonic clock, so that clock adjustments don't show up
+    // as round trip times.
+
+    int64_t interval = 1000000 / rate;
+    int64_t start = get_us();
+    uint32_t n_pings = (uint32_t)(seconds * rate);
+
+    for (uint32_t seq = 0; seq < n_pings; ++seq) {
+        int64_t due = start + seq * interval;
+        int64_t now = get_us();
+
+        if (due > now) {
+            std::this_thread::sleep_for(std::chrono::microseconds{due - now});
+        }
+
+        uint8_t buf[2] = { COMMAND_PING, (uint8_t)seq };
+
+        {
+            std::lock_guard<std::mutex> guard{b.lock};
+            ping &p = b.pings[seq % 256];
+
+            p.seq = seq;
+            p.sent = get_us();
+            b.n_sent = seq + 1;
+        }
+
+        ssize_t len = sendto(sock, buf, sizeof buf, MSG_NOSIGNAL,
+                (sockaddr *)&addr, sizeof addr);
+
+        if (len != (ssize_t)sizeof buf) {
+            std::cerr << "cannot send ping" << std::endl;
+        }
+    }
+
+    // Give the last pings time to come back.
+
+    std::this_thread::sleep_for(std::chrono::microseconds{PING_TIMEOUT});
+
+    b.done = true;
+    receiver.join();
+    close(sock);
+
+    if (b.nodes.empty()) {
+        std::cerr << "no ping replies" << std::endl;
+        return false;
+    }
+
+    print_report(b);
+
+    return csv.empty() || write_csv(csv, label, b);
+}
+
+// --- Helpers -----------------------------------------------------------------
+
+// Collect replies and match them to the pings in flight. The time is taken
+// right after the reply is received, before waiting for the lock.
+static void receive(int sock, bench &b)
+{
+    while (!b.done) {
+        ping_reply_t reply;
+        sockaddr_in addr;
+        socklen_t addr_len = sizeof addr;
+
+        ssize_t len = recvfrom(sock, &reply, sizeof reply, 0,
+                (sockaddr *)&addr, &addr_len);
+
+        int64_t now = get_us();
+
+        if (len != (ssize_t)sizeof reply) {
+            continue;
+        }
+
+        std::string str{inet_ntoa(addr.sin_addr)};
+        std::lock_guard<std::mutex> guard{b.lock};
+
+        const ping &p = b.pings[reply.seq];
+        int64_t rtt = now - p.sent - reply.held;
+
+        if (p.sent < 0 || rtt > PING_TIMEOUT) {
+            continue;
+        }
+
+        node &n = b.nodes[str];
+
+        if (n.seen.size() <= p.seq) {
+            n.seen.resize(p.seq + 1);
+        }
+
+        if (n.seen[p.seq]) {
+            continue;
+        }
+
+        n.seen[p.seq] = true;
+        n.rtts.push_back(rtt);
+        n.leader = n.leader || reply.leader != 0;
+
+        ++b.counts[hist_bucket((uint32_t)rtt)];
+    }
+}
+
+static void print_report(bench &b)
+{
+    std::cout << "        address   sent   recv  loss-%     min     p50     "
+            "p90     p99   p99.9     max L" << std::endl;
+    std::cout << "----------------------------------------------------------"
+            "-------------------------------" << std::endl;
+
+    for (auto &kv : b.nodes) {
+        node &n = kv.second;
+        std::sort(n.rtts.begin(), n.rtts.end());
+
+        double loss = 100.0 * (double)(b.n_sent - n.rtts.size()) / b.n_sent;
+
+        std::cout << std::setw(15) << kv.first << std::setw(7) << b.n_sent <<
+                std::setw(7) << n.rtts.size() << std::setw(8) << std::fixed <<
+                std::setprecision(2) << loss;
+
+        static const uint32_t per_mille[] = { 0, 500, 900, 990, 999, 1000 };
+
+        for (uint32_t pm : per_mille) {
+            double ms = (double)percentile(n.rtts, pm) / 1000.0;
+            std::cout << std::setw(8) << ms;
+        }
+
+        std::cout << " " << (n.leader ? "*" : " ") << std::endl;
+    }
+
+    std::cout << "(times in ms)" << std::endl << std::endl;
+
+    // All replies from all controllers, four buckets per power of two.
+
+    uint32_t total = hist_total(b.counts);
+    uint32_t max = *std::max_element(b.counts, b.counts + HIST_N_BUCKETS);
+
+    for (uint32_t i = 0; i < HIST_N_BUCKETS; ++i) {
+        if (b.counts[i] == 0) {
+            continue;
+        }
+
+        uint32_t width = (uint32_t)(50.0 * b.counts[i] / max + 0.5);
+
+        std::cout << std::setw(8) << hist_lower(i) << " - " <<
+                std::setw(8) << hist_upper(i) << " us " << std::setw(7) <<
+                b.counts[i] << std::setw(7) << std::setprecision(2) <<
+                100.0 * b.counts[i] / total << "% " <<
+                std::string(width, '#') << std::endl;
+    }
+}
+
+// Append a row per controller. The label tells runs apart, e.g., different
+// firmware builds.
+static bool write_csv(const std::string &path, const std::string &label,
+        bench &b)
+{
+    bool fresh = !std::ifstream{path}.good();
+    std::ofstream out{path, std::ios::app};
+
+    if (fresh) {
+        out << "label,address,sent,received,loss_pct,min_us,p50_us,p90_us,"
+                "p99_us,p999_us,max_us,leader" << std::endl;
+    }
+
+    for (auto &kv : b.nodes) {
+        const node &n = kv.second;
+        double loss = 100.0 * (double)(b.n_sent - n.rtts.size()) / b.n_sent;
+
+        out << label << "," << kv.first << "," << b.n_sent << "," <<
+                n.rtts.size() << "," << std::fixed << std::setprecision(3) <<
+                loss;
+
+        static const uint32_t per_mille[] = { 0, 500, 900, 990, 999, 1000 };
+
+        for (uint32_t pm : per_mille) {
+            out << "," << percentile(n.rtts, pm);
+        }
+
+        out << "," << (n.leader ? 1 : 0) << std::endl;
+    }
+
+    out.close();
+
+    if (!out) {
+        std::cerr << path << ": cannot write" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+// Nearest-rank percentile of sorted values, in per mille.
+static int64_t percentile(const std::vector<int64_t> &sorted, uint32_t
+        per_mille)
+{
+    if (sorted.empty()) {
+        return 0;
+    }
+
+    size_t rank = (sorted.size() * per_mille + 999) / 1000;
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+// steady_clock is CLOCK_MONOTONIC on Linux.
+static int64_t get_us()
+{
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::microseconds>(now).count();
+}
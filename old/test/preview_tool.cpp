@@ -0,0 +1,381 @@
+// preview_tool.cpp
+//
+// Copyright (C) 2020 by the contributors
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+
+// --- Includes ----------------------------------------------------------------
+
+#include "test.h"
+
+#include <encode.h>
+#include <panel.h>
+#include <show.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// --- Types -------------------------------------------------------------------
+
+typedef enum {
+    PREVIEW_PPM,
+    PREVIEW_Y4M,
+    PREVIEW_ANSI
+} preview_kind_t;
+
+// Decoding a show frame, encoding it into samples like panel_render() does,
+// latching the samples like the LEDs do, writing the result.
+typedef enum {
+    STAGE_DECODE,
+    STAGE_ENCODE,
+    STAGE_LATCH,
+    STAGE_WRITE,
+    N_STAGES
+} preview_stage_t;
+
+struct stage_time {
+    int64_t total = 0;
+    int64_t max = 0;
+};
+
+// --- Constants and macros ----------------------------------------------------
+
+// The LEDs tell a 0 bit from a 1 bit by the level about 600 ns after the
+// rising edge, see T0H and T1H in encode.c.
+#define LATCH_SAMPLE 5
+
+// --- Globals -----------------------------------------------------------------
+
+// --- Helper declarations -----------------------------------------------------
+
+static bool latch(const uint16_t *samples, uint32_t lane, size_t lane_pixels,
+        uint8_t *pixels);
+static void write_ppm(std::ostream &out, const uint8_t *pixels,
+        const show_header_t *head);
+static void write_y4m(std::ostream &out, const uint8_t *pixels,
+        const show_header_t *head, bool first);
+static void write_ansi(const uint8_t *pixels, const show_header_t *head);
+static int64_t get_us();
+
+// --- API ---------------------------------------------------------------------
+
+// Show what the wall would show. The frames take the same path as on the
+// controllers, including the output samples, which are then read back, pixel
+// by pixel, like the LEDs read them. Writes binary PPMs, one after the other,
+// a Y4M video, or, for "-", plays the frames in the terminal. Files are
+// written at full speed, which makes this a benchmark of the output path.
+bool run_show_preview(int argc, char *argv[])
+{
+    if (argc < 2 || argc > 3) {
+        std::cerr << "usage: test show-preview in.show out.ppm|out.y4m|- "
+                "[frames]" << std::endl;
+        return false;
+    }
+
+    std::string path = argv[1];
+    preview_kind_t kind = PREVIEW_ANSI;
+
+    if (path != "-") {
+        std::string ext = path.substr(path.find_last_of('.') + 1);
+
+        if (ext != "ppm" && ext != "y4m") {
+            std::cerr << path << ": need .ppm or .y4m" << std::endl;
+            return false;
+        }
+
+        kind = ext == "ppm" ? PREVIEW_PPM : PREVIEW_Y4M;
+    }
+
+    std::vector<uint8_t> data;
+
+    if (!read_file(argv[0], data)) {
+        return false;
+    }
+
+    show_t show;
+    show_result_t res = show_open(&show, data.data(), data.size());
+
+    if (res != SHOW_OK) {
+        std::cerr << argv[0] << ": " << show_result_str(res) << std::endl;
+        return false;
+    }
+
+    const show_header_t *head = show.head;
+    size_t n_pixels = (size_t)head->width * head->height;
+    bool wave = head->format == SHOW_FORMAT_WAVE;
+
+    if ((head->format != SHOW_FORMAT_RGB && !wave) ||
+            n_pixels % PANEL_N_LANES != 0) {
+        std::cerr << argv[0] << ": show doesn't fit panel" << std::endl;
+        return false;
+    }
+
+    uint32_t n_frames = argc > 2 ? (uint32_t)std::atoi(argv[2]) :
+            head->n_frames;
+
+    if (n_frames == 0) {
+        std::cerr << "need at least 1 frame" << std::endl;
+        return false;
+    }
+    size_t lane_pixels = n_pixels / PANEL_N_LANES;
+
+    std::vector<uint8_t> frame(show.frame_sz);
+    std::vector<uint8_t> pixels(n_pixels * 3);
+    const uint8_t *lanes[PANEL_N_LANES];
+
+    // All lanes go out in parallel, one bit of each sample per lane.
+
+    std::vector<uint16_t> samples(lane_pixels * ENCODE_SAMPLES_PER_PIXEL);
+
+    for (size_t i = 0; i < PANEL_N_LANES; ++i) {
+        lanes[i] = frame.data() + i * lane_pixels * 3;
+    }
+
+    std::ofstream out;
+
+    if (kind != PREVIEW_ANSI) {
+        out.open(path, std::ios::binary | std::ios::trunc);
+
+        if (!out) {
+            std::cerr << path << ": cannot create" << std::endl;
+            return false;
+        }
+    }
+
+    stage_time times[N_STAGES];
+    int64_t period = 1000000 / head->fps;
+    int64_t start = get_us();
+
+    for (uint32_t i = 0; i < n_frames; ++i) {
+        uint32_t frame_id = i % head->n_frames;
+        int64_t t[N_STAGES + 1];
+
+        t[STAGE_DECODE] = get_us();
+
+        if (!show_apply(&show, frame_id, frame.data())) {
+            std::cerr << argv[0] << ": bad frame " << frame_id << std::endl;
+            return false;
+        }
+
+        t[STAGE_ENCODE] = get_us();
+
+        if (wave) {
+            encode_wave(frame.data(), PANEL_N_LANES, 0, lane_pixels,
+                    samples.data());
+        }
+        else {
+            encode_pixels(lanes, PANEL_N_LANES, 0, lane_pixels,
+                    samples.data());
+        }
+
+        t[STAGE_LATCH] = get_us();
+
+        for (uint32_t l = 0; l < PANEL_N_LANES; ++l) {
+            uint8_t *to = pixels.data() + l * lane_pixels * 3;
+
+            if (!latch(samples.data(), l, lane_pixels, to)) {
+                std::cerr << "bad samples in frame " << frame_id << std::endl;
+                return false;
+            }
+        }
+
+        t[STAGE_WRITE] = get_us();
+
+        switch (kind) {
+        case PREVIEW_PPM:
+            write_ppm(out, pixels.data(), head);
+            break;
+
+        case PREVIEW_Y4M:
+            write_y4m(out, pixels.data(), head, i == 0);
+            break;
+
+        case PREVIEW_ANSI:
+            write_ansi(pixels.data(), head);
+            break;
+        }
+
+        t[N_STAGES] = get_us();
+
+        for (uint32_t s = 0; s < N_STAGES; ++s) {
+            int64_t us = t[s + 1] - t[s];
+            times[s].total += us;
+            times[s].max = std::max(times[s].max, us);
+        }
+
+        // Play the terminal preview in real time.
+
+        if (kind == PREVIEW_ANSI) {
+            int64_t due = start + (int64_t)(i + 1) * period;
+            int64_t now = get_us();
+
+            if (due > now) {
+                std::this_thread::sleep_for(
+                        std::chrono::microseconds{due - now});
+            }
+        }
+    }
+
+    if (kind != PREVIEW_ANSI) {
+        out.close();
+
+        if (!out) {
+            std::cerr << path << ": cannot write" << std::endl;
+            return false;
+        }
+    }
+
+    int64_t elapsed = get_us() - start;
+
+    static const char *const names[N_STAGES] = {
+        "decode", "encode", "latch", "write"
+    };
+
+    std::ostream &report = kind == PREVIEW_ANSI ? std::cerr : std::cout;
+
+    report << n_frames << " frame(s) in " << elapsed / 1000 << " ms, " <<
+            std::fixed << std::setprecision(1) <<
+            (double)n_frames * 1e6 / (double)std::max(elapsed, (int64_t)1) <<
+            " fps" << std::endl;
+    report << "stage    mean-us   max-us" << std::endl;
+
+    for (uint32_t s = 0; s < N_STAGES; ++s) {
+        report << std::left << std::setw(6) << names[s] << std::right <<
+                std::setw(10) << (double)times[s].total / n_frames <<
+                std::setw(9) << times[s].max << std::endl;
+    }
+
+    return true;
+}
+
+// --- Helpers -----------------------------------------------------------------
+
+// Read back the RGB pixels sent to the given lane, like the LEDs read them.
+// Returns false, if the samples aren't valid bits.
+static bool latch(const uint16_t *samples, uint32_t lane, size_t lane_pixels,
+        uint8_t *pixels)
+{
+    // Green, red, blue on the wire. See encode_pixels() for the k ^ 1.
+
+    static const size_t order[3] = { 1, 0, 2 };
+    size_t k = 0;
+
+    for (size_t p = 0; p < lane_pixels; ++p) {
+        for (size_t c = 0; c < 3; ++c) {
+            uint32_t byte = 0;
+
+            for (int32_t bit = 0; bit < 8; ++bit) {
+                uint32_t high = samples[k ^ 1] >> lane & 1;
+                uint32_t low = samples[(k + ENCODE_SAMPLES_PER_BIT - 1) ^ 1] >>
+                        lane & 1;
+
+                if (high != 1 || low != 0) {
+                    return false;
+                }
+
+                uint32_t level = samples[(k + LATCH_SAMPLE) ^ 1] >> lane & 1;
+
+                byte = byte << 1 | level;
+                k += ENCODE_SAMPLES_PER_BIT;
+            }
+
+            pixels[p * 3 + order[c]] = (uint8_t)byte;
+        }
+    }
+
+    return true;
+}
+
+static void write_ppm(std::ostream &out, const uint8_t *pixels,
+        const show_header_t *head)
+{
+    out << "P6\n" << head->width << " " << head->height << "\n255\n";
+    out.write((const char *)pixels,
+            (std::streamsize)head->width * head->height * 3);
+}
+
+// YUV 4:4:4 with BT.601 coefficients.
+static void write_y4m(std::ostream &out, const uint8_t *pixels,
+        const show_header_t *head, bool first)
+{
+    if (first) {
+        out << "YUV4MPEG2 W" << head->width << " H" << head->height <<
+                " F" << head->fps << ":1 Ip A1:1 C444\n";
+    }
+
+    size_t n_pixels = (size_t)head->width * head->height;
+    std::vector<uint8_t> planes(n_pixels * 3);
+
+    for (size_t i = 0; i < n_pixels; ++i) {
+        int32_t r = pixels[i * 3];
+        int32_t g = pixels[i * 3 + 1];
+        int32_t b = pixels[i * 3 + 2];
+
+        planes[i] = (uint8_t)((77 * r + 150 * g + 29 * b + 128) >> 8);
+        planes[n_pixels + i] =
+                (uint8_t)((-43 * r - 85 * g + 128 * b + 32896) >> 8);
+        planes[2 * n_pixels + i] =
+                (uint8_t)((128 * r - 107 * g - 21 * b + 32896) >> 8);
+    }
+
+    out << "FRAME\n";
+    out.write((const char *)planes.data(), (std::streamsize)planes.size());
+}
+
+// Two rows per line of text, as the fore- and background colors of a half
+// block, in 24-bit color.
+static void write_ansi(const uint8_t *pixels, const show_header_t *head)
+{
+    std::string text = "\x1b[H";
+
+    for (uint32_t y = 0; y < head->height; y += 2) {
+        for (uint32_t x = 0; x < head->width; ++x) {
+            const uint8_t *top = pixels + ((size_t)y * head->width + x) * 3;
+            const uint8_t *bottom = top + (size_t)head->width * 3;
+            char buf[64];
+
+            if (y + 1 < head->height) {
+                snprintf(buf, sizeof buf, "\x1b[38;2;%d;%d;%dm"
+                        "\x1b[48;2;%d;%d;%dm\xe2\x96\x80", top[0], top[1],
+                        top[2], bottom[0], bottom[1], bottom[2]);
+            }
+            else {
+                snprintf(buf, sizeof buf, "\x1b[38;2;%d;%d;%dm\x1b[49m"
+                        "\xe2\x96\x80", top[0], top[1], top[2]);
+            }
+
+            text += buf;
+        }
+
+        text += "\x1b[0m\n";
+    }
+
+    std::cout << text << std::flush;
+}
+
+// steady_clock is CLOCK_MONOTONIC on Linux.
+static int64_t get_us()
+{
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::microseconds>(now).count();
+}
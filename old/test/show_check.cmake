@@ -0,0 +1,57 @@
+# Round-trips a show through the test CLI, as a CTest case: makes a show from
+# made-up pixels, checks it, pre-encodes it and checks that, too. Once with
+# compressed and once with uncompressed frames. show-wave itself checks that
+# the pre-encoded frames output the same samples as the original ones.
+#
+#   cmake -DCLI=path/to/test -DDIR=scratch/dir -P show_check.cmake
+
+if(NOT CLI OR NOT DIR)
+    message(FATAL_ERROR "need -DCLI=... and -DDIR=...")
+endif()
+
+# 12 frames of 8 x 4 pixels. Every third frame is random, the rest only
+# change a little, so that there are runs and deltas to code.
+
+set(WIDTH 8)
+set(HEIGHT 4)
+set(N_FRAMES 12)
+math(EXPR FRAME_SZ "${WIDTH} * ${HEIGHT} * 3")
+math(EXPR TAIL_SZ "${FRAME_SZ} - 6")
+
+set(PIXELS "")
+set(FRAME "")
+
+foreach(i RANGE 1 ${N_FRAMES})
+    math(EXPR KEY "${i} % 3")
+
+    if(KEY EQUAL 1)
+        string(RANDOM LENGTH ${FRAME_SZ} RANDOM_SEED ${i} FRAME)
+    else()
+        string(RANDOM LENGTH 6 RANDOM_SEED ${i} HEAD)
+        string(SUBSTRING "${FRAME}" 6 ${TAIL_SZ} TAIL)
+        set(FRAME "${HEAD}${TAIL}")
+    endif()
+
+    string(APPEND PIXELS "${FRAME}")
+endforeach()
+
+file(WRITE ${DIR}/check.rgb "${PIXELS}")
+
+function(run)
+    execute_process(COMMAND ${CLI} ${ARGN} RESULT_VARIABLE RES)
+
+    if(NOT RES EQUAL 0)
+        message(FATAL_ERROR "test ${ARGN} failed")
+    endif()
+endfunction()
+
+foreach(KEY_INTERVAL 4 0)
+    set(SHOW ${DIR}/check-${KEY_INTERVAL}.show)
+    set(WAVE ${DIR}/check-${KEY_INTERVAL}-wave.show)
+
+    run(show-make ${DIR}/check.rgb ${SHOW} ${WIDTH} ${HEIGHT} 25
+            ${KEY_INTERVAL})
+    run(show-check ${SHOW})
+    run(show-wave ${SHOW} ${WAVE})
+    run(show-check ${WAVE})
+endforeach()
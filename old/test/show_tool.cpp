@@ -0,0 +1,341 @@
+// show_tool.cpp
+//
+// Copyright (C) 2020 by the contributors
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+
+// --- Includes ----------------------------------------------------------------
+
+#include "show_writer.h"
+#include "test.h"
+
+#include <crc.h>
+#include <encode.h>
+#include <show.h>
+
+#include <chrono>
+#include <cstring>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+// --- Types -------------------------------------------------------------------
+
+// --- Constants and macros ----------------------------------------------------
+
+#define N_SEEKS 1000
+
+// --- Globals -----------------------------------------------------------------
+
+// --- Helper declarations -----------------------------------------------------
+
+static void print_header(const show_header_t *head);
+static bool check_seeks(const show_t *show);
+static bool check_wave(const show_t *show, const show_t *wave);
+static void get_lanes(const uint8_t *data, size_t n_pixels,
+        const uint8_t *lanes[SHOW_WAVE_LANES]);
+
+// --- API ---------------------------------------------------------------------
+
+bool run_show_make(int argc, char *argv[])
+{
+    if (argc < 5 || argc > 6) {
+        std::cerr << "usage: show-make in.rgb out.show width height fps "
+                "[key-interval]" << std::endl;
+        return false;
+    }
+
+    uint16_t width = (uint16_t)std::atoi(argv[2]);
+    uint16_t height = (uint16_t)std::atoi(argv[3]);
+    uint16_t fps = (uint16_t)std::atoi(argv[4]);
+    uint32_t key_interval = argc > 5 ? (uint32_t)std::atoi(argv[5]) : fps;
+
+    if (width == 0 || height == 0 || fps == 0) {
+        std::cerr << "bad dimensions or frame rate" << std::endl;
+        return false;
+    }
+
+    // A key frame interval of 0 selects uncompressed frames.
+    show_codec_t codec = key_interval == 0 ? SHOW_CODEC_RAW : SHOW_CODEC_RLE;
+
+    if (key_interval == 0) {
+        key_interval = 1;
+    }
+
+    show_writer writer{width, height, fps, SHOW_FORMAT_RGB, codec,
+            key_interval};
+
+    std::vector<uint8_t> in;
+
+    if (!read_file(argv[0], in)) {
+        return false;
+    }
+
+    size_t frame_sz = writer.frame_size();
+
+    if (in.empty() || in.size() % frame_sz != 0) {
+        std::cerr << argv[0] << ": size isn't a multiple of " << frame_sz <<
+                " bytes" << std::endl;
+        return false;
+    }
+
+    for (size_t off = 0; off < in.size(); off += frame_sz) {
+        writer.add_frame(in.data() + off);
+    }
+
+    const std::vector<uint8_t> out = writer.finish();
+
+    std::cout << writer.frame_count() << " frame(s), " << in.size() <<
+            " -> " << out.size() << " bytes" << std::endl;
+
+    return write_file(argv[1], out);
+}
+
+bool run_show_check(int argc, char *argv[])
+{
+    if (argc != 1) {
+        std::cerr << "usage: show-check in.show" << std::endl;
+        return false;
+    }
+
+    std::vector<uint8_t> data;
+
+    if (!read_file(argv[0], data)) {
+        return false;
+    }
+
+    show_t show;
+    show_result_t res = show_open(&show, data.data(), data.size());
+
+    if (res != SHOW_OK) {
+        std::cerr << argv[0] << ": " << show_result_str(res) << std::endl;
+        return false;
+    }
+
+    print_header(show.head);
+
+    std::vector<uint8_t> pixels(show.frame_sz);
+    res = show_check(&show, pixels.data());
+
+    if (res != SHOW_OK) {
+        std::cerr << argv[0] << ": " << show_result_str(res) << std::endl;
+        return false;
+    }
+
+    if (!check_seeks(&show)) {
+        std::cerr << argv[0] << ": seek mismatch" << std::endl;
+        return false;
+    }
+
+    std::cout << "ok" << std::endl;
+    return true;
+}
+
+// Pre-encode a show, so that the controllers only copy samples, see
+// SHOW_FORMAT_WAVE. Then check that the result outputs the exact same samples
+// as the original.
+bool run_show_wave(int argc, char *argv[])
+{
+    if (argc != 2) {
+        std::cerr << "usage: show-wave in.show out.show" << std::endl;
+        return false;
+    }
+
+    std::vector<uint8_t> in;
+
+    if (!read_file(argv[0], in)) {
+        return false;
+    }
+
+    show_t show;
+    show_result_t res = show_open(&show, in.data(), in.size());
+
+    if (res != SHOW_OK) {
+        std::cerr << argv[0] << ": " << show_result_str(res) << std::endl;
+        return false;
+    }
+
+    const show_header_t *head = show.head;
+    size_t n_pixels = (size_t)head->width * head->height;
+
+    if (head->format != SHOW_FORMAT_RGB || n_pixels % SHOW_WAVE_LANES != 0) {
+        std::cerr << argv[0] << ": need RGB pixels, a multiple of " <<
+                SHOW_WAVE_LANES << std::endl;
+        return false;
+    }
+
+    // Keep the coding of the original show.
+
+    show_writer writer{head->width, head->height, head->fps,
+            SHOW_FORMAT_WAVE, (show_codec_t)head->codec, head->key_interval};
+
+    std::vector<uint8_t> pixels(show.frame_sz);
+    std::vector<uint8_t> masks(show.frame_sz);
+    const uint8_t *lanes[SHOW_WAVE_LANES];
+
+    get_lanes(pixels.data(), n_pixels, lanes);
+
+    for (uint32_t i = 0; i < head->n_frames; ++i) {
+        if (!show_apply(&show, i, pixels.data())) {
+            std::cerr << argv[0] << ": bad frame " << i << std::endl;
+            return false;
+        }
+
+        encode_masks(lanes, SHOW_WAVE_LANES, 0, n_pixels / SHOW_WAVE_LANES,
+                masks.data());
+        writer.add_frame(masks.data());
+    }
+
+    const std::vector<uint8_t> out = writer.finish();
+
+    std::cout << writer.frame_count() << " frame(s), " << in.size() <<
+            " -> " << out.size() << " bytes" << std::endl;
+
+    show_t wave;
+    res = show_open(&wave, out.data(), out.size());
+
+    if (res != SHOW_OK || !check_wave(&show, &wave)) {
+        std::cerr << argv[1] << ": samples don't match" << std::endl;
+        return false;
+    }
+
+    return write_file(argv[1], out);
+}
+
+// --- Helpers -----------------------------------------------------------------
+
+static void print_header(const show_header_t *head)
+{
+    static const char *const formats[] = { "rgb", "rgbw", "wave" };
+    static const char *const codecs[] = { "raw", "rle" };
+
+    std::cout <<
+            "size     " << head->width << "x" << head->height << std::endl <<
+            "format   " << formats[head->format] << std::endl <<
+            "codec    " << codecs[head->codec] << std::endl <<
+            "fps      " << head->fps << std::endl <<
+            "frames   " << head->n_frames << std::endl <<
+            "key      " << head->key_interval << std::endl <<
+            "data     " << head->data_sz << " bytes" << std::endl;
+}
+
+static bool check_seeks(const show_t *show)
+{
+    // Decode sequentially and remember each frame's CRC. Then seek around
+    // randomly and compare.
+
+    const uint32_t n_frames = show->head->n_frames;
+    std::vector<uint8_t> pixels(show->frame_sz);
+    std::vector<uint32_t> crcs;
+
+    for (uint32_t i = 0; i < n_frames; ++i) {
+        if (!show_apply(show, i, pixels.data())) {
+            return false;
+        }
+
+        crcs.push_back(crc_32(CRC_INIT, pixels.data(), pixels.size()));
+    }
+
+    std::mt19937 gen{1972};
+    std::uniform_int_distribution<uint32_t> dist{0, n_frames - 1};
+    uint32_t cur_id = SHOW_NO_FRAME;
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (int32_t i = 0; i < N_SEEKS; ++i) {
+        uint32_t frame_id = dist(gen);
+
+        if (!show_decode(show, frame_id, cur_id, pixels.data()) ||
+                crc_32(CRC_INIT, pixels.data(), pixels.size()) !=
+                crcs[frame_id]) {
+            return false;
+        }
+
+        cur_id = frame_id;
+    }
+
+    auto end = std::chrono::steady_clock::now();
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+            end - start);
+
+    std::cout << "seek     " << (double)us.count() / N_SEEKS << " us" <<
+            std::endl;
+
+    return true;
+}
+
+// Compare the samples of all frames of a show and of its pre-encoded version.
+// Also time how long getting them takes per frame, from the decoded frames.
+static bool check_wave(const show_t *show, const show_t *wave)
+{
+    size_t n_pixels = show->frame_sz / 3;
+    size_t n_samples = n_pixels / SHOW_WAVE_LANES * ENCODE_SAMPLES_PER_PIXEL;
+
+    std::vector<uint8_t> pixels(show->frame_sz);
+    std::vector<uint8_t> masks(wave->frame_sz);
+    std::vector<uint16_t> expected(n_samples);
+    std::vector<uint16_t> samples(n_samples);
+    const uint8_t *lanes[SHOW_WAVE_LANES];
+
+    get_lanes(pixels.data(), n_pixels, lanes);
+
+    std::chrono::steady_clock::duration encode{}, copy{};
+
+    for (uint32_t i = 0; i < show->head->n_frames; ++i) {
+        if (!show_apply(show, i, pixels.data()) ||
+                !show_apply(wave, i, masks.data())) {
+            return false;
+        }
+
+        auto t0 = std::chrono::steady_clock::now();
+        encode_pixels(lanes, SHOW_WAVE_LANES, 0, n_pixels / SHOW_WAVE_LANES,
+                expected.data());
+        auto t1 = std::chrono::steady_clock::now();
+        encode_wave(masks.data(), SHOW_WAVE_LANES, 0,
+                n_pixels / SHOW_WAVE_LANES, samples.data());
+        auto t2 = std::chrono::steady_clock::now();
+
+        encode += t1 - t0;
+        copy += t2 - t1;
+
+        if (memcmp(expected.data(), samples.data(),
+                n_samples * sizeof (uint16_t)) != 0) {
+            return false;
+        }
+    }
+
+    auto per_frame = [&](std::chrono::steady_clock::duration d) {
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(d);
+        return (double)us.count() / show->head->n_frames;
+    };
+
+    std::cout << "encode   " << per_frame(encode) << " us/frame" << std::endl <<
+            "wave     " << per_frame(copy) << " us/frame" << std::endl;
+
+    return true;
+}
+
+// Split a frame into lanes like the controllers do, see panel_render().
+static void get_lanes(const uint8_t *data, size_t n_pixels,
+        const uint8_t *lanes[SHOW_WAVE_LANES])
+{
+    size_t lane_pixels = n_pixels / SHOW_WAVE_LANES;
+
+    for (size_t i = 0; i < SHOW_WAVE_LANES; ++i) {
+        lanes[i] = data + i * lane_pixels * 3;
+    }
+}
@@ -0,0 +1,177 @@
+// show_writer.cpp
+//
+// Copyright (C) 2020 by the contributors
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+
+// --- Includes ----------------------------------------------------------------
+
+#include "show_writer.h"
+
+#include <crc.h>
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// --- Types -------------------------------------------------------------------
+
+// --- Constants and macros ----------------------------------------------------
+
+#define MAX_LITERAL 128
+#define MIN_REPEAT 3
+#define MAX_REPEAT 129
+
+// --- Globals -----------------------------------------------------------------
+
+// --- Helper declarations -----------------------------------------------------
+
+static size_t repeat_length(const uint8_t *in, size_t sz);
+
+// --- API ---------------------------------------------------------------------
+
+show_writer::show_writer(uint16_t width, uint16_t height, uint16_t fps,
+        show_format_t format, show_codec_t codec, uint32_t key_interval)
+{
+    assert(width > 0 && height > 0 && fps > 0);
+    assert(key_interval > 0);
+    assert(codec != SHOW_CODEC_RAW || key_interval == 1);
+
+    memset(&head_, 0, sizeof head_);
+
+    head_.magic = SHOW_MAGIC;
+    head_.version = SHOW_VERSION;
+    head_.header_sz = sizeof head_;
+    head_.width = width;
+    head_.height = height;
+    head_.fps = fps;
+    head_.format = (uint8_t)format;
+    head_.codec = (uint8_t)codec;
+    head_.key_interval = key_interval;
+
+    frame_sz_ = (size_t)width * height * show_pixel_sz((uint8_t)format);
+    assert(frame_sz_ > 0);
+
+    prev_.resize(frame_sz_);
+}
+
+void show_writer::add_frame(const uint8_t *pixels)
+{
+    uint32_t frame_id = (uint32_t)index_.size();
+    size_t off = data_.size();
+
+    if (head_.codec == SHOW_CODEC_RAW) {
+        data_.insert(data_.end(), pixels, pixels + frame_sz_);
+    }
+    else if (frame_id % head_.key_interval == 0) {
+        run_length_encode(pixels, frame_sz_, data_);
+    }
+    else {
+        for (size_t i = 0; i < frame_sz_; ++i) {
+            prev_[i] ^= pixels[i];
+        }
+
+        run_length_encode(prev_.data(), frame_sz_, data_);
+    }
+
+    memcpy(prev_.data(), pixels, frame_sz_);
+
+    show_index_t entry;
+
+    entry.off = (uint32_t)off;
+    entry.sz = (uint32_t)(data_.size() - off);
+
+    index_.push_back(entry);
+}
+
+std::vector<uint8_t> show_writer::finish() const
+{
+    assert(!index_.empty());
+
+    // The show is written in host byte order, which matches the ESP32.
+
+    show_header_t head = head_;
+    size_t index_sz = index_.size() * sizeof (show_index_t);
+
+    head.n_frames = (uint32_t)index_.size();
+    head.index_off = (uint32_t)sizeof head;
+    head.data_off = (uint32_t)(head.index_off + index_sz);
+    head.data_sz = (uint32_t)data_.size();
+
+    std::vector<uint8_t> out(head.data_off + head.data_sz);
+
+    memcpy(out.data() + head.index_off, index_.data(), index_sz);
+    memcpy(out.data() + head.data_off, data_.data(), data_.size());
+
+    head.crc = crc_32(CRC_INIT, out.data() + head.index_off,
+            out.size() - head.index_off);
+
+    memcpy(out.data(), &head, sizeof head);
+    return out;
+}
+
+void run_length_encode(const uint8_t *in, size_t sz, std::vector<uint8_t> &out)
+{
+    size_t lit_start = 0;
+    size_t i = 0;
+
+    auto flush_literals = [&](size_t end) {
+        while (lit_start < end) {
+            size_t len = end - lit_start;
+
+            if (len > MAX_LITERAL) {
+                len = MAX_LITERAL;
+            }
+
+            out.push_back((uint8_t)(len - 1));
+            out.insert(out.end(), in + lit_start, in + lit_start + len);
+
+            lit_start += len;
+        }
+    };
+
+    while (i < sz) {
+        size_t len = repeat_length(in + i, sz - i);
+
+        if (len < MIN_REPEAT) {
+            ++i;
+            continue;
+        }
+
+        flush_literals(i);
+
+        out.push_back((uint8_t)(0x80 + len - 2));
+        out.push_back(in[i]);
+
+        i += len;
+        lit_start = i;
+    }
+
+    flush_literals(sz);
+}
+
+// --- Helpers -----------------------------------------------------------------
+
+static size_t repeat_length(const uint8_t *in, size_t sz)
+{
+    size_t len = 1;
+
+    while (len < sz && len < MAX_REPEAT && in[len] == in[0]) {
+        ++len;
+    }
+
+    return len;
+}
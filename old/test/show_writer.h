@@ -0,0 +1,59 @@
+// show_writer.h
+//
+// Copyright (C) 2020 by the contributors
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+// --- Includes ----------------------------------------------------------------
+
+#include <show.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// --- Types -------------------------------------------------------------------
+
+// Builds a show container in memory, one frame at a time. See show.h for the
+// format.
+class show_writer {
+public:
+    show_writer(uint16_t width, uint16_t height, uint16_t fps,
+            show_format_t format, show_codec_t codec, uint32_t key_interval);
+
+    size_t frame_size() const { return frame_sz_; }
+    uint32_t frame_count() const { return (uint32_t)index_.size(); }
+
+    void add_frame(const uint8_t *pixels);
+    std::vector<uint8_t> finish() const;
+
+private:
+    show_header_t head_;
+    size_t frame_sz_;
+
+    std::vector<show_index_t> index_;
+    std::vector<uint8_t> data_;
+    std::vector<uint8_t> prev_;
+};
+
+// --- Constants and macros ----------------------------------------------------
+
+// --- Globals -----------------------------------------------------------------
+
+// --- API ---------------------------------------------------------------------
+
+// Append the run-length coding of the given bytes to out.
+void run_length_encode(const uint8_t *in, size_t sz, std::vector<uint8_t> &out);
@@ -0,0 +1,865 @@
+// sim_tool.cpp
+//
+// Copyright (C) 2020 by the contributors
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+
+// --- Includes ----------------------------------------------------------------
+
+#include "test.h"
+
+#include <crc.h>
+#include <jitter.h>
+#include <proto.h>
+#include <reply.h>
+#include <show.h>
+#include <xfer.h>
+
+#include <arpa/inet.h>
+#include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <netinet/in.h>
+#include <queue>
+#include <random>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+// --- Types -------------------------------------------------------------------
+
+struct sim_ctrl;
+
+// What a socket is for. Broadcast sockets belong to no controller and fan
+// out to all of them.
+enum sim_endpoint_kind {
+    EP_COMMAND,
+    EP_STREAM,
+    EP_LISTEN,
+    EP_UPLOAD
+};
+
+struct sim_endpoint {
+    sim_ctrl *ctrl;
+    sim_endpoint_kind kind;
+    int sock;
+};
+
+// A virtual controller. It speaks the controller side of the protocol, see
+// proto.h, with memory instead of flash and without a panel. Streamed frames
+// go through the firmware's jitter buffer and are played out on time.
+struct sim_ctrl {
+    uint32_t ip = 0;
+    bool leader = false;
+    sim_endpoint eps[4];
+
+    // Upload in progress, or the last one. Kept across connections, so that
+    // uploads resume, like on a real controller.
+    std::vector<uint8_t> in;
+    bool begun = false;
+    std::vector<uint8_t> flash;
+    xfer_t xfer = {};
+
+    // Stream.
+    jitter_t jitter;
+    std::vector<uint8_t> mem;
+    std::vector<uint8_t> frame;
+    bool started = false;
+    uint32_t frame_sz = 0;
+    uint32_t n_parity = 0;
+    int64_t last_part = 0;
+
+    cue_t cue = {};
+    uint32_t n_frames = 0;
+    reply_window_t window = {};
+};
+
+// Something to do later, i.e., a message still on its way.
+struct sim_pending {
+    int64_t due;
+    uint64_t order;
+    std::function<void()> what;
+
+    bool operator<(const sim_pending &other) const
+    {
+        return due != other.due ? due > other.due : order > other.order;
+    }
+};
+
+// Totals, for the summary at the end.
+struct sim_counts {
+    uint64_t n_received = 0;
+    uint64_t n_dropped = 0;
+    uint64_t n_pings = 0;
+    uint64_t n_syncs = 0;
+    uint64_t n_cues = 0;
+    uint64_t n_stats = 0;
+    uint64_t n_parts = 0;
+    uint64_t n_frames = 0;
+    uint64_t n_uploads = 0;
+};
+
+// --- Constants and macros ----------------------------------------------------
+
+// Virtual controllers are at 127.1.0.1 and up. Broadcasts to 127.255.255.255
+// reach all of them.
+#define SIM_BASE_IP 0x7f010001u
+#define SIM_BROADCAST_IP "127.255.255.255"
+#define SIM_MAX_COUNT 60000
+
+// Like the show partition, see partitions.csv. Larger uploads are refused.
+#define SIM_MAX_UPLOAD 0x2f0000
+
+// Like stream.c.
+#define STREAM_TIMEOUT 1000000
+#define STREAM_DELAY 50000
+#define MIN_DELAY 10000
+#define MAX_DELAY 250000
+
+// Play out due frames this often.
+#define TICK_US 2000
+
+#define MAX_EVENTS 256
+
+// --- Globals -----------------------------------------------------------------
+
+// --- Helper declarations -----------------------------------------------------
+
+class simulator {
+public:
+    simulator(int64_t latency, double loss);
+
+    bool add(uint32_t ip, bool leader);
+    bool add_broadcast();
+    void run(int64_t until);
+    void print_summary() const;
+
+private:
+    void on_datagram(sim_endpoint &ep);
+    void on_accept(sim_endpoint &ep);
+    void on_upload(sim_endpoint &ep);
+    void deliver(const sim_endpoint &ep, const std::vector<uint8_t> &msg,
+            const sockaddr_in &from);
+    void handle_command(sim_ctrl &c, const std::vector<uint8_t> &msg,
+            const sockaddr_in &from);
+    void handle_part(sim_ctrl &c, const std::vector<uint8_t> &msg);
+    bool handle_upload(sim_ctrl &c, int sock);
+    void reply(sim_ctrl &c, const void *data, size_t sz,
+            const sockaddr_in &to);
+    void play(int64_t now);
+    void later(int64_t delay, std::function<void()> what);
+    bool watch(sim_endpoint &ep);
+
+    int epoll_;
+    int64_t latency_;
+    double loss_;
+    std::mt19937 rng_{1972};
+    std::uniform_real_distribution<double> unit_{0.0, 1.0};
+    std::priority_queue<sim_pending> pending_;
+    uint64_t order_ = 0;
+    int64_t start_;
+    std::vector<std::unique_ptr<sim_ctrl>> ctrls_;
+    sim_endpoint broadcast_[2];
+    sim_counts counts_;
+};
+
+static int open_udp(uint32_t ip, uint16_t port);
+static int open_tcp(uint32_t ip, uint16_t port);
+static void set_non_blocking(int sock);
+static std::string ip_str(uint32_t ip);
+static int64_t get_us();
+
+// --- API ---------------------------------------------------------------------
+
+// Run count virtual controllers in one process, for load testing the host
+// tools at installation scale. latency is added to every UDP message, half
+// on the way in, half on the way out. loss is the chance of an incoming UDP
+// message being dropped.
+bool run_sim(int argc, char *argv[])
+{
+    if (argc < 1 || argc > 4) {
+        std::cerr << "usage: test sim count [latency-ms] [loss-%] " <<
+                "[seconds]" << std::endl;
+        return false;
+    }
+
+    int64_t count = std::atoi(argv[0]);
+    int64_t latency = argc > 1 ? (int64_t)(std::atof(argv[1]) * 1000.0) : 0;
+    double loss = argc > 2 ? std::atof(argv[2]) / 100.0 : 0.0;
+    int64_t seconds = argc > 3 ? std::atoi(argv[3]) : 0;
+
+    if (count < 1 || count > SIM_MAX_COUNT || latency < 0 || loss < 0.0 ||
+            loss >= 1.0) {
+        std::cerr << "need 1 to " << SIM_MAX_COUNT << " controllers, " <<
+                "latency >= 0, loss in [0, 100)" << std::endl;
+        return false;
+    }
+
+    // Three sockets per controller, plus upload connections.
+
+    rlimit lim;
+
+    if (getrlimit(RLIMIT_NOFILE, &lim) == 0 && lim.rlim_cur < lim.rlim_max) {
+        lim.rlim_cur = lim.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &lim);
+    }
+
+    simulator sim{latency, loss};
+
+    for (int64_t i = 0; i < count; ++i) {
+        if (!sim.add(SIM_BASE_IP + (uint32_t)i, i == 0)) {
+            return false;
+        }
+    }
+
+    if (!sim.add_broadcast()) {
+        return false;
+    }
+
+    std::cout << count << " virtual controller(s) at " <<
+            ip_str(SIM_BASE_IP) << " to " <<
+            ip_str(SIM_BASE_IP + (uint32_t)count - 1) << ", leader " <<
+            ip_str(SIM_BASE_IP) << std::endl;
+    std::cout << "for broadcasts, set NN_BROADCAST=" << SIM_BROADCAST_IP <<
+            std::endl;
+
+    sim.run(seconds > 0 ? get_us() + seconds * 1000000 : INT64_MAX);
+    sim.print_summary();
+
+    return true;
+}
+
+// --- Helpers -----------------------------------------------------------------
+
+simulator::simulator(int64_t latency, double loss) :
+    latency_{latency},
+    loss_{loss},
+    start_{get_us()}
+{
+    epoll_ = epoll_create1(0);
+    assert(epoll_ >= 0);
+}
+
+bool simulator::add(uint32_t ip, bool leader)
+{
+    std::unique_ptr<sim_ctrl> c{new sim_ctrl};
+
+    c->ip = ip;
+    c->leader = leader;
+    reply_init_window(&c->window, get_us());
+
+    int socks[] = {
+        open_udp(ip, PROTO_UDP_PORT),
+        open_udp(ip, PROTO_STREAM_PORT),
+        open_tcp(ip, PROTO_TCP_PORT),
+        -1
+    };
+
+    static const sim_endpoint_kind kinds[] = {
+        EP_COMMAND, EP_STREAM, EP_LISTEN, EP_UPLOAD
+    };
+
+    for (size_t i = 0; i < 4; ++i) {
+        c->eps[i] = { c.get(), kinds[i], socks[i] };
+
+        if (i < 3 && (socks[i] < 0 || !watch(c->eps[i]))) {
+            std::cerr << ip_str(ip) << ": cannot listen" << std::endl;
+            return false;
+        }
+    }
+
+    ctrls_.push_back(std::move(c));
+    return true;
+}
+
+bool simulator::add_broadcast()
+{
+    uint32_t ip = ntohl(inet_addr(SIM_BROADCAST_IP));
+
+    broadcast_[0] = { nullptr, EP_COMMAND, open_udp(ip, PROTO_UDP_PORT) };
+    broadcast_[1] = { nullptr, EP_STREAM, open_udp(ip, PROTO_STREAM_PORT) };
+
+    for (sim_endpoint &ep : broadcast_) {
+        if (ep.sock < 0 || !watch(ep)) {
+            std::cerr << SIM_BROADCAST_IP << ": cannot listen" << std::endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void simulator::run(int64_t until)
+{
+    int64_t next_tick = get_us();
+
+    while (true) {
+        int64_t now = get_us();
+
+        if (now >= until) {
+            break;
+        }
+
+        while (!pending_.empty() && pending_.top().due <= now) {
+            // Copy, as what() may add more.
+            std::function<void()> what = pending_.top().what;
+            pending_.pop();
+            what();
+        }
+
+        if (now >= next_tick) {
+            play(now);
+            next_tick = now + TICK_US;
+        }
+
+        int64_t wake = std::min(next_tick, until);
+
+        if (!pending_.empty() && pending_.top().due < wake) {
+            wake = pending_.top().due;
+        }
+
+        int timeout = (int)std::max<int64_t>((wake - get_us() + 999) / 1000,
+                0);
+
+        epoll_event events[MAX_EVENTS];
+        int n = epoll_wait(epoll_, events, MAX_EVENTS, timeout);
+
+        for (int i = 0; i < n; ++i) {
+            sim_endpoint &ep = *(sim_endpoint *)events[i].data.ptr;
+
+            switch (ep.kind) {
+            case EP_COMMAND:
+            case EP_STREAM:
+                on_datagram(ep);
+                break;
+
+            case EP_LISTEN:
+                on_accept(ep);
+                break;
+
+            case EP_UPLOAD:
+                on_upload(ep);
+                break;
+            }
+        }
+    }
+}
+
+void simulator::print_summary() const
+{
+    std::cout << "received " << counts_.n_received << " message(s), " <<
+            "dropped " << counts_.n_dropped << std::endl;
+    std::cout << "pings " << counts_.n_pings << ", syncs " <<
+            counts_.n_syncs << ", cues " << counts_.n_cues << ", stats " <<
+            counts_.n_stats << std::endl;
+    std::cout << "stream parts " << counts_.n_parts << ", frames played " <<
+            counts_.n_frames << ", uploads completed " <<
+            counts_.n_uploads << std::endl;
+}
+
+// Read all waiting datagrams. Each one is, maybe, lost, and otherwise arrives
+// latency / 2 later.
+void simulator::on_datagram(sim_endpoint &ep)
+{
+    while (true) {
+        std::vector<uint8_t> msg(sizeof (frame_part_t) + STREAM_PART_SZ);
+        sockaddr_in from;
+        socklen_t from_len = sizeof from;
+
+        ssize_t len = recvfrom(ep.sock, msg.data(), msg.size(), 0,
+                (sockaddr *)&from, &from_len);
+
+        if (len < 0) {
+            break;
+        }
+
+        msg.resize((size_t)len);
+
+        if (ep.ctrl != nullptr) {
+            deliver(ep, msg, from);
+            continue;
+        }
+
+        for (auto &c : ctrls_) {
+            deliver(c->eps[ep.kind], msg, from);
+        }
+    }
+}
+
+void simulator::on_accept(sim_endpoint &ep)
+{
+    sim_ctrl &c = *ep.ctrl;
+
+    while (true) {
+        int sock = accept(ep.sock, nullptr, nullptr);
+
+        if (sock < 0) {
+            break;
+        }
+
+        // Like the firmware, one upload at a time. A new connection replaces
+        // the old one.
+
+        if (c.eps[EP_UPLOAD].sock >= 0) {
+            close(c.eps[EP_UPLOAD].sock);
+        }
+
+        set_non_blocking(sock);
+
+        c.eps[EP_UPLOAD].sock = sock;
+        c.in.clear();
+        c.begun = false;
+
+        if (!watch(c.eps[EP_UPLOAD])) {
+            close(sock);
+            c.eps[EP_UPLOAD].sock = -1;
+        }
+    }
+}
+
+void simulator::on_upload(sim_endpoint &ep)
+{
+    sim_ctrl &c = *ep.ctrl;
+
+    if (!handle_upload(c, ep.sock)) {
+        close(ep.sock);
+        ep.sock = -1;
+    }
+}
+
+void simulator::deliver(const sim_endpoint &ep,
+        const std::vector<uint8_t> &msg, const sockaddr_in &from)
+{
+    ++counts_.n_received;
+
+    if (unit_(rng_) < loss_) {
+        ++counts_.n_dropped;
+        return;
+    }
+
+    sim_ctrl *c = ep.ctrl;
+    bool stream = ep.kind == EP_STREAM;
+
+    later(latency_ / 2, [this, c, stream, msg, from]() {
+        if (stream) {
+            handle_part(*c, msg);
+        }
+        else {
+            handle_command(*c, msg, from);
+        }
+    });
+}
+
+void simulator::handle_command(sim_ctrl &c, const std::vector<uint8_t> &msg,
+        const sockaddr_in &from)
+{
+    if (msg.empty()) {
+        return;
+    }
+
+    int64_t now = get_us();
+
+    switch (msg[0]) {
+    case COMMAND_PING: {
+        ping_reply_t rep;
+
+        if (!reply_ping(msg.data(), msg.size(), c.leader, &rep)) {
+            break;
+        }
+
+        // Replies aren't held, as the simulator has no radio to share.
+
+        ++counts_.n_pings;
+        reply(c, &rep, sizeof rep, from);
+        break;
+    }
+
+    case COMMAND_SYNC: {
+        if (msg.size() != sizeof (sync_request_t)) {
+            break;
+        }
+
+        ++counts_.n_syncs;
+
+        sync_request_t req;
+        memcpy(&req, msg.data(), sizeof req);
+
+        // The show clock is the host's monotonic clock, which the tools use,
+        // too. Only the leader answers.
+
+        sync_reply_t rep = {};
+        rep.command = COMMAND_SYNC;
+        rep.result = c.leader ? RESULT_OK : RESULT_NOT_MASTER;
+        rep.seq = req.seq;
+        rep.t1 = req.t1;
+
+        if (c.leader) {
+            rep.t2 = now;
+            rep.t3 = get_us();
+        }
+
+        reply(c, &rep, sizeof rep, from);
+        break;
+    }
+
+    case COMMAND_START:
+    case COMMAND_STOP:
+    case COMMAND_RENDER_FRAME:
+        if (msg.size() == sizeof (cue_t)) {
+            ++counts_.n_cues;
+            memcpy(&c.cue, msg.data(), sizeof c.cue);
+        }
+
+        break;
+
+    case COMMAND_STATS: {
+        stats_reply_t rep;
+
+        if (!reply_stats(msg.size(), &c.window, now,
+                    c.started ? &c.jitter.stats : nullptr, &rep)) {
+            break;
+        }
+
+        ++counts_.n_stats;
+
+        rep.rssi = c.leader ? 0 : -50;
+        rep.uptime_ms = (uint32_t)((now - start_) / 1000);
+        rep.n_frames = c.n_frames;
+
+        reply(c, &rep, sizeof rep, from);
+        break;
+    }
+
+    default:
+        break;
+    }
+}
+
+// Like receive() in stream.c.
+void simulator::handle_part(sim_ctrl &c, const std::vector<uint8_t> &msg)
+{
+    frame_part_t head;
+
+    if (msg.size() < sizeof head) {
+        return;
+    }
+
+    memcpy(&head, msg.data(), sizeof head);
+
+    uint32_t n_parts = (head.frame_sz + STREAM_PART_SZ - 1) / STREAM_PART_SZ;
+
+    if (head.command != COMMAND_FRAME_DATA || head.frame_sz == 0 ||
+            head.frame_sz % 3 != 0 || n_parts > JITTER_MAX_PARTS ||
+            head.n_parts != n_parts || head.n_parity > JITTER_MAX_PARITY ||
+            head.n_parity > n_parts) {
+        return;
+    }
+
+    ++counts_.n_parts;
+
+    int64_t now = get_us();
+
+    if (!c.started || now - c.last_part >= STREAM_TIMEOUT ||
+            head.frame_sz != c.frame_sz || head.n_parity != c.n_parity) {
+        c.frame_sz = head.frame_sz;
+        c.n_parity = head.n_parity;
+        c.mem.resize(jitter_mem_sz(c.frame_sz, STREAM_PART_SZ, c.n_parity));
+        c.frame.assign(c.frame_sz, 0);
+
+        jitter_init(&c.jitter, c.mem.data(), c.frame_sz, STREAM_PART_SZ,
+                c.n_parity, MIN_DELAY, MAX_DELAY);
+        jitter_set_delay(&c.jitter, STREAM_DELAY);
+        c.started = true;
+    }
+
+    c.last_part = now;
+
+    jitter_put(&c.jitter, head.frame_id, head.at, head.part,
+            msg.data() + sizeof head, msg.size() - sizeof head, now);
+}
+
+// Like handle_connection() in upload.c, but driven by readiness. Returns
+// false, when the connection should be closed.
+bool simulator::handle_upload(sim_ctrl &c, int sock)
+{
+    uint8_t buf[UPLOAD_CHUNK_SZ];
+
+    while (true) {
+        ssize_t len = recv(sock, buf, sizeof buf, 0);
+
+        if (len == 0) {
+            return false;
+        }
+
+        if (len < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                return false;
+            }
+
+            break;
+        }
+
+        c.in.insert(c.in.end(), buf, buf + len);
+    }
+
+    size_t used = 0;
+    upload_ack_t ack = {};
+
+    while (true) {
+        size_t avail = c.in.size() - used;
+
+        if (!c.begun) {
+            upload_begin_t begin;
+
+            if (avail < sizeof begin) {
+                break;
+            }
+
+            memcpy(&begin, c.in.data() + used, sizeof begin);
+            used += sizeof begin;
+
+            if (begin.command != COMMAND_UPLOAD) {
+                return false;
+            }
+
+            // Like a controller's flash, memory only holds so much. Anything
+            // else starts over.
+
+            bool same = xfer_same(&c.xfer.progress, &begin);
+            result_t res = xfer_begin(&c.xfer, &begin, SIM_MAX_UPLOAD,
+                    &c.xfer.progress);
+
+            if (res != RESULT_OK) {
+                xfer_ack(&ack, res, 0);
+                send(sock, &ack, sizeof ack, MSG_NOSIGNAL);
+                return false;
+            }
+
+            if (!same) {
+                c.flash.assign(c.xfer.progress.total_sz, 0xff);
+            }
+
+            c.begun = true;
+            xfer_ack(&ack, RESULT_OK, c.xfer.expect);
+        }
+        else {
+            upload_chunk_t head;
+
+            if (avail < sizeof head) {
+                break;
+            }
+
+            memcpy(&head, c.in.data() + used, sizeof head);
+
+            if (!xfer_check(&c.xfer, &head)) {
+                return false;
+            }
+
+            if (avail < sizeof head + head.sz) {
+                break;
+            }
+
+            const uint8_t *data = c.in.data() + used + sizeof head;
+            used += sizeof head + head.sz;
+
+            xfer_action_t action = xfer_take(&c.xfer, &head, data);
+
+            if (action == XFER_SKIP) {
+                continue;
+            }
+
+            if (action == XFER_RESEND) {
+                xfer_ack(&ack, RESULT_BAD_CRC, c.xfer.expect);
+            }
+            else {
+                memcpy(c.flash.data() + head.offset, data, head.sz);
+                result_t res = RESULT_OK;
+
+                if (xfer_stored(&c.xfer, head.offset, head.sz)) {
+                    show_t show;
+                    bool ok = crc_32(CRC_INIT, c.flash.data(),
+                            c.flash.size()) == c.xfer.progress.crc &&
+                            show_open(&show, c.flash.data(),
+                            c.flash.size()) == SHOW_OK;
+
+                    res = ok ? RESULT_OK : RESULT_BAD_SHOW;
+                    counts_.n_uploads += ok ? 1 : 0;
+                }
+
+                xfer_ack(&ack, res, c.xfer.progress.offset);
+            }
+        }
+
+        // Acknowledgements are tiny. If the socket buffer is full, the host
+        // isn't reading them and the upload is broken anyway.
+
+        if (send(sock, &ack, sizeof ack, MSG_NOSIGNAL) != sizeof ack) {
+            return false;
+        }
+    }
+
+    c.in.erase(c.in.begin(), c.in.begin() + (ptrdiff_t)used);
+    return true;
+}
+
+// Send a reply from the controller's command socket, latency / 2 from now.
+void simulator::reply(sim_ctrl &c, const void *data, size_t sz,
+        const sockaddr_in &to)
+{
+    const uint8_t *data_8 = (const uint8_t *)data;
+    std::vector<uint8_t> msg{data_8, data_8 + sz};
+    int sock = c.eps[EP_COMMAND].sock;
+
+    later(latency_ / 2, [sock, msg, to]() {
+        sendto(sock, msg.data(), msg.size(), 0, (const sockaddr *)&to,
+                sizeof to);
+    });
+}
+
+// Play out the frames that are due, like play_stream() in control.c.
+void simulator::play(int64_t now)
+{
+    for (auto &p : ctrls_) {
+        sim_ctrl &c = *p;
+
+        if (!c.started) {
+            continue;
+        }
+
+        int64_t due;
+
+        while (jitter_next(&c.jitter, &due) && due <= now) {
+            if (!jitter_play(&c.jitter, now, c.frame.data())) {
+                break;
+            }
+
+            // There's no panel, so frames are out as soon as they're
+            // published.
+
+            int64_t at = c.jitter.last_at;
+            int64_t stages[LATENCY_N_STAGES] = {
+                c.jitter.last_received - at, c.jitter.last_completed - at,
+                now - at, now - at, now - at
+            };
+
+            reply_add_latency(&c.window, now, now - at);
+            reply_add_stages(&c.window, now, stages);
+
+            ++c.n_frames;
+            ++counts_.n_frames;
+        }
+    }
+}
+
+void simulator::later(int64_t delay, std::function<void()> what)
+{
+    if (delay <= 0) {
+        what();
+        return;
+    }
+
+    pending_.push({ get_us() + delay, order_++, std::move(what) });
+}
+
+bool simulator::watch(sim_endpoint &ep)
+{
+    epoll_event event = {};
+
+    event.events = EPOLLIN;
+    event.data.ptr = &ep;
+
+    return epoll_ctl(epoll_, EPOLL_CTL_ADD, ep.sock, &event) == 0;
+}
+
+static int open_udp(uint32_t ip, uint16_t port)
+{
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+
+    if (sock < 0) {
+        return -1;
+    }
+
+    sockaddr_in addr = {};
+
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(ip);
+
+    static const int32_t buf_sz = 1024 * 1024;
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &buf_sz, sizeof buf_sz);
+
+    if (bind(sock, (const sockaddr *)&addr, sizeof addr) < 0) {
+        close(sock);
+        return -1;
+    }
+
+    set_non_blocking(sock);
+    return sock;
+}
+
+static int open_tcp(uint32_t ip, uint16_t port)
+{
+    int sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+
+    if (sock < 0) {
+        return -1;
+    }
+
+    sockaddr_in addr = {};
+
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(ip);
+
+    static const int32_t one = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+
+    if (bind(sock, (const sockaddr *)&addr, sizeof addr) < 0 ||
+            listen(sock, 1) < 0) {
+        close(sock);
+        return -1;
+    }
+
+    set_non_blocking(sock);
+    return sock;
+}
+
+static void set_non_blocking(int sock)
+{
+    int flags = fcntl(sock, F_GETFL, 0);
+    int res = fcntl(sock, F_SETFL, flags | O_NONBLOCK);
+    assert(res == 0);
+}
+
+static std::string ip_str(uint32_t ip)
+{
+    in_addr addr = { htonl(ip) };
+    return inet_ntoa(addr);
+}
+
+static int64_t get_us()
+{
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::microseconds>(now).count();
+}
@@ -0,0 +1,425 @@
+// stats_tool.cpp
+//
+// Copyright (C) 2020 by the contributors
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+
+// --- Includes ----------------------------------------------------------------
+
+#include "test.h"
+
+#include <hist.h>
+#include <proto.h>
+
+#include <arpa/inet.h>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <netinet/in.h>
+#include <sstream>
+#include <string>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// --- Types -------------------------------------------------------------------
+
+// What we know about a controller: its latest reply and the one before.
+struct controller {
+    stats_reply_t last = {};
+    stats_reply_t prev = {};
+    bool have_prev = false;
+    bool fresh = false;
+};
+
+// --- Constants and macros ----------------------------------------------------
+
+#define REPLY_TIMEOUT 100
+#define MAX_ATTEMPTS 3
+
+// Poll the controllers this often, give them this long to reply.
+#define POLL_INTERVAL 1000
+#define POLL_WINDOW 300
+
+static_assert(PROFILE_N_BUCKETS == HIST_N_BUCKETS, "bucket mismatch");
+
+// --- Globals -----------------------------------------------------------------
+
+static const char *const g_probe_names[PROFILE_N_PROBES] = {
+    "encode", "dma-refill", "parse", "decompress", "publish"
+};
+
+// --- Helper declarations -----------------------------------------------------
+
+static bool get_profile(int sock, const sockaddr_in &addr, uint8_t probe,
+        bool reset, profile_reply_t &reply);
+static void print_histogram(const char *name, uint32_t core,
+        const uint32_t *counts, uint32_t cpu_mhz);
+static void poll(int sock, const std::vector<sockaddr_in> &addrs,
+        std::map<uint32_t, controller> &controllers);
+static void print_table(const std::map<uint32_t, controller> &controllers);
+static void print_stages(const std::map<uint32_t, controller> &controllers);
+static int open_socket(int64_t timeout);
+static bool parse_addr(const std::string &str, sockaddr_in &addr);
+static int64_t get_ms();
+
+// --- API ---------------------------------------------------------------------
+
+bool run_profile(int argc, char *argv[])
+{
+    if (argc < 1 || argc > 2 ||
+            (argc > 1 && std::string{argv[1]} != "reset")) {
+        std::cerr << "usage: test profile address [reset]" << std::endl;
+        return false;
+    }
+
+    sockaddr_in addr;
+
+    if (!parse_addr(argv[0], addr)) {
+        return false;
+    }
+
+    bool reset = argc > 1;
+    int sock = open_socket(REPLY_TIMEOUT);
+
+    std::cout << "probe      core    count      p50      p90      p99    p99.9"
+            "      max" << std::endl;
+    std::cout << "-------------------------------------------------------------"
+            "---------" << std::endl;
+
+    bool ok = true;
+
+    for (uint8_t probe = 0; probe < PROFILE_N_PROBES && ok; ++probe) {
+        profile_reply_t reply;
+        ok = get_profile(sock, addr, probe, reset, reply);
+
+        if (!ok) {
+            std::cerr << argv[0] << ": no profile reply" << std::endl;
+            break;
+        }
+
+        for (uint32_t core = 0; core < PROFILE_N_CORES; ++core) {
+            print_histogram(g_probe_names[probe], core, reply.counts[core],
+                    reply.cpu_mhz);
+        }
+    }
+
+    close(sock);
+
+    if (ok) {
+        std::cout << "(times in microseconds, upper bounds)" << std::endl;
+    }
+
+    return ok;
+}
+
+bool run_stats(int argc, char *argv[])
+{
+    if (argc < 1) {
+        std::cerr << "usage: test stats seconds [address...]" << std::endl;
+        return false;
+    }
+
+    int64_t seconds = std::atoi(argv[0]);
+
+    // Without addresses, broadcast.
+
+    std::vector<sockaddr_in> addrs(argc > 1 ? (size_t)argc - 1 : 1);
+
+    if (argc == 1) {
+        parse_addr(broadcast_ip(), addrs[0]);
+    }
+
+    for (int32_t i = 1; i < argc; ++i) {
+        if (!parse_addr(argv[i], addrs[(size_t)i - 1])) {
+            return false;
+        }
+    }
+
+    int sock = open_socket(POLL_WINDOW);
+    bool tty = isatty(STDOUT_FILENO) != 0;
+
+    std::map<uint32_t, controller> controllers;
+    int64_t end = get_ms() + seconds * 1000;
+
+    for (int64_t next = get_ms(); next < end; next += POLL_INTERVAL) {
+        std::this_thread::sleep_until(std::chrono::steady_clock::time_point{
+                std::chrono::milliseconds{next}});
+
+        poll(sock, addrs, controllers);
+
+        // Redraw in place, if we can.
+
+        if (tty) {
+            std::cout << "\033[H\033[2J";
+        }
+
+        print_table(controllers);
+    }
+
+    close(sock);
+
+    if (controllers.empty()) {
+        std::cerr << "no stats replies" << std::endl;
+    }
+
+    return !controllers.empty();
+}
+
+// --- Helpers -----------------------------------------------------------------
+
+static bool get_profile(int sock, const sockaddr_in &addr, uint8_t probe,
+        bool reset, profile_reply_t &reply)
+{
+    profile_request_t req = {};
+
+    req.command = COMMAND_PROFILE;
+    req.probe = probe;
+    req.reset = reset ? 1 : 0;
+
+    for (int32_t attempt = 0; attempt < MAX_ATTEMPTS; ++attempt) {
+        ssize_t len = sendto(sock, &req, sizeof req, 0,
+                (const sockaddr *)&addr, sizeof addr);
+
+        if (len != sizeof req) {
+            return false;
+        }
+
+        // Skip stray replies, e.g., late ones to an earlier attempt.
+
+        while (true) {
+            len = recv(sock, &reply, sizeof reply, 0);
+
+            if (len < 0) {
+                break;
+            }
+
+            if (len == sizeof reply && reply.command == COMMAND_PROFILE &&
+                    reply.probe == probe) {
+                return reply.result == RESULT_OK && reply.cpu_mhz > 0;
+            }
+        }
+    }
+
+    return false;
+}
+
+static void print_histogram(const char *name, uint32_t core,
+        const uint32_t *counts, uint32_t cpu_mhz)
+{
+    uint32_t total = hist_total(counts);
+
+    std::cout << std::left << std::setw(10) << name << std::right <<
+            std::setw(5) << core << std::setw(9) << total;
+
+    if (total == 0) {
+        std::cout << std::endl;
+        return;
+    }
+
+    static const uint32_t per_mille[] = { 500, 900, 990, 999, 1000 };
+
+    for (uint32_t pm : per_mille) {
+        double us = hist_percentile(counts, pm) / (double)cpu_mhz;
+
+        std::cout << std::setw(9) << std::fixed << std::setprecision(1) << us;
+    }
+
+    std::cout << std::endl;
+}
+
+// Ask all controllers at once, then collect the replies for a while.
+static void poll(int sock, const std::vector<sockaddr_in> &addrs,
+        std::map<uint32_t, controller> &controllers)
+{
+    for (auto &entry: controllers) {
+        entry.second.fresh = false;
+    }
+
+    uint8_t req = COMMAND_STATS;
+
+    for (auto &addr: addrs) {
+        sendto(sock, &req, sizeof req, 0, (const sockaddr *)&addr,
+                sizeof addr);
+    }
+
+    int64_t end = get_ms() + POLL_WINDOW;
+
+    while (get_ms() < end) {
+        stats_reply_t reply;
+        sockaddr_in addr;
+        socklen_t addr_len = sizeof addr;
+
+        ssize_t len = recvfrom(sock, &reply, sizeof reply, 0,
+                (sockaddr *)&addr, &addr_len);
+
+        if (len < 0) {
+            break;
+        }
+
+        if (len != sizeof reply || reply.command != COMMAND_STATS) {
+            continue;
+        }
+
+        controller &con = controllers[ntohl(addr.sin_addr.s_addr)];
+
+        if (con.fresh) {
+            continue;
+        }
+
+        con.prev = con.last;
+        con.have_prev = con.last.uptime_ms != 0 &&
+                con.last.uptime_ms < reply.uptime_ms;
+        con.last = reply;
+        con.fresh = true;
+    }
+}
+
+static void print_table(const std::map<uint32_t, controller> &controllers)
+{
+    std::cout << "address          uptime    fps  under    parts  lost%  "
+            "reord   late   p50   p99   max   heap    min  rssi" <<
+            std::endl;
+    std::cout << "----------------------------------------------------------"
+            "-------------------------------------------------" << std::endl;
+
+    for (auto &entry: controllers) {
+        uint32_t ip = entry.first;
+        const controller &con = entry.second;
+        const stats_reply_t &s = con.last;
+
+        std::string addr = std::to_string(ip >> 24) + "." +
+                std::to_string(ip >> 16 & 255) + "." +
+                std::to_string(ip >> 8 & 255) + "." +
+                std::to_string(ip & 255);
+
+        double fps = 0.0;
+
+        if (con.have_prev) {
+            fps = 1000.0 * (s.n_frames - con.prev.n_frames) /
+                    (s.uptime_ms - con.prev.uptime_ms);
+        }
+
+        uint32_t n_sent = s.n_parts + s.n_lost;
+        double lost = n_sent > 0 ? 100.0 * s.n_lost / n_sent : 0.0;
+
+        std::cout << std::left << std::setw(15) << addr << std::right <<
+                std::fixed << std::setprecision(1) <<
+                std::setw(9) << s.uptime_ms / 1000.0 <<
+                std::setw(7) << fps <<
+                std::setw(7) << s.n_underruns <<
+                std::setw(9) << s.n_parts <<
+                std::setw(7) << std::setprecision(2) << lost <<
+                std::setw(7) << s.n_reordered <<
+                std::setw(7) << s.n_late << std::setprecision(1) <<
+                std::setw(6) << s.latency[0] / 1000.0 <<
+                std::setw(6) << s.latency[2] / 1000.0 <<
+                std::setw(6) << s.latency[3] / 1000.0 <<
+                std::setw(7) << s.free_heap / 1024 <<
+                std::setw(7) << s.min_free_heap / 1024 <<
+                std::setw(6) << (int32_t)s.rssi <<
+                (con.fresh ? "" : "  (no reply)") << std::endl;
+    }
+
+    std::cout << "(latency in ms, heap in KiB, rssi in dBm)" << std::endl;
+
+    print_stages(controllers);
+}
+
+// How long after the host sent them streamed frames got to each stage on
+// their way to the LEDs. The last stage is the display delay.
+static void print_stages(const std::map<uint32_t, controller> &controllers)
+{
+    static const char *const names[LATENCY_N_STAGES] = {
+        "receive", "complete", "publish", "encode", "first-bit"
+    };
+
+    std::cout << std::endl << std::left << std::setw(15) << "address" <<
+            std::right;
+
+    for (const char *name : names) {
+        std::cout << std::setw(12) << name;
+    }
+
+    std::cout << std::endl << std::string(15 + 12 * LATENCY_N_STAGES, '-') <<
+            std::endl;
+
+    for (auto &entry: controllers) {
+        uint32_t ip = entry.first;
+        const stats_reply_t &s = entry.second.last;
+
+        std::string addr = std::to_string(ip >> 24) + "." +
+                std::to_string(ip >> 16 & 255) + "." +
+                std::to_string(ip >> 8 & 255) + "." +
+                std::to_string(ip & 255);
+
+        std::cout << std::left << std::setw(15) << addr << std::right;
+
+        for (uint32_t i = 0; i < LATENCY_N_STAGES; ++i) {
+            std::ostringstream cell;
+            cell << std::fixed << std::setprecision(1) <<
+                    s.stages[i][0] / 1000.0 << "/" << s.stages[i][2] / 1000.0;
+            std::cout << std::setw(12) << cell.str();
+        }
+
+        std::cout << std::endl;
+    }
+
+    std::cout << "(p50/p99 in ms since the host sent the frame)" << std::endl;
+}
+
+static int open_socket(int64_t timeout)
+{
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    assert(sock >= 0);
+
+    timeval tv = {0, (suseconds_t)(timeout * 1000)};
+
+    int32_t res = setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+    assert(res == 0);
+
+    static const int32_t one = 1;
+    res = setsockopt(sock, SOL_SOCKET, SO_BROADCAST, &one, sizeof one);
+    assert(res == 0);
+
+    return sock;
+}
+
+static bool parse_addr(const std::string &str, sockaddr_in &addr)
+{
+    addr = {};
+
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(PROTO_UDP_PORT);
+
+    if (inet_pton(AF_INET, str.c_str(), &addr.sin_addr) != 1) {
+        std::cerr << str << ": bad address" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+static int64_t get_ms()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
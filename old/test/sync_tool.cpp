@@ -0,0 +1,973 @@
+// sync_tool.cpp
+//
+// Copyright (C) 2020 by the contributors
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+
+// --- Includes ----------------------------------------------------------------
+
+#include "test.h"
+
+#include <jitter.h>
+#include <panel.h>
+#include <play.h>
+#include <proto.h>
+#include <show.h>
+#include <sync.h>
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <netinet/in.h>
+#include <random>
+#include <string>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+// --- Types -------------------------------------------------------------------
+
+// --- Constants and macros ----------------------------------------------------
+
+#define SYNC_TIMEOUT 100
+#define SYNC_INTERVAL 20
+
+// Cues are broadcast without acknowledgement, so send them a few times.
+#define CUE_REPEAT 3
+#define CUE_DELAY 500
+
+// Simulated network for sync-bench. One-way delays are a base delay plus an
+// exponentially distributed queueing delay, plus, now and then, a burst of
+// retransmissions.
+#define SIM_BASE_DELAY 1500.0
+#define SIM_MEAN_QUEUE 2000.0
+#define SIM_BURST_RATE 0.05
+#define SIM_MAX_BURST 50000.0
+#define SIM_DRIFT 40e-6
+#define SIM_STEP 3000000
+#define SIM_N_EXCHANGES 1200
+#define SIM_FAST 50000
+#define SIM_SLOW 500000
+
+// sync-bench fails, if the 99th percentile error exceeds this, overall or
+// after the jump, or if the 90th percentile error of the drift estimate, in
+// parts per billion, exceeds SIM_DRIFT_LIMIT.
+#define SIM_LIMIT 500
+#define SIM_DRIFT_LIMIT 15000
+
+// stream-paced hands the kernel at most this many messages per sendmmsg()
+// call, and asks for this much socket buffer, so that a whole frame's worth
+// of messages fits.
+#define MAX_BATCH 1024
+#define SEND_BUF_SZ (8 * 1024 * 1024)
+
+// --- Globals -----------------------------------------------------------------
+
+// --- Helper declarations -----------------------------------------------------
+
+static bool run_cue(command_t command, uint32_t frame_id, int64_t delay);
+static bool send_frame(int sock, const sockaddr_in &addr, uint32_t frame_id,
+        int64_t at, const uint8_t *pixels, size_t frame_sz, uint32_t n_parity,
+        const std::function<bool()> &lose);
+static int open_socket();
+static void broadcast_addr(sockaddr_in &addr);
+static bool join_leader(int sock, sockaddr_in &addr, sync_t &sync);
+static bool find_leader(int sock, sockaddr_in &addr);
+static bool parse_addr(const std::string &str, sockaddr_in &addr);
+static bool exchange(int sock, const sockaddr_in &addr, uint32_t seq,
+        sync_t &sync, int64_t &delay);
+static bool sync_quickly(int sock, const sockaddr_in &addr, sync_t &sync);
+static bool send_all(int sock, mmsghdr *msgs, size_t n_msgs);
+static void sleep_until(const timespec &deadline);
+static int64_t get_ns(clockid_t clock);
+static int64_t get_us();
+static int64_t percentile(std::vector<int64_t> &values, double p);
+
+// --- API ---------------------------------------------------------------------
+
+bool run_sync(int argc, char *argv[])
+{
+    if (argc < 1 || argc > 2) {
+        std::cerr << "usage: test sync address [seconds]" << std::endl;
+        return false;
+    }
+
+    sockaddr_in addr;
+
+    if (!parse_addr(argv[0], addr)) {
+        return false;
+    }
+
+    int64_t seconds = argc > 1 ? std::atoi(argv[1]) : 30;
+    int sock = open_socket();
+
+    sync_t sync;
+    sync_init(&sync);
+
+    std::cout << "   time     offset   drift  delay" << std::endl;
+    std::cout << "---------------------------------" << std::endl;
+
+    int64_t end = get_us() + seconds * 1000000;
+    uint32_t seq = 0;
+
+    while (get_us() < end) {
+        int64_t delay;
+
+        if (exchange(sock, addr, seq, sync, delay) && seq % 10 == 0) {
+            std::cout <<
+                    std::setw(7) << std::fixed << std::setprecision(1) <<
+                    (double)get_us() / 1e6 << " " <<
+                    std::setw(10) << sync.offset << " " <<
+                    std::setw(7) << std::setprecision(2) <<
+                    sync.drift * 1e6 << " " <<
+                    std::setw(6) << delay << std::endl;
+        }
+
+        ++seq;
+        std::this_thread::sleep_for(std::chrono::milliseconds(SYNC_INTERVAL));
+    }
+
+    close(sock);
+
+    if (!sync.valid) {
+        std::cerr << argv[0] << ": no sync replies, not the leader?" <<
+                std::endl;
+    }
+
+    return sync.valid;
+}
+
+bool run_start(int argc, char *argv[])
+{
+    if (argc > 2) {
+        std::cerr << "usage: test start [frame] [delay-ms]" << std::endl;
+        return false;
+    }
+
+    uint32_t frame_id = argc > 0 ? (uint32_t)std::atoi(argv[0]) : 0;
+    int64_t delay = argc > 1 ? std::atoi(argv[1]) : CUE_DELAY;
+
+    return run_cue(COMMAND_START, frame_id, delay);
+}
+
+bool run_stop(int argc, char *argv[])
+{
+    if (argc > 1) {
+        std::cerr << "usage: test stop [delay-ms]" << std::endl;
+        return false;
+    }
+
+    int64_t delay = argc > 0 ? std::atoi(argv[0]) : CUE_DELAY;
+
+    return run_cue(COMMAND_STOP, 0, delay);
+}
+
+bool run_render(int argc, char *argv[])
+{
+    if (argc < 1 || argc > 2) {
+        std::cerr << "usage: test render frame [delay-ms]" << std::endl;
+        return false;
+    }
+
+    uint32_t frame_id = (uint32_t)std::atoi(argv[0]);
+    int64_t delay = argc > 1 ? std::atoi(argv[1]) : CUE_DELAY;
+
+    return run_cue(COMMAND_RENDER_FRAME, frame_id, delay);
+}
+
+// Stream the frames of a show, stamped with the show clock. Loops the show for
+// the given number of seconds, by default once. Optionally adds parity parts
+// and, for testing them, drops the given percentage of parts.
+bool run_stream(int argc, char *argv[])
+{
+    if (argc < 1 || argc > 4) {
+        std::cerr << "usage: test stream in.show [seconds] [parity] " <<
+                "[loss-%]" << std::endl;
+        return false;
+    }
+
+    std::vector<uint8_t> data;
+
+    if (!read_file(argv[0], data)) {
+        return false;
+    }
+
+    show_t show;
+    show_result_t res = show_open(&show, data.data(), data.size());
+
+    if (res != SHOW_OK) {
+        std::cerr << argv[0] << ": " << show_result_str(res) << std::endl;
+        return false;
+    }
+
+    const show_header_t *head = show.head;
+    size_t n_parts = (show.frame_sz + STREAM_PART_SZ - 1) / STREAM_PART_SZ;
+
+    if (head->format != SHOW_FORMAT_RGB || n_parts > JITTER_MAX_PARTS) {
+        std::cerr << argv[0] << ": cannot stream this show" << std::endl;
+        return false;
+    }
+
+    uint32_t n_parity = argc > 2 ? (uint32_t)std::atoi(argv[2]) : 0;
+
+    if (n_parity > JITTER_MAX_PARITY || n_parity > n_parts) {
+        std::cerr << "at most " << std::min<size_t>(JITTER_MAX_PARITY,
+                n_parts) << " parity part(s)" << std::endl;
+        return false;
+    }
+
+    double loss = argc > 3 ? std::atof(argv[3]) / 100.0 : 0.0;
+
+    std::mt19937 rng{std::random_device{}()};
+    std::uniform_real_distribution<double> unit{0.0, 1.0};
+    auto lose = [&]() { return unit(rng) < loss; };
+
+    std::vector<uint8_t> work(show.frame_sz);
+
+    play_t play;
+    play_init(&play, &show, work.data(), nullptr, 0);
+
+    int64_t period = 1000000 / head->fps;
+    int64_t n_frames = argc > 1 ?
+            std::atoi(argv[1]) * (int64_t)head->fps : head->n_frames;
+
+    int sock = open_socket();
+
+    sockaddr_in addr;
+    sync_t sync;
+
+    if (!join_leader(sock, addr, sync)) {
+        close(sock);
+        return false;
+    }
+
+    sockaddr_in out_addr;
+    broadcast_addr(out_addr);
+    out_addr.sin_port = htons(PROTO_STREAM_PORT);
+
+    int64_t start = get_us();
+    uint32_t seq = 0;
+    int64_t frame = 0;
+
+    for (; frame < n_frames; ++frame) {
+        int64_t wait = start + frame * period - get_us();
+
+        if (wait > 0) {
+            std::this_thread::sleep_for(std::chrono::microseconds(wait));
+        }
+
+        uint32_t frame_id = (uint32_t)(frame % head->n_frames);
+        const uint8_t *pixels = play_frame(&play, frame_id);
+
+        if (pixels == nullptr) {
+            std::cerr << argv[0] << ": bad frame " << frame_id << std::endl;
+            break;
+        }
+
+        int64_t at = sync_to_master(&sync, get_us());
+
+        if (!send_frame(sock, out_addr, (uint32_t)frame, at, pixels,
+                show.frame_sz, n_parity, lose)) {
+            std::cerr << "cannot broadcast frame" << std::endl;
+            break;
+        }
+
+        // Keep following the leader's clock. The exchange fits in between
+        // two frames.
+
+        if (frame % head->fps == 0) {
+            int64_t delay;
+            exchange(sock, addr, seq++, sync, delay);
+        }
+    }
+
+    close(sock);
+
+    std::cout << "streamed " << frame << " frame(s) in " <<
+            (get_us() - start) / 1000 << " ms" << std::endl;
+
+    return frame == n_frames;
+}
+
+// Stream a show to many controllers, each of which gets its own, equally sized
+// part of every frame. All messages of a frame go out in one sendmmsg() call,
+// at absolute deadlines. The pixels are sent from where the show player left
+// them, without copying.
+bool run_stream_paced(int argc, char *argv[])
+{
+    if (argc < 4) {
+        std::cerr << "usage: test stream-paced in.show fps seconds " <<
+                "address..." << std::endl;
+        return false;
+    }
+
+    std::vector<uint8_t> data;
+
+    if (!read_file(argv[0], data)) {
+        return false;
+    }
+
+    show_t show;
+    show_result_t res = show_open(&show, data.data(), data.size());
+
+    if (res != SHOW_OK) {
+        std::cerr << argv[0] << ": " << show_result_str(res) << std::endl;
+        return false;
+    }
+
+    int64_t fps = std::atoi(argv[1]);
+    int64_t seconds = std::atoi(argv[2]);
+
+    if (fps < 1 || fps > 1000 || seconds < 1) {
+        std::cerr << "need 1 to 1000 fps, at least 1 second" << std::endl;
+        return false;
+    }
+
+    std::vector<sockaddr_in> addrs((size_t)argc - 3);
+
+    for (size_t i = 0; i < addrs.size(); ++i) {
+        if (!parse_addr(argv[i + 3], addrs[i])) {
+            return false;
+        }
+
+        addrs[i].sin_port = htons(PROTO_STREAM_PORT);
+    }
+
+    // Each controller gets a slice of the frame, which must be a whole number
+    // of pixels per lane and fit into its jitter buffer.
+
+    size_t n_ctrls = addrs.size();
+    size_t n_pixels = show.frame_sz / 3;
+    size_t slice_sz = show.frame_sz / n_ctrls;
+    size_t n_parts = (slice_sz + STREAM_PART_SZ - 1) / STREAM_PART_SZ;
+
+    if (show.head->format != SHOW_FORMAT_RGB ||
+            n_pixels % (n_ctrls * PANEL_N_LANES) != 0 ||
+            n_parts > JITTER_MAX_PARTS) {
+        std::cerr << argv[0] << ": cannot split into " << n_ctrls <<
+                " stream(s)" << std::endl;
+        return false;
+    }
+
+    std::vector<uint8_t> work(show.frame_sz);
+
+    play_t play;
+    play_init(&play, &show, work.data(), nullptr, 0);
+
+    // Set up the messages once. Per frame, only the frame ID, the time stamp
+    // and the pixel pointers change.
+
+    size_t n_msgs = n_ctrls * n_parts;
+
+    std::vector<frame_part_t> heads(n_msgs);
+    std::vector<iovec> iovs(2 * n_msgs);
+    std::vector<mmsghdr> msgs(n_msgs);
+
+    for (size_t i = 0; i < n_msgs; ++i) {
+        size_t part = i % n_parts;
+        size_t offset = part * STREAM_PART_SZ;
+
+        heads[i] = {};
+        heads[i].command = COMMAND_FRAME_DATA;
+        heads[i].part = (uint8_t)part;
+        heads[i].n_parts = (uint8_t)n_parts;
+        heads[i].frame_sz = (uint32_t)slice_sz;
+
+        iovs[2 * i] = { &heads[i], sizeof heads[i] };
+        iovs[2 * i + 1] = { nullptr,
+                std::min<size_t>(STREAM_PART_SZ, slice_sz - offset) };
+
+        msgs[i] = {};
+        msgs[i].msg_hdr.msg_name = &addrs[i / n_parts];
+        msgs[i].msg_hdr.msg_namelen = sizeof addrs[i / n_parts];
+        msgs[i].msg_hdr.msg_iov = &iovs[2 * i];
+        msgs[i].msg_hdr.msg_iovlen = 2;
+    }
+
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    assert(sock >= 0);
+
+    static const int32_t buf_sz = SEND_BUF_SZ;
+    setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &buf_sz, sizeof buf_sz);
+
+    // Keep following the leader's clock on the side, so that exchanges don't
+    // hold up frames.
+
+    int sync_sock = open_socket();
+    sockaddr_in leader;
+    sync_t sync;
+
+    if (!join_leader(sync_sock, leader, sync)) {
+        close(sync_sock);
+        close(sock);
+        return false;
+    }
+
+    std::mutex sync_lock;
+    std::atomic<bool> done{false};
+
+    std::thread follow{[&]() {
+        sync_t next = sync;
+
+        for (uint32_t seq = 0; !done; ++seq) {
+            std::this_thread::sleep_for(std::chrono::seconds{1});
+
+            int64_t delay;
+            exchange(sync_sock, leader, seq, next, delay);
+
+            std::lock_guard<std::mutex> guard{sync_lock};
+            sync = next;
+        }
+    }};
+
+    int64_t period = 1000000000 / fps;
+    int64_t n_frames = seconds * fps;
+    int64_t start = get_ns(CLOCK_MONOTONIC) + period;
+    int64_t cpu = 0;
+    int64_t first_sent = 0;
+    int64_t last_sent = 0;
+
+    std::vector<int64_t> lateness;
+    int64_t frame = 0;
+
+    for (; frame < n_frames; ++frame) {
+        int64_t deadline = start + frame * period;
+        sleep_until({ (time_t)(deadline / 1000000000),
+                (long)(deadline % 1000000000) });
+
+        lateness.push_back(get_ns(CLOCK_MONOTONIC) - deadline);
+
+        int64_t cpu_start = get_ns(CLOCK_THREAD_CPUTIME_ID);
+
+        uint32_t frame_id = (uint32_t)(frame % show.head->n_frames);
+        const uint8_t *pixels = play_frame(&play, frame_id);
+
+        if (pixels == nullptr) {
+            std::cerr << argv[0] << ": bad frame " << frame_id << std::endl;
+            break;
+        }
+
+        int64_t at;
+
+        {
+            std::lock_guard<std::mutex> guard{sync_lock};
+            at = sync_to_master(&sync, get_us());
+        }
+
+        for (size_t i = 0; i < n_msgs; ++i) {
+            heads[i].frame_id = (uint32_t)frame;
+            heads[i].at = at;
+            iovs[2 * i + 1].iov_base = (void *)(uintptr_t)(pixels +
+                    i / n_parts * slice_sz + i % n_parts * STREAM_PART_SZ);
+        }
+
+        bool sent = send_all(sock, msgs.data(), n_msgs);
+        cpu += get_ns(CLOCK_THREAD_CPUTIME_ID) - cpu_start;
+
+        if (!sent) {
+            std::cerr << "cannot send frame" << std::endl;
+            break;
+        }
+
+        last_sent = get_ns(CLOCK_MONOTONIC);
+
+        if (frame == 0) {
+            first_sent = last_sent;
+        }
+    }
+
+    double elapsed = (double)(last_sent - first_sent) / 1e9;
+
+    done = true;
+    follow.join();
+    close(sync_sock);
+    close(sock);
+
+    std::cout << "streamed " << frame << " frame(s) to " << n_ctrls <<
+            " controller(s), " << n_msgs << " message(s) per frame" <<
+            std::endl;
+    std::cout << std::fixed << std::setprecision(1);
+
+    // With a single frame, or none, there is no interval to measure a rate
+    // over.
+    if (elapsed > 0.0) {
+        std::cout << "achieved " << (double)(frame - 1) / elapsed <<
+                " fps of " << fps << std::endl;
+    }
+
+    std::cout << "pacing jitter (us): p50 " <<
+            (double)percentile(lateness, 0.5) / 1000.0 << ", p99 " <<
+            (double)percentile(lateness, 0.99) / 1000.0 << ", max " <<
+            (double)percentile(lateness, 1.0) / 1000.0 << std::endl;
+    std::cout << "send cpu: " << (double)cpu / 1000.0 /
+            (double)std::max<int64_t>(frame, 1) << " us per frame";
+
+    if (elapsed > 0.0) {
+        std::cout << ", " << (double)cpu / 1e7 / elapsed << "% of a core";
+    }
+
+    std::cout << std::endl;
+
+    return frame == n_frames;
+}
+
+// Run the estimator against a simulated leader, whose clock drifts and, half
+// way through, jumps. Reports how far off the estimated show clock is, and
+// how far off it would be, if every exchange were taken at face value.
+bool run_sync_bench(int argc, char *argv[])
+{
+    (void)argv;
+
+    if (argc != 0) {
+        std::cerr << "usage: test sync-bench" << std::endl;
+        return false;
+    }
+
+    std::mt19937 rng{1972};
+    std::exponential_distribution<double> queue{1.0 / SIM_MEAN_QUEUE};
+    std::uniform_real_distribution<double> unit{0.0, 1.0};
+
+    auto one_way = [&]() {
+        double delay = SIM_BASE_DELAY + queue(rng);
+
+        if (unit(rng) < SIM_BURST_RATE) {
+            delay += unit(rng) * SIM_MAX_BURST;
+        }
+
+        return (int64_t)delay;
+    };
+
+    int64_t master_offset = 123456789;
+
+    auto master_time = [&](int64_t local) {
+        return local + master_offset + (int64_t)((double)local * SIM_DRIFT);
+    };
+
+    sync_t sync;
+    sync_init(&sync);
+
+    std::vector<int64_t> errors, naive_errors, jump_errors, drift_errors;
+    int64_t local = 1000000;
+    uint32_t since_reset = 0;
+
+    for (uint32_t i = 0; i < SIM_N_EXCHANGES; ++i) {
+        if (i == SIM_N_EXCHANGES / 2) {
+            master_offset += SIM_STEP;
+        }
+
+        // The leader's processing time is negligible.
+
+        int64_t there = one_way();
+        int64_t back = one_way();
+
+        int64_t t1 = local;
+        int64_t t2 = master_time(t1 + there);
+        int64_t t3 = t2 + 100;
+        int64_t t4 = t1 + there + 100 + back;
+
+        uint32_t n_resets = sync.n_resets;
+
+        if (!sync_add(&sync, t1, t2, t3, t4)) {
+            local = t4 + SIM_FAST;
+            continue;
+        }
+
+        if (sync.n_resets != n_resets) {
+            since_reset = 0;
+        }
+
+        ++since_reset;
+
+        // Judge the estimate once it's had a full set of samples, half way
+        // until the next exchange, i.e., when a frame might be due.
+
+        bool full = sync.n_samples == SYNC_N_SAMPLES;
+        local = t4 + (full ? SIM_SLOW : SIM_FAST);
+
+        if (since_reset <= SYNC_N_SAMPLES) {
+            continue;
+        }
+
+        int64_t check = t4 + (local - t4) / 2;
+        int64_t truth = master_time(check);
+        int64_t naive = check + ((t2 - t1) + (t3 - t4)) / 2;
+
+        int64_t error = std::abs(sync_to_master(&sync, check) - truth);
+
+        errors.push_back(error);
+        naive_errors.push_back(std::abs(naive - truth));
+
+        if (i >= SIM_N_EXCHANGES / 2) {
+            jump_errors.push_back(error);
+        }
+
+        drift_errors.push_back(std::abs((int64_t)((sync.drift - SIM_DRIFT) *
+                1e9)));
+    }
+
+    std::cout << "         p50    p90    p99    max" << std::endl;
+    std::cout << "----------------------------------" << std::endl;
+
+    int64_t p99 = 0;
+
+    for (auto *values: {&errors, &naive_errors}) {
+        std::cout << (values == &errors ? "sync " : "naive") <<
+                std::setw(7) << percentile(*values, 0.5) <<
+                std::setw(7) << percentile(*values, 0.9) <<
+                std::setw(7) << percentile(*values, 0.99) <<
+                std::setw(7) << percentile(*values, 1.0) << std::endl;
+
+        if (values == &errors) {
+            p99 = percentile(*values, 0.99);
+        }
+    }
+
+    // After the jump, the estimator has to start over and must be back to
+    // full accuracy once it has a full set of samples again.
+
+    int64_t jump_p99 = percentile(jump_errors, 0.99);
+    int64_t drift_p90 = percentile(drift_errors, 0.9);
+    size_t min_jump = SIM_N_EXCHANGES / 2 - 2 * SYNC_N_SAMPLES;
+
+    std::cout << "error in us over " << errors.size() << " exchange(s), " <<
+            sync.n_resets << " reset(s)" << std::endl;
+    std::cout << "after the jump: p99 " << jump_p99 << " us over " <<
+            jump_errors.size() << " exchange(s)" << std::endl;
+    std::cout << "drift error p90 " << std::fixed << std::setprecision(2) <<
+            (double)drift_p90 / 1000.0 << " ppm (actual drift " <<
+            SIM_DRIFT * 1e6 << " ppm)" << std::endl;
+
+    bool ok = sync.n_resets == 1 && p99 <= SIM_LIMIT &&
+            jump_errors.size() >= min_jump && jump_p99 <= SIM_LIMIT &&
+            drift_p90 <= SIM_DRIFT_LIMIT;
+    std::cout << (ok ? "ok" : "FAILED") << std::endl;
+
+    return ok;
+}
+
+// --- Helpers -----------------------------------------------------------------
+
+// Cue the show. The controllers' leader keeps the show clock, so get in sync
+// with it first.
+static bool run_cue(command_t command, uint32_t frame_id, int64_t delay)
+{
+    int sock = open_socket();
+
+    sockaddr_in addr;
+    sync_t sync;
+
+    if (!join_leader(sock, addr, sync)) {
+        close(sock);
+        return false;
+    }
+
+    cue_t cue = {};
+
+    cue.command = (uint8_t)command;
+    cue.frame_id = frame_id;
+    cue.at = sync_to_master(&sync, get_us()) + delay * 1000;
+
+    sockaddr_in out_addr;
+    broadcast_addr(out_addr);
+
+    for (int32_t i = 0; i < CUE_REPEAT; ++i) {
+        ssize_t len = sendto(sock, &cue, sizeof cue, 0,
+                (sockaddr *)&out_addr, sizeof out_addr);
+
+        if (len != sizeof cue) {
+            std::cerr << "cannot broadcast cue" << std::endl;
+            close(sock);
+            return false;
+        }
+    }
+
+    std::cout << "cued at show clock " << cue.at << " us" << std::endl;
+
+    close(sock);
+    return true;
+}
+
+// Send a frame in parts, see frame_part_t, followed by n_parity parity parts.
+// Skips the parts that lose() says got lost.
+static bool send_frame(int sock, const sockaddr_in &addr, uint32_t frame_id,
+        int64_t at, const uint8_t *pixels, size_t frame_sz, uint32_t n_parity,
+        const std::function<bool()> &lose)
+{
+    uint8_t buf[sizeof (frame_part_t) + STREAM_PART_SZ];
+    size_t n_parts = (frame_sz + STREAM_PART_SZ - 1) / STREAM_PART_SZ;
+
+    frame_part_t head = {};
+
+    head.command = COMMAND_FRAME_DATA;
+    head.n_parts = (uint8_t)n_parts;
+    head.n_parity = (uint8_t)n_parity;
+    head.frame_id = frame_id;
+    head.at = at;
+    head.frame_sz = (uint32_t)frame_sz;
+
+    for (size_t part = 0; part < n_parts + n_parity; ++part) {
+        size_t offset = part * STREAM_PART_SZ;
+        size_t sz;
+
+        if (part < n_parts) {
+            sz = std::min<size_t>(STREAM_PART_SZ, frame_sz - offset);
+            std::copy_n(pixels + offset, sz, buf + sizeof head);
+        }
+        else {
+            sz = std::min<size_t>(STREAM_PART_SZ, frame_sz);
+            jitter_make_parity(pixels, frame_sz, STREAM_PART_SZ, n_parity,
+                    (uint32_t)(part - n_parts), buf + sizeof head);
+        }
+
+        if (lose()) {
+            continue;
+        }
+
+        head.part = (uint8_t)part;
+        std::copy_n((const uint8_t *)&head, sizeof head, buf);
+
+        ssize_t len = sendto(sock, buf, sizeof head + sz, 0,
+                (const sockaddr *)&addr, sizeof addr);
+
+        if (len != (ssize_t)(sizeof head + sz)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Open a socket that may broadcast and that doesn't wait long for replies.
+static int open_socket()
+{
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    assert(sock >= 0);
+
+    static const timeval timeout = {0, SYNC_TIMEOUT * 1000};
+
+    int32_t res = setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+            sizeof timeout);
+    assert(res == 0);
+
+    static const int32_t one = 1;
+    res = setsockopt(sock, SOL_SOCKET, SO_BROADCAST, &one, sizeof one);
+    assert(res == 0);
+
+    return sock;
+}
+
+static void broadcast_addr(sockaddr_in &addr)
+{
+    addr = {};
+
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(PROTO_UDP_PORT);
+    addr.sin_addr.s_addr = inet_addr(broadcast_ip());
+}
+
+// Find the controllers' leader, which keeps the show clock, and get in sync
+// with it.
+static bool join_leader(int sock, sockaddr_in &addr, sync_t &sync)
+{
+    if (!find_leader(sock, addr)) {
+        std::cerr << "no leader" << std::endl;
+        return false;
+    }
+
+    sync_init(&sync);
+
+    if (!sync_quickly(sock, addr, sync)) {
+        std::cerr << inet_ntoa(addr.sin_addr) << ": no sync replies" <<
+                std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+// Ask around for the leader. Ping replies say whether the sender leads.
+static bool find_leader(int sock, sockaddr_in &addr)
+{
+    sockaddr_in out_addr;
+    broadcast_addr(out_addr);
+
+    uint8_t ping[2] = { COMMAND_PING, 0 };
+
+    ssize_t len = sendto(sock, ping, sizeof ping, 0, (sockaddr *)&out_addr,
+            sizeof out_addr);
+
+    if (len != sizeof ping) {
+        return false;
+    }
+
+    while (true) {
+        ping_reply_t reply;
+        socklen_t addr_len = sizeof addr;
+
+        len = recvfrom(sock, &reply, sizeof reply, 0, (sockaddr *)&addr,
+                &addr_len);
+
+        if (len < 0) {
+            return false;
+        }
+
+        if (len == sizeof reply && reply.seq == ping[1] && reply.leader != 0) {
+            addr.sin_port = htons(PROTO_UDP_PORT);
+            return true;
+        }
+    }
+}
+
+static bool parse_addr(const std::string &str, sockaddr_in &addr)
+{
+    addr = {};
+
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(PROTO_UDP_PORT);
+
+    if (inet_pton(AF_INET, str.c_str(), &addr.sin_addr) != 1) {
+        std::cerr << str << ": bad address" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+static bool exchange(int sock, const sockaddr_in &addr, uint32_t seq,
+        sync_t &sync, int64_t &delay)
+{
+    sync_request_t req = {};
+
+    req.command = COMMAND_SYNC;
+    req.seq = seq;
+    req.t1 = get_us();
+
+    ssize_t len = sendto(sock, &req, sizeof req, 0, (const sockaddr *)&addr,
+            sizeof addr);
+
+    if (len != sizeof req) {
+        return false;
+    }
+
+    sync_reply_t reply;
+
+    // Skip anything else, e.g., late replies to a broadcast ping.
+
+    do {
+        len = recv(sock, &reply, sizeof reply, 0);
+
+        if (len < 0) {
+            return false;
+        }
+    }
+    while (len != sizeof reply || reply.command != COMMAND_SYNC ||
+            reply.seq != seq);
+
+    int64_t t4 = get_us();
+
+    if (reply.result != RESULT_OK) {
+        return false;
+    }
+
+    delay = t4 - reply.t1 - (reply.t3 - reply.t2);
+
+    return sync_add(&sync, reply.t1, reply.t2, reply.t3, t4);
+}
+
+// Collect a full set of samples as fast as the leader answers. Good enough
+// for the offset, which is all that a cue a second from now needs.
+static bool sync_quickly(int sock, const sockaddr_in &addr, sync_t &sync)
+{
+    for (uint32_t seq = 0; seq < 2 * SYNC_N_SAMPLES; ++seq) {
+        int64_t delay;
+        exchange(sock, addr, seq, sync, delay);
+
+        if (sync.n_samples == SYNC_N_SAMPLES) {
+            break;
+        }
+    }
+
+    return sync.valid;
+}
+
+// Send the given messages, in as few system calls as possible.
+static bool send_all(int sock, mmsghdr *msgs, size_t n_msgs)
+{
+    while (n_msgs > 0) {
+        int n = sendmmsg(sock, msgs, (uint32_t)std::min<size_t>(n_msgs,
+                MAX_BATCH), 0);
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (n <= 0) {
+            return false;
+        }
+
+        msgs += n;
+        n_msgs -= (size_t)n;
+    }
+
+    return true;
+}
+
+// Sleep until the given CLOCK_MONOTONIC time. Absolute deadlines don't add up
+// the time spent between sleeps.
+static void sleep_until(const timespec &deadline)
+{
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline,
+            nullptr) == EINTR) {
+    }
+}
+
+static int64_t get_ns(clockid_t clock)
+{
+    timespec now;
+
+    int32_t res = clock_gettime(clock, &now);
+    assert(res == 0);
+
+    return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static int64_t get_us()
+{
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::microseconds>(now).count();
+}
+
+static int64_t percentile(std::vector<int64_t> &values, double p)
+{
+    if (values.empty()) {
+        return 0;
+    }
+
+    std::sort(values.begin(), values.end());
+
+    size_t i = (size_t)(p * (double)(values.size() - 1));
+    return values[i];
+}
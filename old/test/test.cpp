@@ -17,44 +17,34 @@
 
 // --- Includes ----------------------------------------------------------------
 
+#include "test.h"
+
+#include <proto.h>
+
 #include <arpa/inet.h>
 #include <cassert>
 #include <cmath>
 #include <cstddef>
 #include <cstdint>
+#include <cstdlib>
 #include <errno.h>
+#include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <map>
+#include <set>
 #include <netinet/in.h>
 #include <sys/socket.h>
 #include <sys/time.h>
+#include <string>
 #include <sys/types.h>
 #include <unistd.h>
 #include <vector>
 
 // --- Types -------------------------------------------------------------------
 
-enum command_t {
-    COMMAND_PING,
-    COMMAND_UPLOAD,
-    COMMAND_PREPARE,
-    COMMAND_START,
-    COMMAND_STOP,
-    COMMAND_RENDER_FRAME
-};
-
-enum result_t {
-    RESULT_OK,
-    RESULT_NOT_MASTER
-};
-
 // --- Constants and macros ----------------------------------------------------
 
-#define BROADCAST_IP "10.255.255.255"
-
-#define UDP_PORT 1972
-
 #define PING_COUNT 1000
 #define PING_INTERVAL 20
 #define PING_TIMEOUT 100
@@ -83,15 +73,180 @@ int main(int argc, char *argv[])
         return 0;
     }
 
+    if (command == "ping-bench") {
+        return run_ping_bench(argc - 2, argv + 2) ? 0 : 1;
+    }
+
+    if (command == "show-make") {
+        return run_show_make(argc - 2, argv + 2) ? 0 : 1;
+    }
+
+    if (command == "show-check") {
+        return run_show_check(argc - 2, argv + 2) ? 0 : 1;
+    }
+
+    if (command == "show-wave") {
+        return run_show_wave(argc - 2, argv + 2) ? 0 : 1;
+    }
+
+    if (command == "show-preview") {
+        return run_show_preview(argc - 2, argv + 2) ? 0 : 1;
+    }
+
+    if (command == "upload") {
+        return run_upload(argc - 2, argv + 2) ? 0 : 1;
+    }
+
+    if (command == "upload-bench") {
+        return run_upload_bench(argc - 2, argv + 2) ? 0 : 1;
+    }
+
+    if (command == "sync") {
+        return run_sync(argc - 2, argv + 2) ? 0 : 1;
+    }
+
+    if (command == "sync-bench") {
+        return run_sync_bench(argc - 2, argv + 2) ? 0 : 1;
+    }
+
+    if (command == "start") {
+        return run_start(argc - 2, argv + 2) ? 0 : 1;
+    }
+
+    if (command == "stop") {
+        return run_stop(argc - 2, argv + 2) ? 0 : 1;
+    }
+
+    if (command == "render") {
+        return run_render(argc - 2, argv + 2) ? 0 : 1;
+    }
+
+    if (command == "elect-bench") {
+        return run_elect_bench(argc - 2, argv + 2) ? 0 : 1;
+    }
+
+    if (command == "stream") {
+        return run_stream(argc - 2, argv + 2) ? 0 : 1;
+    }
+
+    if (command == "stream-paced") {
+        return run_stream_paced(argc - 2, argv + 2) ? 0 : 1;
+    }
+
+    if (command == "sim") {
+        return run_sim(argc - 2, argv + 2) ? 0 : 1;
+    }
+
+    if (command == "jitter-bench") {
+        return run_jitter_bench(argc - 2, argv + 2) ? 0 : 1;
+    }
+
+    if (command == "fec-bench") {
+        return run_fec_bench(argc - 2, argv + 2) ? 0 : 1;
+    }
+
+    if (command == "core-bench") {
+        return run_core_bench(argc - 2, argv + 2) ? 0 : 1;
+    }
+
+    if (command == "encode-golden") {
+        return run_encode_golden(argc - 2, argv + 2) ? 0 : 1;
+    }
+
+    if (command == "encode-check") {
+        return run_encode_check(argc - 2, argv + 2) ? 0 : 1;
+    }
+
+    if (command == "profile") {
+        return run_profile(argc - 2, argv + 2) ? 0 : 1;
+    }
+
+    if (command == "stats") {
+        return run_stats(argc - 2, argv + 2) ? 0 : 1;
+    }
+
     usage();
 	return 1;
 }
 
+// --- API ---------------------------------------------------------------------
+
+const char *broadcast_ip()
+{
+    const char *ip = std::getenv("NN_BROADCAST");
+    return ip != nullptr ? ip : BROADCAST_IP;
+}
+
+bool read_file(const std::string &path, std::vector<uint8_t> &data)
+{
+    std::ifstream in{path, std::ios::binary};
+
+    if (!in) {
+        std::cerr << path << ": cannot open" << std::endl;
+        return false;
+    }
+
+    data.assign(std::istreambuf_iterator<char>{in},
+            std::istreambuf_iterator<char>{});
+
+    if (in.bad()) {
+        std::cerr << path << ": cannot read" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool write_file(const std::string &path, const std::vector<uint8_t> &data)
+{
+    std::ofstream out{path, std::ios::binary | std::ios::trunc};
+
+    out.write((const char *)data.data(), (std::streamsize)data.size());
+    out.close();
+
+    if (!out) {
+        std::cerr << path << ": cannot write" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
 // --- Helpers -----------------------------------------------------------------
 
 static void usage()
 {
-    std::cerr << "usage: cli ping" << std::endl;
+    std::cerr <<
+            "usage: cli ping" << std::endl <<
+            "       cli ping-bench [seconds] [rate] [out.csv] [label]" <<
+            std::endl <<
+            "       cli show-make in.rgb out.show width height fps "
+                    "[key-interval]" << std::endl <<
+            "       cli show-check in.show" << std::endl <<
+            "       cli show-wave in.show out.show" << std::endl <<
+            "       cli show-preview in.show out.ppm|out.y4m|- [frames]" <<
+            std::endl <<
+            "       cli upload in.show address..." << std::endl <<
+            "       cli upload-bench [megabytes] [nodes]" << std::endl <<
+            "       cli sync address [seconds]" << std::endl <<
+            "       cli sync-bench" << std::endl <<
+            "       cli start [frame] [delay-ms]" << std::endl <<
+            "       cli stop [delay-ms]" << std::endl <<
+            "       cli render frame [delay-ms]" << std::endl <<
+            "       cli elect-bench" << std::endl <<
+            "       cli stream in.show [seconds] [parity] [loss-%]" <<
+            std::endl <<
+            "       cli stream-paced in.show fps seconds address..." <<
+            std::endl <<
+            "       cli sim count [latency-ms] [loss-%] [seconds]" <<
+            std::endl <<
+            "       cli jitter-bench" << std::endl <<
+            "       cli fec-bench" << std::endl <<
+            "       cli core-bench [ms-per-case]" << std::endl <<
+            "       cli encode-golden out.golden" << std::endl <<
+            "       cli encode-check in.golden" << std::endl <<
+            "       cli profile address [reset]" << std::endl <<
+            "       cli stats seconds [address...]" << std::endl;
 }
 
 static void run_ping()
@@ -112,15 +267,17 @@ static void run_ping()
     sockaddr_in out_addr;
 
     out_addr.sin_family = AF_INET;
-    out_addr.sin_port = htons(UDP_PORT);
-    out_addr.sin_addr.s_addr = inet_addr(BROADCAST_IP);
+    out_addr.sin_port = htons(PROTO_UDP_PORT);
+    out_addr.sin_addr.s_addr = inet_addr(broadcast_ip());
 
     int32_t count;
     uint64_t out_us, now_us, delay_us, rtt_us;
-    uint8_t out_buffer[2], in_buffer[2];
+    uint8_t out_buffer[2];
+    ping_reply_t reply;
     ssize_t len;
 
     std::map<std::string, std::vector<uint32_t>> rtt_map;
+    std::set<std::string> leaders;
 
     for (count = 0; count < PING_COUNT; ++count) {
         if (count % 100 == 0) {
@@ -141,7 +298,7 @@ static void run_ping()
             sockaddr_storage in_addr;
             socklen_t in_addr_len = sizeof in_addr;
 
-            len = recvfrom(sock, in_buffer, sizeof in_buffer, 0,
+            len = recvfrom(sock, &reply, sizeof reply, 0,
                     (sockaddr *)&in_addr, &in_addr_len);
 
             if (len < 0) {
@@ -149,19 +306,24 @@ static void run_ping()
                 break;
             }
 
-            assert(len == 2);
+            assert(len == sizeof reply);
             assert(in_addr_len == sizeof (sockaddr_in));
 
-            if (in_buffer[0] != (uint8_t)count) {
+            if (reply.seq != (uint8_t)count) {
                 continue;
             }
 
-            rtt_us = get_us() - out_us;
+            // Without the time that the controller held the reply.
+            rtt_us = get_us() - out_us - reply.held;
 
             const sockaddr_in *in_addr_v4 = (sockaddr_in *)&in_addr;
             const std::string str(inet_ntoa(in_addr_v4->sin_addr));
 
             rtt_map[str].push_back((uint32_t)rtt_us);
+
+            if (reply.leader != 0) {
+                leaders.insert(str);
+            }
         }
 
         now_us = get_us();
@@ -174,8 +336,10 @@ static void run_ping()
 
     close(sock);
 
-    std::cout << "        address    min    avg    max    std    #" << std::endl;
-    std::cout << "------------------------------------------------" << std::endl;
+    std::cout << "        address    min    avg    max    std    # L" <<
+            std::endl;
+    std::cout << "--------------------------------------------------" <<
+            std::endl;
 
     for (auto kv: rtt_map) {
         const std::string &addr = kv.first;
@@ -219,7 +383,8 @@ static void run_ping()
                 std::setw(6) << std::setprecision(5) << avg << " " <<
                 std::setw(6) << std::setprecision(5) << max << " " <<
                 std::setw(6) << std::setprecision(5) << std << " " <<
-                std::setw(4) << rtts.size() << std::endl;
+                std::setw(4) << rtts.size() << " " <<
+                (leaders.count(addr) != 0 ? "*" : " ") << std::endl;
     }
 }
 
@@ -0,0 +1,71 @@
+// test.h
+//
+// Copyright (C) 2020 by the contributors
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+// --- Includes ----------------------------------------------------------------
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// --- Types -------------------------------------------------------------------
+
+// --- Constants and macros ----------------------------------------------------
+
+// Where broadcasts go, unless the NN_BROADCAST environment variable says
+// otherwise, see broadcast_ip().
+#define BROADCAST_IP "10.255.255.255"
+
+// --- Globals -----------------------------------------------------------------
+
+// --- API ---------------------------------------------------------------------
+
+// Commands. Each one gets the arguments following the command name and returns
+// true on success.
+bool run_show_make(int argc, char *argv[]);
+bool run_show_check(int argc, char *argv[]);
+bool run_show_wave(int argc, char *argv[]);
+bool run_show_preview(int argc, char *argv[]);
+bool run_upload(int argc, char *argv[]);
+bool run_upload_bench(int argc, char *argv[]);
+bool run_sync(int argc, char *argv[]);
+bool run_sync_bench(int argc, char *argv[]);
+bool run_start(int argc, char *argv[]);
+bool run_stop(int argc, char *argv[]);
+bool run_render(int argc, char *argv[]);
+bool run_elect_bench(int argc, char *argv[]);
+bool run_stream(int argc, char *argv[]);
+bool run_jitter_bench(int argc, char *argv[]);
+bool run_fec_bench(int argc, char *argv[]);
+bool run_profile(int argc, char *argv[]);
+bool run_stats(int argc, char *argv[]);
+bool run_ping_bench(int argc, char *argv[]);
+bool run_stream_paced(int argc, char *argv[]);
+bool run_sim(int argc, char *argv[]);
+bool run_core_bench(int argc, char *argv[]);
+bool run_encode_golden(int argc, char *argv[]);
+bool run_encode_check(int argc, char *argv[]);
+
+// Get the broadcast address, e.g., that of virtual controllers, see run_sim().
+const char *broadcast_ip();
+
+// Read an entire file. Returns false and complains on failure.
+bool read_file(const std::string &path, std::vector<uint8_t> &data);
+
+// Write an entire file. Returns false and complains on failure.
+bool write_file(const std::string &path, const std::vector<uint8_t> &data);
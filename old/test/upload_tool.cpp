@@ -0,0 +1,553 @@
+// upload_tool.cpp
+//
+// Copyright (C) 2020 by the contributors
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+
+// --- Includes ----------------------------------------------------------------
+
+#include "test.h"
+
+#include <crc.h>
+#include <proto.h>
+#include <xfer.h>
+
+#include <arpa/inet.h>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <random>
+#include <string>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// --- Types -------------------------------------------------------------------
+
+struct upload_stats {
+    std::string addr;
+    bool ok = false;
+    int32_t n_attempts = 0;
+    uint32_t n_chunks = 0;
+    uint32_t n_resent = 0;
+    double seconds = 0.0;
+};
+
+// Stands in for a controller: speaks the device side of the upload protocol
+// and writes to memory instead of flash. Drops the connection once and
+// reports a bad CRC once, so that every run exercises resuming and resending.
+class stand_in {
+public:
+    stand_in(uint32_t drop_at, uint32_t corrupt_at);
+    ~stand_in();
+
+    uint16_t port() const { return port_; }
+    bool complete() const { return complete_; }
+
+private:
+    void serve();
+    void handle_connection(int sock);
+
+    int listen_sock_;
+    uint16_t port_;
+    std::thread thread_;
+
+    uint32_t drop_at_;
+    uint32_t corrupt_at_;
+
+    std::vector<uint8_t> flash_;
+    xfer_t xfer_ = {};
+    std::atomic<bool> complete_{false};
+};
+
+// --- Constants and macros ----------------------------------------------------
+
+#define MAX_ATTEMPTS 5
+#define RETRY_DELAY 1000
+#define ACK_TIMEOUT 10
+
+#define BENCH_SIZE 16
+#define BENCH_NODES 8
+
+// The most that a stand-in takes, in megabytes.
+#define BENCH_MAX_SIZE 256
+
+// --- Globals -----------------------------------------------------------------
+
+// --- Helper declarations -----------------------------------------------------
+
+static void upload(const sockaddr_in &addr, const std::vector<uint8_t> &data,
+        upload_stats &stats);
+static bool upload_once(const sockaddr_in &addr,
+        const std::vector<uint8_t> &data, uint32_t crc, upload_stats &stats,
+        bool &retry);
+static void print_stats(const std::vector<upload_stats> &stats, size_t sz);
+static bool send_all(int sock, const void *data, size_t sz);
+static bool recv_all(int sock, void *data, size_t sz);
+
+// --- API ---------------------------------------------------------------------
+
+bool run_upload(int argc, char *argv[])
+{
+    if (argc < 2) {
+        std::cerr << "usage: upload in.show address..." << std::endl;
+        return false;
+    }
+
+    std::vector<uint8_t> data;
+
+    if (!read_file(argv[0], data)) {
+        return false;
+    }
+
+    std::vector<upload_stats> stats((size_t)argc - 1);
+    std::vector<std::thread> threads;
+
+    for (int32_t i = 1; i < argc; ++i) {
+        sockaddr_in addr;
+
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(PROTO_TCP_PORT);
+
+        if (inet_pton(AF_INET, argv[i], &addr.sin_addr) != 1) {
+            std::cerr << argv[i] << ": bad address" << std::endl;
+            return false;
+        }
+
+        upload_stats &st = stats[(size_t)i - 1];
+        st.addr = argv[i];
+
+        threads.emplace_back(upload, addr, std::cref(data), std::ref(st));
+    }
+
+    bool ok = true;
+
+    for (size_t i = 0; i < threads.size(); ++i) {
+        threads[i].join();
+        ok = ok && stats[i].ok;
+    }
+
+    print_stats(stats, data.size());
+    return ok;
+}
+
+bool run_upload_bench(int argc, char *argv[])
+{
+    if (argc > 2) {
+        std::cerr << "usage: upload-bench [megabytes] [nodes]" << std::endl;
+        return false;
+    }
+
+    size_t mb = argc > 0 ? (size_t)std::atoi(argv[0]) : BENCH_SIZE;
+    size_t n_nodes = argc > 1 ? (size_t)std::atoi(argv[1]) : BENCH_NODES;
+
+    if (mb == 0 || mb > BENCH_MAX_SIZE || n_nodes == 0) {
+        std::cerr << "bad size or node count" << std::endl;
+        return false;
+    }
+
+    std::vector<uint8_t> data(mb << 20);
+    std::mt19937 gen{1972};
+
+    for (auto &byte: data) {
+        byte = (uint8_t)gen();
+    }
+
+    // Drop the connection a little before half-way. Corrupt a chunk at
+    // three quarters.
+
+    uint32_t drop_at = (uint32_t)data.size() / 2 - 3 * UPLOAD_CHUNK_SZ;
+    uint32_t corrupt_at = (uint32_t)data.size() / 4 * 3;
+
+    std::vector<std::unique_ptr<stand_in>> nodes;
+    std::vector<upload_stats> stats(n_nodes);
+    std::vector<std::thread> threads;
+
+    for (size_t i = 0; i < n_nodes; ++i) {
+        nodes.emplace_back(new stand_in{drop_at, corrupt_at});
+        stats[i].addr = "127.0.0.1:" + std::to_string(nodes[i]->port());
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (size_t i = 0; i < n_nodes; ++i) {
+        sockaddr_in addr;
+
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(nodes[i]->port());
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        threads.emplace_back(upload, addr, std::cref(data),
+                std::ref(stats[i]));
+    }
+
+    bool ok = true;
+
+    for (size_t i = 0; i < n_nodes; ++i) {
+        threads[i].join();
+        ok = ok && stats[i].ok && nodes[i]->complete();
+    }
+
+    auto end = std::chrono::steady_clock::now();
+    double secs = std::chrono::duration<double>(end - start).count();
+
+    print_stats(stats, data.size());
+
+    std::cout << "aggregate " << std::setprecision(4) <<
+            (double)(data.size() * n_nodes) / secs / 1e6 << " MB/s" <<
+            std::endl;
+
+    return ok;
+}
+
+// --- Helpers -----------------------------------------------------------------
+
+static void upload(const sockaddr_in &addr, const std::vector<uint8_t> &data,
+        upload_stats &stats)
+{
+    uint32_t crc = crc_32(CRC_INIT, data.data(), data.size());
+    auto start = std::chrono::steady_clock::now();
+
+    // Resume after a lost connection. The controller remembers how far we
+    // got.
+
+    for (stats.n_attempts = 1; stats.n_attempts <= MAX_ATTEMPTS;
+            ++stats.n_attempts) {
+        bool retry;
+
+        if (upload_once(addr, data, crc, stats, retry)) {
+            stats.ok = true;
+            break;
+        }
+
+        if (!retry) {
+            break;
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(RETRY_DELAY));
+    }
+
+    auto end = std::chrono::steady_clock::now();
+    stats.seconds = std::chrono::duration<double>(end - start).count();
+}
+
+static bool upload_once(const sockaddr_in &addr,
+        const std::vector<uint8_t> &data, uint32_t crc, upload_stats &stats,
+        bool &retry)
+{
+    retry = true;
+
+    int32_t sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    assert(sock >= 0);
+
+    static const timeval timeout = {ACK_TIMEOUT, 0};
+    static const int32_t one = 1;
+    int32_t res;
+
+    res = setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+    assert(res == 0);
+
+    res = setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+    assert(res == 0);
+
+    if (connect(sock, (const sockaddr *)&addr, sizeof addr) < 0) {
+        close(sock);
+        return false;
+    }
+
+    const uint32_t total_sz = (uint32_t)data.size();
+
+    upload_begin_t begin;
+    memset(&begin, 0, sizeof begin);
+
+    begin.command = COMMAND_UPLOAD;
+    begin.total_sz = total_sz;
+    begin.crc = crc;
+
+    upload_ack_t ack;
+
+    if (!send_all(sock, &begin, sizeof begin) ||
+            !recv_all(sock, &ack, sizeof ack)) {
+        close(sock);
+        return false;
+    }
+
+    if (ack.result == RESULT_TOO_LARGE) {
+        std::cerr << stats.addr << ": upload refused, " << total_sz <<
+                " byte(s) don't fit into the show partition" << std::endl;
+        retry = false;
+        close(sock);
+        return false;
+    }
+
+    if (ack.result != RESULT_OK) {
+        std::cerr << stats.addr << ": upload refused (" <<
+                (int32_t)ack.result << ")" << std::endl;
+        retry = false;
+        close(sock);
+        return false;
+    }
+
+    // Keep up to UPLOAD_WINDOW chunks in flight. Acknowledgements are
+    // cumulative.
+
+    uint32_t acked = ack.offset;
+    uint32_t next = ack.offset;
+
+    const uint32_t window_sz = UPLOAD_WINDOW * UPLOAD_CHUNK_SZ;
+
+    while (acked < total_sz) {
+        while (next < total_sz && next - acked < window_sz) {
+            upload_chunk_t head;
+
+            head.offset = next;
+            head.sz = total_sz - next < UPLOAD_CHUNK_SZ ?
+                    total_sz - next : UPLOAD_CHUNK_SZ;
+            head.crc = crc_32(CRC_INIT, data.data() + next, head.sz);
+
+            if (!send_all(sock, &head, sizeof head) ||
+                    !send_all(sock, data.data() + next, head.sz)) {
+                close(sock);
+                return false;
+            }
+
+            next += head.sz;
+            ++stats.n_chunks;
+        }
+
+        if (!recv_all(sock, &ack, sizeof ack)) {
+            close(sock);
+            return false;
+        }
+
+        switch (ack.result) {
+        case RESULT_OK:
+            if (ack.offset > acked) {
+                acked = ack.offset;
+            }
+
+            break;
+
+        case RESULT_BAD_CRC:
+            stats.n_resent += (next - ack.offset + UPLOAD_CHUNK_SZ - 1) /
+                    UPLOAD_CHUNK_SZ;
+            next = ack.offset;
+            break;
+
+        default:
+            std::cerr << stats.addr << ": upload failed (" <<
+                    (int32_t)ack.result << ")" << std::endl;
+            retry = false;
+            close(sock);
+            return false;
+        }
+    }
+
+    close(sock);
+    return true;
+}
+
+static void print_stats(const std::vector<upload_stats> &stats, size_t sz)
+{
+    std::cout << "                address   MB/s  tries  chunks  resent  ok" <<
+            std::endl;
+    std::cout << "-------------------------------------------------------" <<
+            std::endl;
+
+    for (const auto &st: stats) {
+        std::cout <<
+                std::setw(23) << st.addr << " " <<
+                std::setw(6) << std::setprecision(4) <<
+                        (double)sz / st.seconds / 1e6 << " " <<
+                std::setw(6) << st.n_attempts << " " <<
+                std::setw(7) << st.n_chunks << " " <<
+                std::setw(7) << st.n_resent << " " <<
+                std::setw(3) << (st.ok ? "yes" : "no") << std::endl;
+    }
+}
+
+static bool send_all(int sock, const void *data, size_t sz)
+{
+    const uint8_t *data_8 = (const uint8_t *)data;
+
+    while (sz > 0) {
+        ssize_t len = send(sock, data_8, sz, MSG_NOSIGNAL);
+
+        if (len <= 0) {
+            return false;
+        }
+
+        data_8 += len;
+        sz -= (size_t)len;
+    }
+
+    return true;
+}
+
+static bool recv_all(int sock, void *data, size_t sz)
+{
+    uint8_t *data_8 = (uint8_t *)data;
+
+    while (sz > 0) {
+        ssize_t len = recv(sock, data_8, sz, 0);
+
+        if (len <= 0) {
+            return false;
+        }
+
+        data_8 += len;
+        sz -= (size_t)len;
+    }
+
+    return true;
+}
+
+stand_in::stand_in(uint32_t drop_at, uint32_t corrupt_at) :
+    drop_at_{drop_at},
+    corrupt_at_{corrupt_at}
+{
+    listen_sock_ = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    assert(listen_sock_ >= 0);
+
+    sockaddr_in addr;
+    socklen_t addr_len = sizeof addr;
+
+    addr.sin_family = AF_INET;
+    addr.sin_port = 0;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    int32_t res = bind(listen_sock_, (const sockaddr *)&addr, sizeof addr);
+    assert(res == 0);
+
+    res = listen(listen_sock_, 1);
+    assert(res == 0);
+
+    res = getsockname(listen_sock_, (sockaddr *)&addr, &addr_len);
+    assert(res == 0);
+
+    port_ = ntohs(addr.sin_port);
+    thread_ = std::thread{&stand_in::serve, this};
+}
+
+stand_in::~stand_in()
+{
+    shutdown(listen_sock_, SHUT_RDWR);
+    thread_.join();
+    close(listen_sock_);
+}
+
+void stand_in::serve()
+{
+    while (true) {
+        int32_t sock = accept(listen_sock_, NULL, NULL);
+
+        if (sock < 0) {
+            break;
+        }
+
+        handle_connection(sock);
+        close(sock);
+    }
+}
+
+void stand_in::handle_connection(int sock)
+{
+    upload_begin_t begin;
+    upload_ack_t ack;
+
+    if (!recv_all(sock, &begin, sizeof begin) ||
+            begin.command != COMMAND_UPLOAD) {
+        return;
+    }
+
+    bool same = xfer_same(&xfer_.progress, &begin);
+    result_t res = xfer_begin(&xfer_, &begin, (uint32_t)BENCH_MAX_SIZE << 20,
+            &xfer_.progress);
+
+    if (res != RESULT_OK) {
+        xfer_ack(&ack, res, 0);
+        send_all(sock, &ack, sizeof ack);
+        return;
+    }
+
+    if (!same) {
+        complete_ = false;
+        flash_.assign(xfer_.progress.total_sz, 0xff);
+    }
+
+    xfer_ack(&ack, RESULT_OK, xfer_.expect);
+
+    if (!send_all(sock, &ack, sizeof ack)) {
+        return;
+    }
+
+    std::vector<uint8_t> buf(UPLOAD_CHUNK_SZ);
+
+    while (xfer_.progress.offset < xfer_.progress.total_sz) {
+        if (xfer_.progress.offset == drop_at_) {
+            drop_at_ = UINT32_MAX;
+            return;
+        }
+
+        upload_chunk_t head;
+
+        if (!recv_all(sock, &head, sizeof head) || !xfer_check(&xfer_, &head) ||
+                !recv_all(sock, buf.data(), head.sz)) {
+            return;
+        }
+
+        // Pretend that the chunk got corrupted on the way, once.
+
+        if (head.offset == corrupt_at_ && head.offset == xfer_.expect) {
+            corrupt_at_ = UINT32_MAX;
+            buf[0] ^= 1;
+        }
+
+        xfer_action_t action = xfer_take(&xfer_, &head, buf.data());
+
+        if (action == XFER_SKIP) {
+            continue;
+        }
+
+        if (action == XFER_RESEND) {
+            xfer_ack(&ack, RESULT_BAD_CRC, xfer_.expect);
+        }
+        else {
+            memcpy(flash_.data() + head.offset, buf.data(), head.sz);
+            res = RESULT_OK;
+
+            if (xfer_stored(&xfer_, head.offset, head.sz)) {
+                complete_ = crc_32(CRC_INIT, flash_.data(), flash_.size()) ==
+                        xfer_.progress.crc;
+                res = complete_ ? RESULT_OK : RESULT_BAD_SHOW;
+            }
+
+            xfer_ack(&ack, res, xfer_.progress.offset);
+        }
+
+        if (!send_all(sock, &ack, sizeof ack)) {
+            return;
+        }
+    }
+}